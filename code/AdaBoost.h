@@ -0,0 +1,382 @@
+/**
+ * @file AdaBoost.h
+ * @brief C++ implementation of multi-class AdaBoost of decision trees.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @class AdaBoost
+ * @brief Class to train and run an AdaBoost (SAMME) ensemble of trees.
+ *
+ * This is the algorithm of TrainAdaBoost.m, with the trees kept in memory.
+ * Each round trains a tree on the current weights, decides the training
+ * rows with the compiled tree, and then, for K labels,
+ *
+ *     err   = sum of the weights of misclassified rows
+ *     alpha = log((1 - err) / err) + log(K - 1)
+ *     W     = W * exp(alpha) on misclassified rows, normalized to sum 1
+ *
+ * with err clamped to [1e-10, 1 - 1/K - 1e-10]. The weights are updated in
+ * place in one buffer, which Data::W points to while training. The votes
+ * of the trees so far are cached for the training rows, so the training
+ * error of the ensemble after each round costs one pass over the rows of
+ * the new tree only.
+ *
+ * The ensemble decides by weighted votes, as RunAdaBoost.m: each tree adds
+ * its alpha to the label it decides, and P is the votes divided by the sum
+ * of alphas. ModelFile::saveBoost() writes the trees and their alphas to
+ * one model file.
+ */
+
+#ifndef AdaBoost_H
+#define AdaBoost_H
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include "DecisionTree.h"
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+class AdaBoost
+{
+private:
+    int size;              // number of rounds
+    Tree **trees;          // the tree of each round
+    double *alphas;        // vote weight of each tree
+    double *importance;    // feature importance summed over trees, normalized
+    double *trainingError; // training error of the ensemble after each round
+    bool histogramMode;    // train trees on binned features
+    int numThreads;        // training threads, 0 for all cores
+
+    /**
+     * @brief Decide the training rows with one tree, a chunk of rows at a
+     * time, read from data->source if X is not in memory.
+     */
+    void decideRows(Tree *tree, Data *data, int *leafY, ThreadPool &pool);
+
+public:
+    long d;  // dimension of each instance
+    int nol; // number of unique labels
+
+    AdaBoost(int size_, int depth_, long noc_, uint64_t seed = Random::randomSeed()); // round i is seeded from seed and i
+    ~AdaBoost();
+    int boostSize();
+    Tree *getTree(int i);
+    void setNumThreads(int numThreads_);                       // see Tree::setNumThreads()
+    void setHistogramMode(bool histogramMode_);
+    void setLevelWise(bool levelWise_);                        // see Tree::setLevelWise()
+    void setFeatureSampling(long maxFeatures_);                // see Tree::setFeatureSampling()
+    void setRowSampling(double sampleRatio_, bool bootstrap_); // see Tree::setRowSampling()
+
+    /**
+     * @brief Train all rounds. data->W, if not NULL, gives the initial
+     * weights; it is left unchanged.
+     */
+    void trainBoost(Data *data);
+
+    double *getAlphas();
+    double *getImportance();
+    double *getTrainingError();
+    FlatForest *getFlat(); // compiled ensemble to be deleted by the caller, valid while the ensemble is
+    void runDecision(double *X, double *Y, double *P, long n, long d, int numThreads = 1); // make decisions given testing data
+};
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+inline AdaBoost::AdaBoost(int size_, int depth_, long noc_, uint64_t seed)
+{
+    size = size_;
+    trees = new Tree *[size];
+    for (int i = 0; i < size; i++)
+    {
+        trees[i] = new Tree(depth_, noc_, Random(seed, i).next());
+    }
+    alphas = new double[size];
+    trainingError = new double[size];
+    for (int i = 0; i < size; i++)
+    {
+        alphas[i] = 0;
+        trainingError[i] = 0;
+    }
+    importance = NULL;
+    histogramMode = false;
+    numThreads = 0;
+    d = 0;
+    nol = 0;
+}
+
+inline AdaBoost::~AdaBoost()
+{
+    for (int i = 0; i < size; i++)
+    {
+        delete trees[i];
+    }
+    delete[] trees;
+    delete[] alphas;
+    delete[] trainingError;
+    if (importance != NULL) delete[] importance;
+}
+
+inline int AdaBoost::boostSize()
+{
+    return size;
+}
+
+inline Tree *AdaBoost::getTree(int i)
+{
+    return trees[i];
+}
+
+inline void AdaBoost::setNumThreads(int numThreads_)
+{
+    numThreads = numThreads_;
+}
+
+inline void AdaBoost::setHistogramMode(bool histogramMode_)
+{
+    histogramMode = histogramMode_;
+    for (int i = 0; i < size; i++)
+    {
+        trees[i]->setHistogramMode(histogramMode_);
+    }
+}
+
+inline void AdaBoost::setLevelWise(bool levelWise_)
+{
+    for (int i = 0; i < size; i++)
+    {
+        trees[i]->setLevelWise(levelWise_);
+    }
+}
+
+inline void AdaBoost::setFeatureSampling(long maxFeatures_)
+{
+    for (int i = 0; i < size; i++)
+    {
+        trees[i]->setFeatureSampling(maxFeatures_);
+    }
+}
+
+inline void AdaBoost::setRowSampling(double sampleRatio_, bool bootstrap_)
+{
+    for (int i = 0; i < size; i++)
+    {
+        trees[i]->setRowSampling(sampleRatio_, bootstrap_);
+    }
+}
+
+inline void AdaBoost::decideRows(Tree *tree, Data *data, int *leafY, ThreadPool &pool)
+{
+    FlatTree *flat = tree->getFlat();
+    long n = data->n;
+    long chunk = data->X == NULL ? data->source->chunkRows() : n;
+    double *buffer = data->X == NULL ? new double[chunk * data->d] : NULL;
+    const long block = 1024;
+
+    for (long begin = 0; begin < n; begin += chunk)
+    {
+        long num = n - begin < chunk ? n - begin : chunk;
+        long stride = n;
+        const double *rows = data->X == NULL ? data->source->readRows(begin, num, buffer, stride) : data->X + begin;
+        pool.run((num + block - 1) / block, [&](long b) {
+            long first = b * block;
+            long count = num - first < block ? num - first : block;
+            int *leaves = leafY + begin + first;
+            flat->findLeaves(rows + first, 1, stride, count, leaves);
+            for (long i = 0; i < count; i++)
+            {
+                leaves[i] = flat->leafY[leaves[i]];
+            }
+        });
+    }
+    if (buffer != NULL) delete[] buffer;
+}
+
+inline void AdaBoost::trainBoost(Data *data)
+{
+    d = data->d;
+    nol = data->nol;
+    long n = data->n;
+    if (nol < 2)
+    {
+        throw Error("AdaBoost needs at least two labels.");
+    }
+
+    // features are binned once for all rounds
+    if (histogramMode && data->B == NULL && data->X != NULL)
+    {
+        data->buildBins(256);
+    }
+
+    // the weights of all rounds, updated in place
+    double *initialW = data->W;
+    std::vector<double> W(n);
+    double sum = 0;
+    for (long i = 0; i < n; i++)
+    {
+        W[i] = initialW == NULL ? 1 : initialW[i];
+        sum += W[i];
+    }
+    for (long i = 0; i < n; i++)
+    {
+        W[i] /= sum;
+    }
+
+    // decisions of the current tree, and votes of the trees so far
+    std::vector<int> leafY(n);
+    std::vector<double> votes(n * nol, 0);
+
+    if (importance != NULL) delete[] importance;
+    importance = new double[d];
+    for (long j = 0; j < d; j++)
+    {
+        importance[j] = 0;
+    }
+
+    // data->W points to W during the rounds only, also if a round throws
+    data->W = W.data();
+    try
+    {
+        ThreadPool pool(numThreads);
+        const double K = nol;
+        for (int t = 0; t < size; t++)
+        {
+            trees[t]->setNumThreads(numThreads);
+            trees[t]->trainTree(data);
+            for (long j = 0; j < d; j++)
+            {
+                importance[j] += trees[t]->getImportance()[j];
+            }
+
+            decideRows(trees[t], data, leafY.data(), pool);
+
+            double err = 0;
+            for (long i = 0; i < n; i++)
+            {
+                if (leafY[i] != data->Y[i])
+                {
+                    err += W[i];
+                }
+            }
+            if (err == 0)
+            {
+                err = 1e-10;
+            }
+            else if (err >= 1 - 1 / K)
+            {
+                err = 1 - 1 / K - 1e-10;
+            }
+            double alpha = log((1 - err) / err) + log(K - 1);
+            alphas[t] = alpha;
+
+            double boost = exp(alpha);
+            sum = 0;
+            for (long i = 0; i < n; i++)
+            {
+                if (leafY[i] != data->Y[i])
+                {
+                    W[i] *= boost;
+                }
+                sum += W[i];
+            }
+            for (long i = 0; i < n; i++)
+            {
+                W[i] /= sum;
+            }
+
+            // training error of the ensemble so far, first maximum wins
+            long wrong = 0;
+            for (long i = 0; i < n; i++)
+            {
+                double *vote = votes.data() + i * nol;
+                vote[leafY[i] - 1] += alpha;
+                int label = 0;
+                for (int j = 1; j < nol; j++)
+                {
+                    if (vote[j] > vote[label])
+                    {
+                        label = j;
+                    }
+                }
+                wrong += (label + 1 != data->Y[i]);
+            }
+            trainingError[t] = (double)wrong / n;
+        }
+    }
+    catch (...)
+    {
+        data->W = initialW;
+        throw;
+    }
+    data->W = initialW;
+
+    sum = 0;
+    for (long j = 0; j < d; j++)
+    {
+        sum += importance[j];
+    }
+    for (long j = 0; sum != 0 && j < d; j++)
+    {
+        importance[j] /= sum;
+    }
+}
+
+inline double *AdaBoost::getAlphas()
+{
+    return alphas;
+}
+
+inline double *AdaBoost::getImportance()
+{
+    return importance;
+}
+
+inline double *AdaBoost::getTrainingError()
+{
+    return trainingError;
+}
+
+inline FlatForest *AdaBoost::getFlat()
+{
+    FlatTree **flats = new FlatTree *[size];
+    for (int i = 0; i < size; i++)
+    {
+        flats[i] = trees[i]->getFlat();
+    }
+    FlatForest *flat = new FlatForest(flats, size, alphas);
+    delete[] flats;
+    return flat;
+}
+
+inline void AdaBoost::runDecision(double *X, double *Y, double *P, long n_, long d_, int numThreads_)
+{
+    FlatForest *flat = getFlat();
+    flat->runDecision(X, Y, P, n_, d_, numThreads_);
+    delete flat;
+}
+
+#endif
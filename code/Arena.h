@@ -0,0 +1,242 @@
+/**
+ * @file Arena.h
+ * @brief C++ implementation of a scratch memory arena.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @class Arena
+ * @brief Class for stack-like scratch allocation.
+ * @class ArenaPool
+ * @brief Class to hand out arenas to the threads of one training task.
+ *
+ * Implemented functionalities:
+ *   1. Allocate uninitialized arrays by bumping an offset in large blocks.
+ *   2. Free everything allocated after a mark in O(1), keeping the blocks
+ *      for the next allocations.
+ *   3. Lend arenas to threads, so that each thread has its own arena and
+ *      the blocks of finished tasks are reused by the next ones.
+ *
+ * An arena is used by one thread at a time, and never runs constructors
+ * or destructors, so it only holds plain data. Arrays are aligned to 64
+ * bytes. Blocks are only returned to the system when the arena is
+ * destroyed.
+ */
+
+#ifndef Arena_H
+#define Arena_H
+
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+class Arena
+{
+private:
+    struct Block
+    {
+        char *data;
+        size_t size;
+    };
+    std::vector<Block> blocks; // blocks after current are free
+    size_t current;            // block being filled
+    size_t used;               // bytes used in the current block
+    size_t blockSize;          // minimum size of a new block
+
+public:
+    struct Mark
+    {
+        size_t block;
+        size_t used;
+    };
+
+    Arena(size_t blockSize_ = 1 << 20);
+    ~Arena();
+
+    /**
+     * @brief Allocate an uninitialized array of num elements.
+     */
+    template <class T>
+    T *allocate(long num);
+
+    Mark mark(); // current position
+    void release(Mark mark_); // free everything allocated since mark_
+    void reset();             // free everything
+    size_t capacity();        // bytes held in all blocks
+
+private:
+    void *allocateBytes(size_t bytes);
+};
+
+class ArenaPool
+{
+private:
+    std::vector<Arena *> arenas; // all arenas, owned
+    std::vector<Arena *> idle;   // arenas not lent to any thread
+    std::mutex lock;
+
+public:
+    ArenaPool();
+    ~ArenaPool();
+    Arena *acquire();             // an idle arena, or a new one
+    void release(Arena *arena);   // reset the arena and take it back
+    void clear();                 // free all arenas, none may be lent
+};
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+inline Arena::Arena(size_t blockSize_)
+{
+    blockSize = blockSize_;
+    current = 0;
+    used = 0;
+}
+
+inline Arena::~Arena()
+{
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        free(blocks[i].data);
+    }
+}
+
+template <class T>
+T *Arena::allocate(long num)
+{
+    return (T *)allocateBytes((num > 0 ? num : 1) * sizeof(T));
+}
+
+inline void *Arena::allocateBytes(size_t bytes)
+{
+    const size_t alignment = 64;
+    while (true)
+    {
+        if (current < blocks.size())
+        {
+            size_t offset = (size_t)((-(size_t)(blocks[current].data + used)) & (alignment - 1));
+            if (used + offset + bytes <= blocks[current].size)
+            {
+                void *p = blocks[current].data + used + offset;
+                used += offset + bytes;
+                return p;
+            }
+            if (current + 1 < blocks.size() && blocks[current + 1].size >= bytes + alignment)
+            {
+                current++;
+                used = 0;
+                continue;
+            }
+        }
+
+        // insert a large enough block after the current one
+        Block block;
+        block.size = bytes + alignment > blockSize ? bytes + alignment : blockSize;
+        block.data = (char *)malloc(block.size);
+        if (block.data == NULL)
+        {
+            throw std::bad_alloc();
+        }
+        size_t position = current < blocks.size() ? current + 1 : blocks.size();
+        blocks.insert(blocks.begin() + position, block);
+        current = position;
+        used = 0;
+    }
+}
+
+inline Arena::Mark Arena::mark()
+{
+    Mark m;
+    m.block = current;
+    m.used = used;
+    return m;
+}
+
+inline void Arena::release(Mark mark_)
+{
+    current = mark_.block;
+    used = mark_.used;
+}
+
+inline void Arena::reset()
+{
+    current = 0;
+    used = 0;
+}
+
+inline size_t Arena::capacity()
+{
+    size_t total = 0;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        total += blocks[i].size;
+    }
+    return total;
+}
+
+inline ArenaPool::ArenaPool()
+{
+}
+
+inline ArenaPool::~ArenaPool()
+{
+    clear();
+}
+
+inline Arena *ArenaPool::acquire()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (idle.empty())
+    {
+        arenas.push_back(new Arena());
+        return arenas.back();
+    }
+    Arena *arena = idle.back();
+    idle.pop_back();
+    return arena;
+}
+
+inline void ArenaPool::release(Arena *arena)
+{
+    arena->reset();
+    std::lock_guard<std::mutex> guard(lock);
+    idle.push_back(arena);
+}
+
+inline void ArenaPool::clear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < arenas.size(); i++)
+    {
+        delete arenas[i];
+    }
+    arenas.clear();
+    idle.clear();
+}
+
+#endif
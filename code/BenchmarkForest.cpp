@@ -0,0 +1,251 @@
+/**
+ * @file BenchmarkForest.cpp
+ * @brief Benchmark of forest inference engines on synthetic data.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * A standalone program, not a MEX file. It trains a forest on synthetic
+ * data and runs it with:
+ *   1. decideTree(), walking the TreeNodes of each tree per row,
+ *      and averaging the trees as RunDecisionForest does;
+ *   2. FlatForest, walking the compiled trees a block of rows at a time;
+ *   3. FlatForest with QuickScorer, if every tree has at most 64 leaves.
+ * It checks that all engines give identical Y and P, prints ns/row, and
+ * prints the engine FlatForest chooses by itself. It then builds the
+ * compact variants of the forest (CompactModel.h), runs them on float32
+ * input, and reports their memory, ns/row, and accuracy against the
+ * double model.
+ *
+ * Compile and run:
+ *     g++ -O2 -std=c++11 -pthread BenchmarkForest.cpp -o BenchmarkForest
+ *     ./BenchmarkForest [numTrees] [depth] [n] [d]
+ */
+
+#include <chrono>
+#include <random>
+#include "DecisionTree.h"
+#include "CompactModel.h"
+
+static double seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Synthetic data: Gaussian features, and one of 4 labels from the
+ * signs of two random linear combinations of all features, so that splits
+ * use many features.
+ */
+static void makeData(double *X, int *Y, long n, long d, unsigned seed)
+{
+    std::mt19937 generator(seed);
+    std::normal_distribution<double> normal;
+    for (long i = 0; i < n * d; i++)
+    {
+        X[i] = normal(generator);
+    }
+
+    std::mt19937 weightGenerator(0); // same labeling for all seeds
+    double *w = new double[2 * d];
+    for (long j = 0; j < 2 * d; j++)
+    {
+        w[j] = normal(weightGenerator);
+    }
+    for (long i = 0; i < n; i++)
+    {
+        double a = 0, b = 0;
+        for (long j = 0; j < d; j++)
+        {
+            a += w[j] * X[i + j * n];
+            b += w[d + j] * X[i + j * n];
+        }
+        Y[i] = 1 + (a > 0) + 2 * (b > 0);
+    }
+    delete[] w;
+}
+
+/**
+ * @brief Run the forest with decideTree(), as RunDecisionForest.m does.
+ */
+static void runDecideTree(Forest *forest, double *X, double *Y, double *P, long n, long d)
+{
+    double eps = 0.00000000001;
+    int nol = forest->nol;
+    double *feature = new double[d];
+    for (long i = 0; i < n * nol; i++)
+    {
+        P[i] = 0;
+    }
+    for (int t = 0; t < forest->forestSize(); t++)
+    {
+        Tree *tree = forest->getTree(t);
+        for (long i = 0; i < n; i++)
+        {
+            for (long j = 0; j < d; j++)
+            {
+                feature[j] = X[i + j * n];
+            }
+            TreeNode *node = tree->decideTree(0, feature);
+            double sum = 0;
+            for (int k = 0; k < node->numParams; k++)
+            {
+                sum += node->param[k];
+            }
+            for (int k = 0; k < node->numParams; k++)
+            {
+                P[i + node->labels[k] * n] += node->param[k] / (sum + eps);
+            }
+        }
+    }
+    for (long i = 0; i < n; i++)
+    {
+        Y[i] = 1;
+        for (int j = 0; j < nol; j++)
+        {
+            P[i + j * n] /= forest->forestSize();
+            if (P[i + j * n] > P[i + (long)(Y[i] - 1) * n])
+            {
+                Y[i] = j + 1;
+            }
+        }
+    }
+    delete[] feature;
+}
+
+static bool identical(double *a, double *b, long num)
+{
+    return memcmp(a, b, num * sizeof(double)) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int numTrees = argc > 1 ? atoi(argv[1]) : 100;
+    int depth = argc > 2 ? atoi(argv[2]) : 6;
+    long n = argc > 3 ? atol(argv[3]) : 100000;
+    long d = argc > 4 ? atol(argv[4]) : 20;
+
+    long trainN = 20000;
+    double *trainX = new double[trainN * d];
+    int *trainY = new int[trainN];
+    makeData(trainX, trainY, trainN, d, 1);
+    Data data(trainX, trainY, trainN, d);
+    Forest forest(numTrees, depth, 100);
+    forest.trainForest(&data);
+
+    double *X = new double[n * d];
+    int *labels = new int[n];
+    makeData(X, labels, n, d, 2);
+    int nol = forest.nol;
+    double *Y[3], *P[3], elapsed[3];
+    for (int k = 0; k < 3; k++)
+    {
+        Y[k] = new double[n];
+        P[k] = new double[n * nol];
+    }
+
+    FlatForest *flat = forest.getFlat();
+    long maxLeaves = 0;
+    for (int t = 0; t < numTrees; t++)
+    {
+        maxLeaves = std::max(maxLeaves, flat->trees[t]->numLeaves);
+    }
+    bool quickScorer = flat->scorer != NULL;
+
+    // let the forest time both engines and choose one
+    flat->runDecision(X, Y[1], P[1], n, d);
+    const char *chosen = flat->engine == ENGINE_QUICKSCORER ? "QuickScorer" : "FlatForest";
+
+    double start = seconds();
+    runDecideTree(&forest, X, Y[0], P[0], n, d);
+    elapsed[0] = seconds() - start;
+
+    flat->setEngine(ENGINE_TRAVERSAL);
+    start = seconds();
+    flat->runDecision(X, Y[1], P[1], n, d);
+    elapsed[1] = seconds() - start;
+
+    flat->setEngine(ENGINE_QUICKSCORER);
+    start = seconds();
+    flat->runDecision(X, Y[2], P[2], n, d);
+    elapsed[2] = seconds() - start;
+
+    printf("%d trees of depth %d, at most %ld leaves, %ld rows, %ld features\n",
+           numTrees, depth, maxLeaves, n, d);
+    printf("decideTree:   %8.1f ns/row\n", elapsed[0] * 1e9 / n);
+    printf("FlatForest:   %8.1f ns/row  identical %d\n", elapsed[1] * 1e9 / n,
+           identical(Y[0], Y[1], n) && identical(P[0], P[1], n * nol));
+    if (quickScorer)
+    {
+        printf("QuickScorer:  %8.1f ns/row  identical %d\n", elapsed[2] * 1e9 / n,
+               identical(Y[0], Y[2], n) && identical(P[0], P[2], n * nol));
+    }
+    else
+    {
+        printf("QuickScorer:  not used, some tree has more than 64 leaves\n");
+    }
+    printf("chosen by FlatForest: %s\n", chosen);
+
+    // compact variants on float32 input, against the double model
+    const char *thresholdNames[2] = {"float32", "uint16"};
+    const char *leafNames[2] = {"uint16 P", "argmax"};
+    CompactReport reference = CompactForest(flat, COMPACT_FLOAT32, COMPACT_ARGMAX).compare(flat, X, labels, n, d);
+    printf("double model: %8ld bytes  accuracy %.4f\n", reference.referenceBytes, reference.referenceAccuracy);
+    float *floatX = new float[n * d];
+    for (long i = 0; i < n * d; i++)
+    {
+        floatX[i] = (float)X[i];
+    }
+    for (int thresholdMode = COMPACT_FLOAT32; thresholdMode <= COMPACT_UINT16; thresholdMode++)
+    {
+        for (int leafMode = COMPACT_PROBABILITY; leafMode <= COMPACT_ARGMAX; leafMode++)
+        {
+            if (!CompactForest::supports(flat, thresholdMode))
+            {
+                printf("%-7s %-8s: not used, too many thresholds\n", thresholdNames[thresholdMode], leafNames[leafMode]);
+                continue;
+            }
+            CompactForest compact(flat, thresholdMode, leafMode);
+            start = seconds();
+            compact.runDecision(floatX, Y[2], P[2], n, d);
+            double elapsedCompact = seconds() - start;
+            CompactReport report = compact.compare(flat, X, labels, n, d, true);
+            printf("%-7s %-8s: %8ld bytes (%.2fx) %8.1f ns/row  same Y %.4f  max |dP| %.1e  accuracy %+.4f\n",
+                   thresholdNames[thresholdMode], leafNames[leafMode], report.bytes,
+                   (double)report.bytes / report.referenceBytes, elapsedCompact * 1e9 / n, report.agreement,
+                   report.maxDeltaP, report.accuracy - report.referenceAccuracy);
+        }
+    }
+    delete[] floatX;
+
+    delete flat;
+    for (int k = 0; k < 3; k++)
+    {
+        delete[] Y[k];
+        delete[] P[k];
+    }
+    delete[] X;
+    delete[] labels;
+    delete[] trainX;
+    delete[] trainY;
+    return 0;
+}
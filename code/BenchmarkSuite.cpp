@@ -0,0 +1,557 @@
+/**
+ * @file BenchmarkSuite.cpp
+ * @brief Benchmarks of training and inference on synthetic data, as JSON.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * A standalone program, not a MEX file. It runs a grid of cases on
+ * synthetic data, and for each case times
+ *   train_tree:     Tree::trainTree()
+ *   tree_predict:   Tree::runDecision()
+ *   train_forest:   Forest::trainForest()
+ *   forest_predict: FlatForest::runDecision()
+ * Each step is repeated and the fastest run is kept. The results are
+ * written as JSON: seconds, rows/s and ns/row of every step, nodes/s of
+ * training, accuracy on testing data, the peak resident memory of the
+ * step, and the number of heap allocations (calls of operator new) of the
+ * step, so that runs of two versions can be compared.
+ *
+ * The data has Gaussian features, and nol labels decided by the largest of
+ * nol random linear combinations of the features. Testing data is drawn
+ * the same way with another seed.
+ *
+ * Build with CMake (target BenchmarkSuite, or run it with the target
+ * benchmark), or:
+ *     g++ -O2 -std=c++11 -pthread BenchmarkSuite.cpp -o BenchmarkSuite
+ *     ./BenchmarkSuite [options]
+ * Options, where n to trees take comma-separated lists, and every
+ * combination of them is one case:
+ *     --n 20000,100000   number of training and of testing rows
+ *     --d 20             number of features
+ *     --nol 3,20         number of labels
+ *     --depth 10         maximum depth, 0 for fully grown trees
+ *     --noc 50           candidates per node
+ *     --trees 16         trees of the forest
+ *     --threads 1        threads of forest training and prediction
+ *     --repeat 3         runs of each step
+ *     --seed 1           seed of the data and of the trees
+ *     --histogram        train in histogram mode
+ *     --simd avx2        traversal instructions: scalar, avx2 or avx512
+ *     --quick            one small case, to check that everything runs
+ *     --out path         write the JSON to path instead of stdout
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include "DecisionTree.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/**********************************************
+ * Allocation counting and memory
+ **********************************************/
+
+static std::atomic<long> allocations(0);
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size > 0 ? size : 1);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    allocations++;
+    return malloc(size > 0 ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+/**
+ * @brief Reset the peak resident memory where the system allows it (Linux),
+ * so that it is measured for one step. Elsewhere it is the peak so far.
+ */
+static void resetPeakMemory()
+{
+#if defined(__linux__)
+    FILE *pFile = fopen("/proc/self/clear_refs", "w");
+    if (pFile != NULL)
+    {
+        fputs("5", pFile);
+        fclose(pFile);
+    }
+#endif
+}
+
+/**
+ * @brief Peak resident memory in bytes since resetPeakMemory().
+ */
+static long peakMemory()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return (long)counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+#if defined(__linux__)
+    FILE *pFile = fopen("/proc/self/status", "r");
+    if (pFile != NULL)
+    {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), pFile) != NULL)
+        {
+            if (strncmp(line, "VmHWM:", 6) == 0)
+            {
+                kb = atol(line + 6);
+            }
+        }
+        fclose(pFile);
+        if (kb >= 0)
+        {
+            return kb * 1024;
+        }
+    }
+#endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (long)usage.ru_maxrss; // bytes
+#else
+    return (long)usage.ru_maxrss * 1024; // kilobytes
+#endif
+#endif
+}
+
+static double seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**********************************************
+ * Synthetic data
+ **********************************************/
+
+/**
+ * @brief Gaussian features, and the label of the largest of nol random
+ * linear combinations of the features. The combinations depend on d and
+ * nol only, so training and testing data of different seeds agree.
+ */
+static void makeData(double *X, int *Y, long n, long d, int nol, uint64_t seed)
+{
+    Random random(seed, 1);
+    const double pi = 3.14159265358979323846;
+    for (long i = 0; i < n * d; i++)
+    {
+        // Box-Muller
+        double u = 1 - random.uniform();
+        X[i] = sqrt(-2 * log(u)) * cos(2 * pi * random.uniform());
+    }
+
+    Random weightRandom(0, 2);
+    std::vector<double> w(nol * d);
+    for (long k = 0; k < nol * d; k++)
+    {
+        w[k] = weightRandom.uniform() * 2 - 1;
+    }
+    std::vector<double> score(nol);
+    for (long i = 0; i < n; i++)
+    {
+        int label = 0;
+        for (int c = 0; c < nol; c++)
+        {
+            score[c] = 0;
+            for (long j = 0; j < d; j++)
+            {
+                score[c] += w[c * d + j] * X[i + j * n];
+            }
+            if (score[c] > score[label])
+            {
+                label = c;
+            }
+        }
+        Y[i] = label + 1;
+    }
+}
+
+/**********************************************
+ * Benchmark
+ **********************************************/
+
+class BenchmarkCase
+{
+public:
+    long n;
+    long d;
+    int nol;
+    int depth;
+    long noc;
+    int trees;
+};
+
+class StepResult
+{
+public:
+    std::string name;
+    double seconds;     // fastest run
+    long rows;          // rows trained on or predicted
+    long nodes;         // nodes trained, 0 for prediction
+    double accuracy;    // on testing data, negative if not measured
+    long peakBytes;     // peak resident memory of the step
+    long allocations;   // calls of operator new in the first run
+};
+
+/**
+ * @brief Run a step repeat times, keeping the fastest run. prepare() is
+ * called before every run, outside of the measurement.
+ */
+template <class Prepare, class Run>
+static StepResult measure(const char *name, int repeat, Prepare prepare, Run run)
+{
+    StepResult result;
+    result.name = name;
+    result.seconds = 0;
+    result.rows = 0;
+    result.nodes = 0;
+    result.accuracy = -1;
+    result.peakBytes = 0;
+    result.allocations = 0;
+    for (int r = 0; r < repeat; r++)
+    {
+        prepare();
+        resetPeakMemory();
+        long before = allocations;
+        double start = seconds();
+        run();
+        double elapsed = seconds() - start;
+        long peak = peakMemory();
+        if (r == 0)
+        {
+            result.allocations = allocations - before;
+        }
+        result.seconds = (r == 0 || elapsed < result.seconds) ? elapsed : result.seconds;
+        result.peakBytes = peak > result.peakBytes ? peak : result.peakBytes;
+    }
+    return result;
+}
+
+static double accuracy(const double *Y, const int *labels, long n)
+{
+    long correct = 0;
+    for (long i = 0; i < n; i++)
+    {
+        correct += (Y[i] == labels[i]);
+    }
+    return (double)correct / n;
+}
+
+static long countNodes(Tree *tree)
+{
+    return tree->getFlat()->numNodes;
+}
+
+static std::vector<StepResult> runCase(const BenchmarkCase &c, int numThreads, int repeat, uint64_t seed,
+                                       bool histogramMode)
+{
+    std::vector<StepResult> results;
+    std::vector<double> X(c.n * c.d), testX(c.n * c.d);
+    std::vector<int> Y(c.n), testY(c.n);
+    makeData(X.data(), Y.data(), c.n, c.d, c.nol, seed);
+    makeData(testX.data(), testY.data(), c.n, c.d, c.nol, seed + 1);
+    std::vector<double> predictY(c.n), predictP(c.n * c.nol);
+
+    // one tree, trained again from scratch in every run
+    Data *data = NULL;
+    Tree *tree = NULL;
+    auto prepareTree = [&]() {
+        delete tree;
+        delete data;
+        data = new Data(X.data(), Y.data(), c.n, c.d);
+        tree = new Tree(c.depth, c.noc, seed);
+        tree->setHistogramMode(histogramMode);
+    };
+    StepResult result = measure("train_tree", repeat, prepareTree, [&]() { tree->trainTree(data); });
+    result.rows = c.n;
+    result.nodes = countNodes(tree);
+    results.push_back(result);
+
+    result = measure("tree_predict", repeat, []() {}, [&]() {
+        tree->runDecision(testX.data(), predictY.data(), predictP.data(), c.n, c.d);
+    });
+    result.rows = c.n;
+    result.accuracy = accuracy(predictY.data(), testY.data(), c.n);
+    results.push_back(result);
+    delete tree;
+    delete data;
+
+    // the forest
+    data = NULL;
+    Forest *forest = NULL;
+    auto prepareForest = [&]() {
+        delete forest;
+        delete data;
+        data = new Data(X.data(), Y.data(), c.n, c.d);
+        forest = new Forest(c.trees, c.depth, c.noc, seed);
+        forest->setHistogramMode(histogramMode);
+    };
+    result = measure("train_forest", repeat, prepareForest, [&]() { forest->trainForest(data, numThreads); });
+    result.rows = c.n * (long)c.trees;
+    for (int t = 0; t < c.trees; t++)
+    {
+        result.nodes += countNodes(forest->getTree(t));
+    }
+    results.push_back(result);
+
+    FlatForest *flat = forest->getFlat();
+    result = measure("forest_predict", repeat, []() {}, [&]() {
+        flat->runDecision(testX.data(), predictY.data(), predictP.data(), c.n, c.d, numThreads);
+    });
+    result.rows = c.n;
+    result.accuracy = accuracy(predictY.data(), testY.data(), c.n);
+    results.push_back(result);
+    delete flat;
+    delete forest;
+    delete data;
+
+    return results;
+}
+
+/**********************************************
+ * Command line and JSON
+ **********************************************/
+
+static std::vector<long> parseList(const char *text)
+{
+    std::vector<long> values;
+    std::string value;
+    for (const char *p = text;; p++)
+    {
+        if (*p == ',' || *p == '\0')
+        {
+            if (!value.empty())
+            {
+                values.push_back(atol(value.c_str()));
+            }
+            value.clear();
+            if (*p == '\0')
+            {
+                break;
+            }
+            continue;
+        }
+        value += *p;
+    }
+    return values;
+}
+
+static void writeResult(FILE *pFile, const StepResult &r, bool last)
+{
+    fprintf(pFile, "        {\"step\": \"%s\", \"seconds\": %.6g, \"rows_per_sec\": %.6g, \"ns_per_row\": %.6g, ",
+            r.name.c_str(), r.seconds, r.rows / r.seconds, r.seconds * 1e9 / r.rows);
+    if (r.nodes > 0)
+    {
+        fprintf(pFile, "\"nodes\": %ld, \"nodes_per_sec\": %.6g, ", r.nodes, r.nodes / r.seconds);
+    }
+    if (r.accuracy >= 0)
+    {
+        fprintf(pFile, "\"accuracy\": %.6g, ", r.accuracy);
+    }
+    fprintf(pFile, "\"peak_rss_bytes\": %ld, \"allocations\": %ld}%s\n", r.peakBytes, r.allocations,
+            last ? "" : ",");
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<long> ns(1, 20000), ds(1, 20), nols(1, 3), depths(1, 10), nocs(1, 50), treeCounts(1, 16);
+    ns.push_back(100000);
+    nols.push_back(20);
+    int numThreads = 1;
+    int repeat = 3;
+    uint64_t seed = 1;
+    bool histogramMode = false;
+    const char *out = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (option == "--quick")
+        {
+            ns.assign(1, 2000);
+            ds.assign(1, 10);
+            nols.assign(1, 3);
+            depths.assign(1, 6);
+            nocs.assign(1, 20);
+            treeCounts.assign(1, 4);
+            repeat = 1;
+        }
+        else if (option == "--histogram")
+        {
+            histogramMode = true;
+        }
+        else if (option == "--n" && hasValue)
+        {
+            ns = parseList(argv[++i]);
+        }
+        else if (option == "--d" && hasValue)
+        {
+            ds = parseList(argv[++i]);
+        }
+        else if (option == "--nol" && hasValue)
+        {
+            nols = parseList(argv[++i]);
+        }
+        else if (option == "--depth" && hasValue)
+        {
+            depths = parseList(argv[++i]);
+        }
+        else if (option == "--noc" && hasValue)
+        {
+            nocs = parseList(argv[++i]);
+        }
+        else if (option == "--trees" && hasValue)
+        {
+            treeCounts = parseList(argv[++i]);
+        }
+        else if (option == "--threads" && hasValue)
+        {
+            numThreads = atoi(argv[++i]);
+        }
+        else if (option == "--repeat" && hasValue)
+        {
+            repeat = atoi(argv[++i]);
+        }
+        else if (option == "--seed" && hasValue)
+        {
+            seed = (uint64_t)atoll(argv[++i]);
+        }
+        else if (option == "--simd" && hasValue && simdLevelOfName(argv[i + 1]) >= 0)
+        {
+            setSimdLevel(simdLevelOfName(argv[++i]));
+        }
+        else if (option == "--out" && hasValue)
+        {
+            out = argv[++i];
+        }
+        else
+        {
+            std::cout << "Error: unknown option " << option << ". See BenchmarkSuite.cpp for the options. \n";
+            return 1;
+        }
+    }
+
+    std::vector<BenchmarkCase> cases;
+    for (long n : ns)
+        for (long d : ds)
+            for (long nol : nols)
+                for (long depth : depths)
+                    for (long noc : nocs)
+                        for (long trees : treeCounts)
+                        {
+                            if (n < 1 || d < 1 || nol < 2 || depth < 0 || noc < 1 || trees < 1)
+                            {
+                                std::cout << "Error: every case needs n, d, noc, trees >= 1, nol >= 2, depth >= 0. \n";
+                                return 1;
+                            }
+                            BenchmarkCase c = {n, d, (int)nol, (int)depth, noc, (int)trees};
+                            cases.push_back(c);
+                        }
+    repeat = repeat < 1 ? 1 : repeat;
+
+    FILE *pFile = out == NULL ? stdout : fopen(out, "w");
+    if (pFile == NULL)
+    {
+        std::cout << "Error opening " << out << std::endl;
+        return 1;
+    }
+    fprintf(pFile, "{\n  \"benchmark\": \"DecisionForest\",\n");
+    fprintf(pFile, "  \"simd\": \"%s\",\n  \"threads\": %d,\n  \"repeat\": %d,\n  \"seed\": %llu,\n",
+            simdLevelName(simdLevel()), numThreads, repeat, (unsigned long long)seed);
+    fprintf(pFile, "  \"histogram\": %s,\n  \"cases\": [\n", histogramMode ? "true" : "false");
+    for (size_t k = 0; k < cases.size(); k++)
+    {
+        const BenchmarkCase &c = cases[k];
+        std::cerr << "case " << k + 1 << "/" << cases.size() << ": n " << c.n << ", d " << c.d << ", nol " << c.nol
+                  << ", depth " << c.depth << ", noc " << c.noc << ", trees " << c.trees << std::endl;
+        std::vector<StepResult> results = runCase(c, numThreads, repeat, seed, histogramMode);
+        fprintf(pFile, "    {\"n\": %ld, \"d\": %ld, \"nol\": %d, \"depth\": %d, \"noc\": %ld, \"trees\": %d,\n",
+                c.n, c.d, c.nol, c.depth, c.noc, c.trees);
+        fprintf(pFile, "      \"results\": [\n");
+        for (size_t r = 0; r < results.size(); r++)
+        {
+            writeResult(pFile, results[r], r + 1 == results.size());
+        }
+        fprintf(pFile, "      ]}%s\n", k + 1 == cases.size() ? "" : ",");
+    }
+    fprintf(pFile, "  ]\n}\n");
+    if (pFile != stdout)
+    {
+        fclose(pFile);
+    }
+    return 0;
+}
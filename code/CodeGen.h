@@ -0,0 +1,429 @@
+/**
+ * @file CodeGen.h
+ * @brief C++ implementation of compiling trees into C++ source code.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @class CodeGen
+ * @brief Class to write a tree or forest as C++ source code.
+ * @class CompiledModel
+ * @brief Class to load and run a shared library built from that code.
+ *
+ * Each tree becomes a function of nested if/else branches, with its
+ * thresholds as constexpr constants and its leaf probabilities in a
+ * constexpr table, so the compiler can inline the comparisons and lay out
+ * the branches. Trees deeper than maxBranchDepth, whose nested branches
+ * would exceed the nesting limits of compilers, become a constexpr node
+ * table walked by a loop instead, as FlatTree::findLeaf() does. The
+ * source exports a stable C interface:
+ *
+ *     extern "C" int predict(const double *x, double *p);
+ *     extern "C" long num_features();
+ *     extern "C" int num_labels();
+ *
+ * predict() takes the num_features() features of one instance, writes the
+ * num_labels() probabilities, averaged over the trees, to p, and returns
+ * the decided label between 1 and num_labels(). For a weighted ensemble
+ * (AdaBoost), each tree adds its weight to the label of its leaf, and p
+ * is the votes divided by the total weight, as FlatForest does. Thresholds and
+ * probabilities are written with 17 significant digits, the comparisons
+ * are the "<=" of decideTree() (NaN goes right), and the probabilities are
+ * summed in tree order, so results are bit-identical to runDecision().
+ *
+ * The source needs C++11 and is built as a shared library, e.g.
+ *     c++ -O2 -std=c++11 -shared -fPIC model.cpp -o model.so
+ * which is what compileSource() runs.
+ */
+
+#ifndef CodeGen_H
+#define CodeGen_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "DecisionTree.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+class CodeGen
+{
+private:
+    static void writeNode(FILE *pFile, FlatTree *tree, int t, long node, int indent);
+    static void writeTable(FILE *pFile, FlatTree *tree, int t); // node table and loop of a deep tree
+    static void writeDouble(FILE *pFile, double value);        // exact, also for NaN and infinity
+    static long treeDepth(FlatTree *tree);                      // levels of split nodes on the longest path
+
+public:
+    static const int maxBranchDepth = 32; // deepest tree written as nested branches by default
+
+    /**
+     * @brief Write trees as C++ source, as described above.
+     * @param weights Vote weight of each tree, or NULL to average probabilities.
+     * @param branchDepth Trees deeper than this are written as node tables.
+     */
+    static void writeSource(char *path, FlatTree **trees, int numTrees, const double *weights = NULL,
+                            int branchDepth = maxBranchDepth);
+    static void writeTree(char *path, Tree *tree);
+    static void writeForest(char *path, Forest *forest);
+
+    /**
+     * @brief Build a generated source file into a shared library.
+     * @param compiler Compiler command, e.g. "c++", "g++" or "clang++".
+     * @return Whether the compiler succeeded.
+     */
+    static bool compileSource(const char *sourcePath, const char *libraryPath, const char *compiler = "c++");
+};
+
+class CompiledModel
+{
+private:
+    void *library;
+    int (*predictFunction)(const double *, double *);
+
+public:
+    long d;  // dimension of each instance
+    int nol; // number of unique labels
+
+    CompiledModel(const char *libraryPath); // load a shared library
+    ~CompiledModel();
+
+    int predict(const double *x, double *p); // one instance, features contiguous
+
+    /**
+     * @brief Make decisions given testing data, as FlatForest::runDecision().
+     */
+    void runDecision(double *X, double *Y, double *P, long n, long d);
+};
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+inline void CodeGen::writeNode(FILE *pFile, FlatTree *tree, int t, long node, int indent)
+{
+    FlatNode *p = tree->nodes + node;
+    if (p->feature < 0)
+    {
+        fprintf(pFile, "%*sreturn %d;\n", indent, "", p->child);
+        return;
+    }
+    fprintf(pFile, "%*sif (x[%d] <= t%d_%ld)\n%*s{\n", indent, "", p->feature, t, node, indent, "");
+    writeNode(pFile, tree, t, p->child, indent + 4);
+    fprintf(pFile, "%*s}\n%*selse\n%*s{\n", indent, "", indent, "", indent, "");
+    writeNode(pFile, tree, t, p->child + 1, indent + 4);
+    fprintf(pFile, "%*s}\n", indent, "");
+}
+
+inline void CodeGen::writeTable(FILE *pFile, FlatTree *tree, int t)
+{
+    fprintf(pFile, "constexpr Node nodes%d[] = {", t);
+    for (long k = 0; k < tree->numNodes; k++)
+    {
+        FlatNode *p = tree->nodes + k;
+        fprintf(pFile, "%s{", k == 0 ? "\n    " : ",\n    ");
+        writeDouble(pFile, p->threshold);
+        fprintf(pFile, ", %d, %d}", p->feature, p->child);
+    }
+    fprintf(pFile, "};\n\n");
+    fprintf(pFile, "inline int tree%d(const double *x)\n{\n", t);
+    fprintf(pFile, "    const Node *node = nodes%d;\n", t);
+    fprintf(pFile, "    while (node->feature >= 0)\n    {\n");
+    fprintf(pFile, "        node = nodes%d + node->child + (x[node->feature] <= node->threshold ? 0 : 1);\n", t);
+    fprintf(pFile, "    }\n    return node->child;\n}\n");
+}
+
+inline long CodeGen::treeDepth(FlatTree *tree)
+{
+    // children come after their parents, so one pass in node order
+    std::vector<long> depth(tree->numNodes, 0);
+    long maxDepth = 0;
+    for (long k = 0; k < tree->numNodes; k++)
+    {
+        FlatNode *p = tree->nodes + k;
+        if (p->feature >= 0)
+        {
+            depth[p->child] = depth[p->child + 1] = depth[k] + 1;
+            maxDepth = depth[k] + 1 > maxDepth ? depth[k] + 1 : maxDepth;
+        }
+    }
+    return maxDepth;
+}
+
+inline void CodeGen::writeDouble(FILE *pFile, double value)
+{
+    if (value != value)
+    {
+        fprintf(pFile, "std::numeric_limits<double>::quiet_NaN()");
+    }
+    else if (value > 1.7976931348623157e308 || value < -1.7976931348623157e308)
+    {
+        fprintf(pFile, "%sstd::numeric_limits<double>::infinity()", value < 0 ? "-" : "");
+    }
+    else
+    {
+        fprintf(pFile, "%.17g", value);
+    }
+}
+
+inline void CodeGen::writeSource(char *path, FlatTree **trees, int numTrees, const double *weights,
+                                 int branchDepth)
+{
+    FILE *pFile = fopen(path, "w");
+    if (pFile == NULL)
+    {
+        throw Error(std::string("Cannot open ") + path + ".");
+    }
+    long d = trees[0]->d;
+    int nol = trees[0]->nol;
+
+    fprintf(pFile, "// Generated by CodeGen.h of DecisionForest: %d tree(s), %ld features, %d labels.\n",
+            numTrees, d, nol);
+    fprintf(pFile, "//\n");
+    fprintf(pFile, "// int predict(const double *x, double *p) reads the %ld features of one\n", d);
+    fprintf(pFile, "// instance from x, writes its %d probabilities to p, and returns the\n", nol);
+    fprintf(pFile, "// decided label between 1 and %d.\n\n", nol);
+    fprintf(pFile, "#ifdef _WIN32\n#define DF_EXPORT extern \"C\" __declspec(dllexport)\n");
+    fprintf(pFile, "#else\n#define DF_EXPORT extern \"C\" __attribute__((visibility(\"default\")))\n#endif\n\n");
+    fprintf(pFile, "#include <limits>\n\n");
+    fprintf(pFile, "namespace\n{\n\n");
+    fprintf(pFile, "constexpr long numFeatures = %ld;\n", d);
+    fprintf(pFile, "constexpr int numLabels = %d;\n", nol);
+    fprintf(pFile, "constexpr int numTrees = %d;\n", numTrees);
+    fprintf(pFile, "\nstruct Node\n{\n    double threshold;\n    int feature; // -1 for leaf\n");
+    fprintf(pFile, "    int child;   // split node: left child, right child is child + 1; leaf: leaf index\n};\n");
+    if (weights != NULL)
+    {
+        // summed in tree order, as FlatForest does
+        double totalWeight = 0;
+        for (int t = 0; t < numTrees; t++)
+        {
+            totalWeight += weights[t];
+        }
+        fprintf(pFile, "constexpr double totalWeight = ");
+        writeDouble(pFile, totalWeight);
+        fprintf(pFile, ";\n");
+    }
+
+    for (int t = 0; t < numTrees; t++)
+    {
+        FlatTree *tree = trees[t];
+        bool branches = treeDepth(tree) <= branchDepth;
+        fprintf(pFile, "\n// tree %d\n", t + 1);
+        for (long k = 0; branches && k < tree->numNodes; k++)
+        {
+            if (tree->nodes[k].feature >= 0)
+            {
+                fprintf(pFile, "constexpr double t%d_%ld = ", t, k);
+                writeDouble(pFile, tree->nodes[k].threshold);
+                fprintf(pFile, ";\n");
+            }
+        }
+        if (weights != NULL)
+        {
+            fprintf(pFile, "constexpr double weight%d = ", t);
+            writeDouble(pFile, weights[t]);
+            fprintf(pFile, ";\n");
+            fprintf(pFile, "constexpr int leafY%d[] = {", t);
+            for (long k = 0; k < tree->numLeaves; k++)
+            {
+                fprintf(pFile, "%s%d", k == 0 ? "" : ", ", tree->leafY[k]);
+            }
+            fprintf(pFile, "};\n\n");
+        }
+        else
+        {
+            // sparse leaves are written out in full
+            double *leafP = new double[nol];
+            fprintf(pFile, "constexpr double leafP%d[] = {", t);
+            for (long k = 0; k < tree->numLeaves * nol; k++)
+            {
+                if (k % nol == 0)
+                {
+                    tree->copyLeafP(k / nol, leafP, 1);
+                }
+                fprintf(pFile, "%s", k == 0 ? "\n    " : (k % nol == 0 ? ",\n    " : ", "));
+                writeDouble(pFile, leafP[k % nol]);
+            }
+            fprintf(pFile, "};\n\n");
+            delete[] leafP;
+        }
+        if (branches)
+        {
+            fprintf(pFile, "inline int tree%d(const double *x)\n{\n", t);
+            writeNode(pFile, tree, t, 0, 4);
+            fprintf(pFile, "}\n");
+        }
+        else
+        {
+            writeTable(pFile, tree, t);
+        }
+    }
+    fprintf(pFile, "\n} // namespace\n\n");
+
+    fprintf(pFile, "DF_EXPORT long num_features()\n{\n    return numFeatures;\n}\n\n");
+    fprintf(pFile, "DF_EXPORT int num_labels()\n{\n    return numLabels;\n}\n\n");
+    fprintf(pFile, "DF_EXPORT int predict(const double *x, double *p)\n{\n");
+    fprintf(pFile, "    for (int j = 0; j < numLabels; j++)\n    {\n        p[j] = 0;\n    }\n");
+    if (weights != NULL)
+    {
+        for (int t = 0; t < numTrees; t++)
+        {
+            fprintf(pFile, "    p[leafY%d[tree%d(x)] - 1] += weight%d;\n", t, t, t);
+        }
+    }
+    else
+    {
+        fprintf(pFile, "    const double *leaf;\n");
+        for (int t = 0; t < numTrees; t++)
+        {
+            fprintf(pFile, "    leaf = leafP%d + tree%d(x) * numLabels;\n", t, t);
+            fprintf(pFile, "    for (int j = 0; j < numLabels; j++)\n    {\n        p[j] += leaf[j];\n    }\n");
+        }
+    }
+    fprintf(pFile, "    int label = 1;\n");
+    fprintf(pFile, "    for (int j = 0; j < numLabels; j++)\n    {\n");
+    fprintf(pFile, "        p[j] /= %s;\n", weights != NULL ? "totalWeight" : "numTrees");
+    fprintf(pFile, "        if (p[j] > p[label - 1])\n        {\n            label = j + 1;\n        }\n    }\n");
+    fprintf(pFile, "    return label;\n}\n");
+
+    if (fclose(pFile) != 0)
+    {
+        throw Error(std::string("Cannot write ") + path + ".");
+    }
+}
+
+inline void CodeGen::writeTree(char *path, Tree *tree)
+{
+    FlatTree *flat = tree->getFlat();
+    writeSource(path, &flat, 1);
+}
+
+inline void CodeGen::writeForest(char *path, Forest *forest)
+{
+    int numTrees = forest->forestSize();
+    FlatTree **flats = new FlatTree *[numTrees];
+    for (int i = 0; i < numTrees; i++)
+    {
+        flats[i] = forest->getTree(i)->getFlat();
+    }
+    writeSource(path, flats, numTrees);
+    delete[] flats;
+}
+
+inline bool CodeGen::compileSource(const char *sourcePath, const char *libraryPath, const char *compiler)
+{
+    std::string command = std::string(compiler) + " -O2 -std=c++11 -shared";
+#ifndef _WIN32
+    command += " -fPIC";
+#endif
+    command += std::string(" \"") + sourcePath + "\" -o \"" + libraryPath + "\"";
+    return system(command.c_str()) == 0;
+}
+
+inline CompiledModel::CompiledModel(const char *libraryPath)
+{
+    long (*numFeatures)() = NULL;
+    int (*numLabels)() = NULL;
+    predictFunction = NULL;
+#ifdef _WIN32
+    library = (void *)LoadLibraryA(libraryPath);
+    if (library != NULL)
+    {
+        numFeatures = (long (*)())GetProcAddress((HMODULE)library, "num_features");
+        numLabels = (int (*)())GetProcAddress((HMODULE)library, "num_labels");
+        predictFunction = (int (*)(const double *, double *))GetProcAddress((HMODULE)library, "predict");
+    }
+#else
+    library = dlopen(libraryPath, RTLD_NOW | RTLD_LOCAL);
+    if (library != NULL)
+    {
+        numFeatures = (long (*)())dlsym(library, "num_features");
+        numLabels = (int (*)())dlsym(library, "num_labels");
+        predictFunction = (int (*)(const double *, double *))dlsym(library, "predict");
+    }
+#endif
+    if (numFeatures == NULL || numLabels == NULL || predictFunction == NULL)
+    {
+        if (library != NULL)
+        {
+#ifdef _WIN32
+            FreeLibrary((HMODULE)library);
+#else
+            dlclose(library);
+#endif
+        }
+        throw Error(std::string("Cannot load ") + libraryPath + ".");
+    }
+    d = numFeatures();
+    nol = numLabels();
+}
+
+inline CompiledModel::~CompiledModel()
+{
+#ifdef _WIN32
+    FreeLibrary((HMODULE)library);
+#else
+    dlclose(library);
+#endif
+}
+
+inline int CompiledModel::predict(const double *x, double *p)
+{
+    return predictFunction(x, p);
+}
+
+inline void CompiledModel::runDecision(double *X, double *Y, double *P, long n, long d_)
+{
+    if (d != d_)
+    {
+        throw Error("Testing data dimension does not match.");
+    }
+
+    double *x = new double[d];
+    double *p = new double[nol];
+    for (long i = 0; i < n; i++)
+    {
+        for (long j = 0; j < d; j++)
+        {
+            x[j] = X[i + j * n];
+        }
+        Y[i] = predict(x, p);
+        for (int j = 0; j < nol; j++)
+        {
+            P[i + j * n] = p[j];
+        }
+    }
+    delete[] x;
+    delete[] p;
+}
+
+#endif
@@ -0,0 +1,952 @@
+/**
+ * @file CompactModel.h
+ * @brief C++ implementation of compact trees with 32-bit thresholds and 16-bit leaves.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @class CompactNode
+ * @brief Class to represent a node of a compact tree, 12 bytes.
+ * @class CodedNode
+ * @brief Class to represent a node of a compact tree with 16-bit codes, 8 bytes.
+ * @class CompactTree
+ * @brief Class to represent a compiled tree with compact nodes and leaves.
+ * @class CompactForest
+ * @brief Class to represent a set of compact trees voting together.
+ * @class CompactReport
+ * @brief Class to hold the differences between a compact and a double model.
+ *
+ * A CompactForest is built from a FlatForest, and trades some precision of
+ * the model for memory. Thresholds are stored in 32 bits, either
+ *
+ *   COMPACT_FLOAT32: as floats, rounded down, so that a float32 input
+ *       goes left exactly when it would in the double model; a double
+ *       input is rounded to float first, and may go the other way when it
+ *       falls between the float and the double threshold; or
+ *   COMPACT_UINT16: as 16-bit codes, from the rank of the threshold among
+ *       the distinct thresholds of its feature in the forest (at most 65535
+ *       per feature). Each input value is coded by a binary search in the
+ *       thresholds of its feature, so the decisions are those of the
+ *       double model for any input. A table of as many equal-width buckets
+ *       as thresholds narrows each search to the thresholds of the value's
+ *       bucket, with a few branchless steps. The code and a 16-bit feature
+ *       (fewer than 65535 features) make 8-byte CodedNodes, and the rows
+ *       of a block are coded once into 16-bit values, half the block of
+ *       floats. The sorted thresholds and their buckets, 10 bytes per
+ *       threshold, are kept besides the trees, so this mode is the
+ *       smallest when trees share their thresholds, as with histogram
+ *       mode, where they are bin edges. Coding still costs time: this mode
+ *       saves memory, and COMPACT_FLOAT32 is the faster one.
+ *
+ * Leaves store either
+ *
+ *   COMPACT_PROBABILITY: the nol probabilities in 16-bit fixed point
+ *       (1/65535 steps), summed exactly over the trees; or
+ *   COMPACT_ARGMAX: only the decided label, each tree voting for one
+ *       label, and P is the fraction of the votes.
+ *
+ * A weighted forest (AdaBoost) always votes with labels and weights.
+ *
+ * Rows are walked a block at a time, with features converted to float or
+ * coded once per block; with AVX-512, 16 rows walk a tree together, twice
+ * the lanes of the double traversal. runDecision() also takes float32 input,
+ * e.g. MATLAB single matrices, without converting X to double. compare()
+ * reports how far the compact model is from the double one on given data.
+ */
+
+#ifndef CompactModel_H
+#define CompactModel_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <stdint.h>
+#include <vector>
+#include "DecisionTree.h"
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+enum CompactThreshold
+{
+    COMPACT_FLOAT32 = 0, // float thresholds, rounded down
+    COMPACT_UINT16 = 1   // per-feature 16-bit codes, exact
+};
+
+enum CompactLeaf
+{
+    COMPACT_PROBABILITY = 0, // 16-bit fixed-point probabilities
+    COMPACT_ARGMAX = 1       // decided label only
+};
+
+class CompactNode
+{
+public:
+    float threshold; // split threshold, or its code in COMPACT_UINT16
+    int feature;     // split feature, -1 for leaf
+    int child;       // as in FlatNode: left child of a split, or index into the leaf table
+};
+
+class CodedNode
+{
+public:
+    uint16_t bound;   // split: a value goes left if its code is below bound, 0 for a NaN threshold
+    uint16_t feature; // split feature, leaf for leaf
+    int child;        // as in FlatNode: left child of a split, or index into the leaf table
+
+    static const uint16_t leaf = 0xffff;
+};
+
+class CompactTree
+{
+public:
+    long numNodes;      // number of nodes
+    long numLeaves;     // number of leaves
+    int nol;            // number of unique labels
+    CompactNode *nodes; // nodes in breadth-first order, root first, NULL if coded
+    CodedNode *coded;   // nodes of COMPACT_UINT16 in the same order, NULL otherwise
+    uint16_t *leafP;    // numLeaves * nol probabilities times 65535, NULL unless COMPACT_PROBABILITY
+    int *leafY;         // decision label of each leaf, between 1 and nol
+
+    CompactTree(FlatTree *tree, bool probabilities, bool codes);
+    ~CompactTree();
+    long bytes(); // memory of nodes and leaves
+
+    /**
+     * @brief Find the leaves of num instances, with SIMD if available.
+     * @param x Features of the instances, row by row, d values per row.
+     */
+    void findLeaves(const float *x, long d, long num, int *leaves);
+    void findLeaves(const uint16_t *x, long d, long num, int *leaves); // coded values
+};
+
+class CompactReport
+{
+public:
+    long bytes;               // memory of the compact trees
+    long referenceBytes;      // memory of the double trees
+    double agreement;         // fraction of rows decided as by the double model
+    double maxDeltaP;         // largest absolute difference of P
+    double meanDeltaP;        // mean absolute difference of P
+    double accuracy;          // accuracy given labels, or NaN
+    double referenceAccuracy; // accuracy of the double model given labels, or NaN
+};
+
+class CompactForest
+{
+private:
+    long *codeBegin;    // COMPACT_UINT16: thresholds of feature f are codeEdges[codeBegin[f], ..., codeBegin[f+1]-1]
+    double *codeEdges;  // distinct thresholds sorted within each feature
+    uint16_t *codeGuide; // m+1 entries of feature f at codeGuide[codeBegin[f] + f]: thresholds in buckets below k
+    double *codeScale;  // buckets per unit of feature f, its m buckets spanning its thresholds, or 0 for one bucket
+    int *codeSteps;     // search steps of feature f, enough for its fullest bucket
+    long codePadding;   // thresholds after the last feature's, read and masked by searches
+
+    static long bucketOf(double value, double first, double scale, long m); // nondecreasing in value, NaN excluded
+
+    template <typename T>
+    void convertBlock(const T *X, long n, long begin, long num, float *block); // column-major X to float rows
+    template <typename T>
+    void codeBlock(const T *X, long n, long begin, long num, uint16_t *block); // column-major X to coded rows
+    template <typename T>
+    void run(const T *X, double *Y, double *P, long n, long d_, int numThreads);
+
+public:
+    long d;            // dimension of each instance
+    int nol;           // number of unique labels
+    int size;          // number of trees
+    int thresholdMode; // CompactThreshold
+    int leafMode;      // CompactLeaf, COMPACT_ARGMAX if weighted
+    CompactTree **trees;
+    double *weights;    // vote weight of each tree, NULL for unweighted
+    double totalWeight; // sum of weights, in tree order
+
+    /**
+     * @brief Constructor.
+     * @param forest The double model, which may be deleted afterwards.
+     */
+    CompactForest(FlatForest *forest, int thresholdMode_, int leafMode_);
+    ~CompactForest();
+
+    /**
+     * @brief Whether a forest can be made compact with the given thresholds:
+     * COMPACT_UINT16 needs at most 65535 thresholds per feature, and fewer
+     * than 65535 features.
+     */
+    static bool supports(FlatForest *forest, int thresholdMode_);
+    static long bytes(FlatForest *forest); // memory of the double trees
+    long bytes();                          // memory of the compact trees and codes
+
+    /**
+     * @brief Make decisions given testing data, column-major as in
+     * FlatForest::runDecision().
+     */
+    void runDecision(const double *X, double *Y, double *P, long n, long d, int numThreads = 1);
+    void runDecision(const float *X, double *Y, double *P, long n, long d, int numThreads = 1);
+
+    /**
+     * @brief Run both models on testing data, and report the differences.
+     * @param labels True labels of the rows, or NULL.
+     * @param floatInput Run the compact model on X converted to float32.
+     */
+    CompactReport compare(FlatForest *reference, double *X, const int *labels, long n, long d,
+                          bool floatInput = false, int numThreads = 1);
+};
+
+/**
+ * @brief Find the leaves of num instances with AVX-512, 2 x 16 at a time,
+ * as findLeavesAVX512() in SimdTraversal.h, with the first 32 nodes looked
+ * up by permutes.
+ * @return Number of instances done; the rest are left to the scalar code.
+ */
+long findLeavesCompactAVX512(const CompactNode *nodes, long numNodes, const float *x, long d, long num, int *leaves);
+long findLeavesCodedAVX512(const CodedNode *nodes, long numNodes, const uint16_t *x, long d, long num, int *leaves);
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+inline CompactTree::CompactTree(FlatTree *tree, bool probabilities, bool codes)
+{
+    numNodes = tree->numNodes;
+    numLeaves = tree->numLeaves;
+    nol = tree->nol;
+    nodes = NULL;
+    coded = NULL;
+    if (codes)
+    {
+        coded = new CodedNode[numNodes];
+        for (long k = 0; k < numNodes; k++)
+        {
+            int feature = tree->nodes[k].feature;
+            coded[k].feature = feature < 0 ? CodedNode::leaf : (uint16_t)feature;
+            coded[k].child = tree->nodes[k].child;
+            coded[k].bound = 0;
+        }
+    }
+    else
+    {
+        nodes = new CompactNode[numNodes];
+        for (long k = 0; k < numNodes; k++)
+        {
+            nodes[k].feature = tree->nodes[k].feature;
+            nodes[k].child = tree->nodes[k].child;
+            nodes[k].threshold = 0;
+        }
+    }
+    leafY = new int[numLeaves];
+    for (long k = 0; k < numLeaves; k++)
+    {
+        leafY[k] = tree->leafY[k];
+    }
+    leafP = NULL;
+    if (probabilities)
+    {
+        leafP = new uint16_t[numLeaves * nol];
+        double *row = new double[nol];
+        for (long k = 0; k < numLeaves * nol; k++)
+        {
+            if (k % nol == 0)
+            {
+                tree->copyLeafP(k / nol, row, 1);
+            }
+            double p = row[k % nol];
+            leafP[k] = (uint16_t)floor((p < 0 ? 0 : (p > 1 ? 1 : p)) * 65535 + 0.5);
+        }
+        delete[] row;
+    }
+}
+
+inline CompactTree::~CompactTree()
+{
+    if (nodes != NULL) delete[] nodes;
+    if (coded != NULL) delete[] coded;
+    delete[] leafY;
+    if (leafP != NULL) delete[] leafP;
+}
+
+inline long CompactTree::bytes()
+{
+    return numNodes * (coded != NULL ? sizeof(CodedNode) : sizeof(CompactNode)) + numLeaves * sizeof(int) +
+           (leafP != NULL ? numLeaves * nol * sizeof(uint16_t) : 0);
+}
+
+inline void CompactTree::findLeaves(const float *x, long d, long num, int *leaves)
+{
+    long done = 0;
+    if (simdLevel() >= SIMD_AVX512)
+    {
+        done = findLeavesCompactAVX512(nodes, numNodes, x, d, num, leaves);
+    }
+    for (long i = done; i < num; i++)
+    {
+        const float *row = x + i * d;
+        CompactNode *node = nodes;
+        while (node->feature >= 0)
+        {
+            // NaN is never <= threshold, so it goes right as in decideTree
+            node = nodes + node->child + !(row[node->feature] <= node->threshold);
+        }
+        leaves[i] = node->child;
+    }
+}
+
+inline void CompactTree::findLeaves(const uint16_t *x, long d, long num, int *leaves)
+{
+    long done = 0;
+    if (simdLevel() >= SIMD_AVX512)
+    {
+        done = findLeavesCodedAVX512(coded, numNodes, x, d, num, leaves);
+    }
+    for (long i = done; i < num; i++)
+    {
+        const uint16_t *row = x + i * d;
+        CodedNode *node = coded;
+        while (node->feature != CodedNode::leaf)
+        {
+            // NaN is coded above every bound, so it goes right as in decideTree
+            node = coded + node->child + !(row[node->feature] < node->bound);
+        }
+        leaves[i] = node->child;
+    }
+}
+
+inline CompactForest::CompactForest(FlatForest *forest, int thresholdMode_, int leafMode_)
+{
+    if (!supports(forest, thresholdMode_))
+    {
+        throw Error("16-bit codes need at most 65535 thresholds per feature, and fewer than 65535 features.");
+    }
+    d = forest->d;
+    nol = forest->nol;
+    size = forest->size;
+    thresholdMode = thresholdMode_;
+    leafMode = forest->weights != NULL ? COMPACT_ARGMAX : leafMode_;
+    weights = NULL;
+    totalWeight = size;
+    if (forest->weights != NULL)
+    {
+        weights = new double[size];
+        for (int t = 0; t < size; t++)
+        {
+            weights[t] = forest->weights[t];
+        }
+        totalWeight = forest->totalWeight;
+    }
+
+    trees = new CompactTree *[size];
+    for (int t = 0; t < size; t++)
+    {
+        trees[t] = new CompactTree(forest->trees[t], leafMode == COMPACT_PROBABILITY, thresholdMode == COMPACT_UINT16);
+    }
+
+    // distinct thresholds of each feature, for codes
+    codeBegin = NULL;
+    codeEdges = NULL;
+    codeGuide = NULL;
+    codeScale = NULL;
+    codeSteps = NULL;
+    codePadding = 0;
+    if (thresholdMode == COMPACT_UINT16)
+    {
+        std::vector<std::vector<double> > edges(d);
+        for (int t = 0; t < size; t++)
+        {
+            FlatTree *tree = forest->trees[t];
+            for (long k = 0; k < tree->numNodes; k++)
+            {
+                double threshold = tree->nodes[k].threshold;
+                if (tree->nodes[k].feature >= 0 && threshold == threshold)
+                {
+                    edges[tree->nodes[k].feature].push_back(threshold);
+                }
+            }
+        }
+        codeBegin = new long[d + 1];
+        codeBegin[0] = 0;
+        for (long f = 0; f < d; f++)
+        {
+            std::sort(edges[f].begin(), edges[f].end());
+            edges[f].erase(std::unique(edges[f].begin(), edges[f].end()), edges[f].end());
+            codeBegin[f + 1] = codeBegin[f] + (long)edges[f].size();
+        }
+
+        // thresholds of bucket k are guide[k], ..., guide[k+1]-1, since buckets are
+        // nondecreasing; values of bucket k are above all thresholds of lower buckets
+        // and below all of higher ones, so their codes lie in that range
+        codeGuide = new uint16_t[codeBegin[d] + d];
+        codeScale = new double[d > 0 ? d : 1];
+        codeSteps = new int[d > 0 ? d : 1];
+        for (long f = 0; f < d; f++)
+        {
+            const double *begin = edges[f].data();
+            long m = codeBegin[f + 1] - codeBegin[f];
+            double scale = m > 1 ? m / (begin[m - 1] - begin[0]) : 0;
+            codeScale[f] = scale > 0 && scale < INFINITY ? scale : 0;
+            uint16_t *guide = codeGuide + codeBegin[f] + f;
+            std::fill(guide, guide + m + 1, 0);
+            for (long e = 0; e < m; e++)
+            {
+                guide[bucketOf(begin[e], begin[0], codeScale[f], m) + 1]++;
+            }
+            long fullest = 0;
+            for (long k = 0; k < m; k++)
+            {
+                fullest = std::max(fullest, (long)guide[k + 1]);
+                guide[k + 1] += guide[k];
+            }
+            codeSteps[f] = 0;
+            while ((1L << codeSteps[f]) <= fullest)
+            {
+                codeSteps[f]++;
+            }
+            codePadding = std::max(codePadding, 1L << codeSteps[f]);
+        }
+
+        codeEdges = new double[codeBegin[d] + codePadding];
+        std::fill(codeEdges, codeEdges + codeBegin[d] + codePadding, INFINITY);
+        for (long f = 0; f < d; f++)
+        {
+            std::copy(edges[f].begin(), edges[f].end(), codeEdges + codeBegin[f]);
+        }
+    }
+
+    for (int t = 0; t < size; t++)
+    {
+        FlatTree *tree = forest->trees[t];
+        for (long k = 0; k < tree->numNodes; k++)
+        {
+            int f = tree->nodes[k].feature;
+            double threshold = tree->nodes[k].threshold;
+            if (f < 0)
+            {
+                continue;
+            }
+            if (thresholdMode == COMPACT_UINT16)
+            {
+                // x <= threshold exactly when code(x) <= rank, i.e. code(x) < rank + 1;
+                // nothing is below bound 0, so NaN thresholds send every value right
+                const double *begin = codeEdges + codeBegin[f];
+                const double *end = codeEdges + codeBegin[f + 1];
+                trees[t]->coded[k].bound =
+                    threshold == threshold ? (uint16_t)(std::lower_bound(begin, end, threshold) - begin + 1) : 0;
+            }
+            else
+            {
+                // the largest float not above the threshold
+                float value = (float)threshold;
+                if ((double)value > threshold)
+                {
+                    value = nextafterf(value, -INFINITY);
+                }
+                trees[t]->nodes[k].threshold = value;
+            }
+        }
+    }
+}
+
+inline CompactForest::~CompactForest()
+{
+    for (int t = 0; t < size; t++)
+    {
+        delete trees[t];
+    }
+    delete[] trees;
+    if (weights != NULL) delete[] weights;
+    if (codeBegin != NULL) delete[] codeBegin;
+    if (codeEdges != NULL) delete[] codeEdges;
+    if (codeGuide != NULL) delete[] codeGuide;
+    if (codeScale != NULL) delete[] codeScale;
+    if (codeSteps != NULL) delete[] codeSteps;
+}
+
+inline bool CompactForest::supports(FlatForest *forest, int thresholdMode_)
+{
+    if (thresholdMode_ != COMPACT_UINT16)
+    {
+        return true;
+    }
+    if (forest->d >= CodedNode::leaf)
+    {
+        return false;
+    }
+    std::vector<std::vector<double> > edges(forest->d);
+    for (int t = 0; t < forest->size; t++)
+    {
+        FlatTree *tree = forest->trees[t];
+        for (long k = 0; k < tree->numNodes; k++)
+        {
+            if (tree->nodes[k].feature >= 0)
+            {
+                edges[tree->nodes[k].feature].push_back(tree->nodes[k].threshold);
+            }
+        }
+    }
+    for (long f = 0; f < forest->d; f++)
+    {
+        std::sort(edges[f].begin(), edges[f].end());
+        if (std::unique(edges[f].begin(), edges[f].end()) - edges[f].begin() > 65535)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline long CompactForest::bytes(FlatForest *forest)
+{
+    long total = 0;
+    for (int t = 0; t < forest->size; t++)
+    {
+        FlatTree *tree = forest->trees[t];
+        total += tree->numNodes * sizeof(FlatNode) + tree->numLeaves * sizeof(int);
+        if (tree->leafP != NULL)
+        {
+            total += tree->numLeaves * tree->nol * sizeof(double);
+        }
+        else
+        {
+            total += (tree->numLeaves + 1 + tree->numValues) * sizeof(int) + tree->numValues * sizeof(double);
+        }
+    }
+    return total;
+}
+
+inline long CompactForest::bytes()
+{
+    long total = 0;
+    if (codeBegin != NULL)
+    {
+        total = (d + 1) * sizeof(long) + (codeBegin[d] + codePadding) * sizeof(double) + (codeBegin[d] + d) * sizeof(uint16_t) +
+                d * (sizeof(double) + sizeof(int));
+    }
+    for (int t = 0; t < size; t++)
+    {
+        total += trees[t]->bytes();
+    }
+    return total;
+}
+
+template <typename T>
+inline void CompactForest::convertBlock(const T *X, long n, long begin, long num, float *block)
+{
+    for (long j = 0; j < d; j++)
+    {
+        const T *column = X + begin + j * n;
+        for (long i = 0; i < num; i++)
+        {
+            block[i * d + j] = (float)column[i];
+        }
+    }
+}
+
+inline long CompactForest::bucketOf(double value, double first, double scale, long m)
+{
+    // clamped to the m buckets; only a zero scale gives NaN, for infinite values
+    double x = (value - first) * scale;
+    return x >= 0 ? (x < m ? (long)x : m - 1) : 0;
+}
+
+template <typename T>
+inline void CompactForest::codeBlock(const T *X, long n, long begin, long num, uint16_t *block)
+{
+    for (long j = 0; j < d; j++)
+    {
+        // code of a value: number of thresholds below it, all of them for NaN
+        const T *column = X + begin + j * n;
+        const double *edges = codeEdges + codeBegin[j];
+        const uint16_t *guide = codeGuide + codeBegin[j] + j;
+        long m = codeBegin[j + 1] - codeBegin[j];
+        int steps = codeSteps[j];
+        double scale = codeScale[j];
+        for (long i = 0; i < num; i++)
+        {
+            double value = (double)column[i];
+            long code = m;
+            if (value == value && m > 0)
+            {
+                // branchless lower_bound in the thresholds of the bucket, with the same
+                // number of steps for every value of the feature, so no branch is mispredicted
+                long k = bucketOf(value, edges[0], scale, m);
+                long end = guide[k + 1];
+                code = guide[k];
+                for (long step = (1L << steps) >> 1; step > 0; step >>= 1)
+                {
+                    long next = code + step;
+                    code += step & -(long)((next <= end) & (edges[next - 1] < value));
+                }
+            }
+            block[i * d + j] = (uint16_t)code;
+        }
+    }
+}
+
+template <typename T>
+inline void CompactForest::run(const T *X, double *Y, double *P, long n, long d_, int numThreads)
+{
+    if (d != d_)
+    {
+        throw Error("Testing data dimension does not match.");
+    }
+
+    long rows = d > 0 ? 4096 / d : 512;
+    rows = rows < 16 ? 16 : (rows > 512 ? 512 : rows);
+    long numBlocks = (n + rows - 1) / rows;
+    double scale = leafMode == COMPACT_PROBABILITY ? size * 65535.0 : totalWeight;
+    bool codes = thresholdMode == COMPACT_UINT16;
+
+    // each worker claims blocks until none is left, with its own buffers
+    ThreadPool pool(numThreads);
+    std::atomic<long> next(0);
+    long numWorkers = pool.size() < numBlocks ? pool.size() : numBlocks;
+    pool.run(numWorkers, [&](long) {
+        // one more coded value, as AVX-512 reads 32 bits at each value
+        std::vector<float> block(codes ? 0 : rows * d);
+        std::vector<uint16_t> codedBlock(codes ? rows * d + 1 : 0);
+        std::vector<double> votes(rows * nol);
+        std::vector<int> leaves(rows);
+        for (long b = next++; b < numBlocks; b = next++)
+        {
+            long begin = b * rows;
+            long num = n - begin < rows ? n - begin : rows;
+            if (codes)
+            {
+                codeBlock(X, n, begin, num, codedBlock.data());
+            }
+            else
+            {
+                convertBlock(X, n, begin, num, block.data());
+            }
+            std::fill(votes.begin(), votes.begin() + num * nol, 0.0);
+
+            // votes are summed in tree order; 16-bit probabilities are summed exactly
+            for (int t = 0; t < size; t++)
+            {
+                CompactTree *tree = trees[t];
+                if (codes)
+                {
+                    tree->findLeaves(codedBlock.data(), d, num, leaves.data());
+                }
+                else
+                {
+                    tree->findLeaves(block.data(), d, num, leaves.data());
+                }
+                for (long i = 0; i < num; i++)
+                {
+                    double *vote = votes.data() + i * nol;
+                    if (leafMode == COMPACT_PROBABILITY)
+                    {
+                        const uint16_t *leafP = tree->leafP + (long)leaves[i] * nol;
+                        for (int j = 0; j < nol; j++)
+                        {
+                            vote[j] += leafP[j];
+                        }
+                    }
+                    else
+                    {
+                        vote[tree->leafY[leaves[i]] - 1] += weights != NULL ? weights[t] : 1;
+                    }
+                }
+            }
+
+            for (long i = 0; i < num; i++)
+            {
+                double *vote = votes.data() + i * nol;
+                double *p = P + begin + i;
+                Y[begin + i] = 1;
+                for (int j = 0; j < nol; j++)
+                {
+                    p[j * n] = vote[j] / scale;
+                    if (p[j * n] > p[(long)(Y[begin + i] - 1) * n])
+                    {
+                        Y[begin + i] = j + 1;
+                    }
+                }
+            }
+        }
+    });
+}
+
+inline void CompactForest::runDecision(const double *X, double *Y, double *P, long n, long d_, int numThreads)
+{
+    run(X, Y, P, n, d_, numThreads);
+}
+
+inline void CompactForest::runDecision(const float *X, double *Y, double *P, long n, long d_, int numThreads)
+{
+    run(X, Y, P, n, d_, numThreads);
+}
+
+inline CompactReport CompactForest::compare(FlatForest *reference, double *X, const int *labels, long n, long d_,
+                                            bool floatInput, int numThreads)
+{
+    double *Y0 = new double[n];
+    double *P0 = new double[n * nol];
+    double *Y1 = new double[n];
+    double *P1 = new double[n * nol];
+    reference->runDecision(X, Y0, P0, n, d_, numThreads);
+    if (floatInput)
+    {
+        float *X1 = new float[n * d_];
+        for (long i = 0; i < n * d_; i++)
+        {
+            X1[i] = (float)X[i];
+        }
+        runDecision(X1, Y1, P1, n, d_, numThreads);
+        delete[] X1;
+    }
+    else
+    {
+        runDecision(X, Y1, P1, n, d_, numThreads);
+    }
+
+    CompactReport report;
+    report.bytes = bytes();
+    report.referenceBytes = bytes(reference);
+    long agree = 0, correct = 0, referenceCorrect = 0;
+    for (long i = 0; i < n; i++)
+    {
+        agree += Y0[i] == Y1[i];
+        if (labels != NULL)
+        {
+            correct += Y1[i] == labels[i];
+            referenceCorrect += Y0[i] == labels[i];
+        }
+    }
+    report.agreement = n > 0 ? (double)agree / n : 1;
+    report.maxDeltaP = 0;
+    report.meanDeltaP = 0;
+    for (long i = 0; i < n * nol; i++)
+    {
+        double delta = fabs(P1[i] - P0[i]);
+        report.maxDeltaP = delta > report.maxDeltaP ? delta : report.maxDeltaP;
+        report.meanDeltaP += delta;
+    }
+    report.meanDeltaP = n > 0 ? report.meanDeltaP / (n * nol) : 0;
+    report.accuracy = labels != NULL && n > 0 ? (double)correct / n : NAN;
+    report.referenceAccuracy = labels != NULL && n > 0 ? (double)referenceCorrect / n : NAN;
+
+    delete[] Y0;
+    delete[] P0;
+    delete[] Y1;
+    delete[] P1;
+    return report;
+}
+
+#ifdef DF_SIMD_X86
+
+#if defined(__GNUC__) && !defined(__clang__)
+// the AVX-512 intrinsics of GCC start from self-initialized vectors
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f"))) inline long findLeavesCompactAVX512(
+    const CompactNode *nodes, long numNodes, const float *x, long d, long num, int *leaves)
+{
+    // row offsets are 32-bit lanes
+    if (num * d > 0x7fffffffL)
+    {
+        return 0;
+    }
+
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i two = _mm512_set1_epi32(2);
+    const __m512i top = _mm512_set1_epi32(32);
+    const __m512i lanes = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m512i stride = _mm512_set1_epi32((int)d);
+    const float *base = (const float *)nodes;
+
+    // the first 32 nodes, to be looked up by permutes
+    float topThreshold[32];
+    int topFeature[32], topChild[32];
+    for (int k = 0; k < 32; k++)
+    {
+        topThreshold[k] = k < numNodes ? nodes[k].threshold : 0;
+        topFeature[k] = k < numNodes ? nodes[k].feature : -1;
+        topChild[k] = k < numNodes ? nodes[k].child : 0;
+    }
+    const __m512 threshold0 = _mm512_loadu_ps(topThreshold);
+    const __m512 threshold1 = _mm512_loadu_ps(topThreshold + 16);
+    const __m512i feature0 = _mm512_loadu_si512((const void *)topFeature);
+    const __m512i feature1 = _mm512_loadu_si512((const void *)(topFeature + 16));
+    const __m512i child0 = _mm512_loadu_si512((const void *)topChild);
+    const __m512i child1 = _mm512_loadu_si512((const void *)(topChild + 16));
+
+    long i = 0;
+    for (; i + 32 <= num; i += 32)
+    {
+        __m512i node[2], row[2], child[2];
+        for (int g = 0; g < 2; g++)
+        {
+            node[g] = zero;
+            row[g] = _mm512_mullo_epi32(_mm512_add_epi32(lanes, _mm512_set1_epi32((int)(i + 16 * g))), stride);
+        }
+        for (bool done = false; !done;)
+        {
+            done = true;
+            for (int g = 0; g < 2; g++)
+            {
+                __m512 threshold;
+                __m512i feature;
+                if (_mm512_cmplt_epu32_mask(node[g], top) == 0xffff)
+                {
+                    threshold = _mm512_permutex2var_ps(threshold0, node[g], threshold1);
+                    feature = _mm512_permutex2var_epi32(feature0, node[g], feature1);
+                    child[g] = _mm512_permutex2var_epi32(child0, node[g], child1);
+                }
+                else
+                {
+                    // CompactNode is 3 words: threshold, then feature and child
+                    __m512i offset = _mm512_add_epi32(_mm512_slli_epi32(node[g], 1), node[g]);
+                    threshold = _mm512_i32gather_ps(offset, base, 4);
+                    feature = _mm512_i32gather_epi32(_mm512_add_epi32(offset, one), base, 4);
+                    child[g] = _mm512_i32gather_epi32(_mm512_add_epi32(offset, two), base, 4);
+                }
+                __mmask16 active = _mm512_cmpge_epi32_mask(feature, zero);
+                done &= active == 0;
+
+                __m512 value = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), active,
+                                                        _mm512_add_epi32(row[g], feature), x, 4);
+
+                // right child is child + 1, left child if value <= threshold
+                __mmask16 le = _mm512_cmp_ps_mask(value, threshold, _CMP_LE_OQ);
+                __m512i next = _mm512_add_epi32(child[g], one);
+                next = _mm512_mask_sub_epi32(next, le, next, one);
+                node[g] = _mm512_mask_mov_epi32(node[g], active, next);
+            }
+        }
+        for (int g = 0; g < 2; g++)
+        {
+            _mm512_storeu_si512((void *)(leaves + i + 16 * g), child[g]);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx512f"))) inline long findLeavesCodedAVX512(
+    const CodedNode *nodes, long numNodes, const uint16_t *x, long d, long num, int *leaves)
+{
+    // row offsets are 32-bit lanes
+    if (num * d > 0x7fffffffL)
+    {
+        return 0;
+    }
+
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i low = _mm512_set1_epi32(0xffff);
+    const __m512i leaf = _mm512_set1_epi32(CodedNode::leaf);
+    const __m512i top = _mm512_set1_epi32(32);
+    const __m512i lanes = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m512i stride = _mm512_set1_epi32((int)d);
+    const int *base = (const int *)nodes;
+
+    // the first 32 nodes, to be looked up by permutes
+    int topBound[32], topFeature[32], topChild[32];
+    for (int k = 0; k < 32; k++)
+    {
+        topBound[k] = k < numNodes ? nodes[k].bound : 0;
+        topFeature[k] = k < numNodes ? nodes[k].feature : CodedNode::leaf;
+        topChild[k] = k < numNodes ? nodes[k].child : 0;
+    }
+    const __m512i bound0 = _mm512_loadu_si512((const void *)topBound);
+    const __m512i bound1 = _mm512_loadu_si512((const void *)(topBound + 16));
+    const __m512i feature0 = _mm512_loadu_si512((const void *)topFeature);
+    const __m512i feature1 = _mm512_loadu_si512((const void *)(topFeature + 16));
+    const __m512i child0 = _mm512_loadu_si512((const void *)topChild);
+    const __m512i child1 = _mm512_loadu_si512((const void *)(topChild + 16));
+
+    long i = 0;
+    for (; i + 32 <= num; i += 32)
+    {
+        __m512i node[2], row[2], child[2];
+        for (int g = 0; g < 2; g++)
+        {
+            node[g] = _mm512_setzero_si512();
+            row[g] = _mm512_mullo_epi32(_mm512_add_epi32(lanes, _mm512_set1_epi32((int)(i + 16 * g))), stride);
+        }
+        for (bool done = false; !done;)
+        {
+            done = true;
+            for (int g = 0; g < 2; g++)
+            {
+                __m512i bound, feature;
+                if (_mm512_cmplt_epu32_mask(node[g], top) == 0xffff)
+                {
+                    bound = _mm512_permutex2var_epi32(bound0, node[g], bound1);
+                    feature = _mm512_permutex2var_epi32(feature0, node[g], feature1);
+                    child[g] = _mm512_permutex2var_epi32(child0, node[g], child1);
+                }
+                else
+                {
+                    // CodedNode is 2 words: bound and feature in 16 bits each, then child
+                    __m512i offset = _mm512_slli_epi32(node[g], 1);
+                    __m512i word = _mm512_i32gather_epi32(offset, base, 4);
+                    bound = _mm512_and_si512(word, low);
+                    feature = _mm512_srli_epi32(word, 16);
+                    child[g] = _mm512_i32gather_epi32(_mm512_add_epi32(offset, one), base, 4);
+                }
+                __mmask16 active = _mm512_cmpneq_epi32_mask(feature, leaf);
+                done &= active == 0;
+
+                // 32 bits at the coded value, of which the low 16 are the value
+                __m512i value = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active,
+                                                            _mm512_add_epi32(row[g], feature), x, 2);
+                value = _mm512_and_si512(value, low);
+
+                // right child is child + 1, left child if value < bound
+                __mmask16 lt = _mm512_cmplt_epu32_mask(value, bound);
+                __m512i next = _mm512_add_epi32(child[g], one);
+                next = _mm512_mask_sub_epi32(next, lt, next, one);
+                node[g] = _mm512_mask_mov_epi32(node[g], active, next);
+            }
+        }
+        for (int g = 0; g < 2; g++)
+        {
+            _mm512_storeu_si512((void *)(leaves + i + 16 * g), child[g]);
+        }
+    }
+    return i;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#else
+
+inline long findLeavesCompactAVX512(const CompactNode *, long, const float *, long, long, int *)
+{
+    return 0;
+}
+
+inline long findLeavesCodedAVX512(const CodedNode *, long, const uint16_t *, long, long, int *)
+{
+    return 0;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,680 @@
+/**
+ * @file DForest.cpp
+ * @brief The dforest command line tool: train and run trees and forests.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * A standalone program, not a MEX file, built by CMake as dforest and
+ * linked with the decisionforest library.
+ *
+ * usage:
+ *     dforest train --data path --model path [options]
+ *       --data: training data, a CSV file with one instance per row, or a
+ *           column file (see DataSource.h), streamed a chunk of rows at a time
+ *       --labels (optional): the labels, integers between 1 and nol, a CSV file
+ *           of one column or a column file of one feature; without it, the last
+ *           column of the CSV data holds the labels
+ *       --model: the resulting tree file, forest folder of 1.tree, 2.tree, ...,
+ *           or binary model file with --format binary
+ *       --trees: number of trees, default 1 for a single tree
+ *       --depth: maximum depth of each tree, 0 for fully grown trees, default 10
+ *       --noc: number of candidates at each node, default 100
+ *       --threads: number of training threads, 0 for all cores (default)
+ *       --format: text (default) or binary
+ *       --max-bins: if positive, train in histogram mode on features quantized
+ *           into at most max-bins (up to 256) bins, default 0
+ *       --max-features: number of features sampled at each node, default 0 for all
+ *       --sample-ratio: train each tree on round(sample-ratio * n) sampled rows, default 1
+ *       --bootstrap: sample rows with replacement
+ *       --level-wise: train breadth-first, one sweep over the rows per level
+ *       --seed: seed of the random candidates, default random
+ *     dforest predict --data path --model path [options]
+ *       --data: testing data, a CSV file or a column file; data with one more
+ *           column than the model has features holds the labels in the last
+ *           column, and the accuracy is reported
+ *       --model: a tree file, a forest folder or a binary model file
+ *       --out: path of the decisions, one label per row, default standard output
+ *       --probabilities: write the probabilities of every label after the label
+ *       --threads: number of threads, 0 for all cores (default)
+ *       --simd: vector instructions of tree traversal, scalar, avx2 or avx512,
+ *           lowered to what the CPU supports; default avx512 where
+ *           supported, scalar elsewhere
+ *
+ * A CSV file holds numbers separated by commas, and may start with a
+ * header line. An empty field is a missing value (NaN). Errors are printed
+ * to standard error, and the exit code is 1, or 2 for a wrong command line.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "DecisionTree.h"
+#include "ModelFile.h"
+
+#ifdef _WIN32
+#define stat _stat
+#endif
+
+/**********************************************
+ * Reading data
+ **********************************************/
+
+/**
+ * @brief A matrix read from a CSV file, or mapped from a column file,
+ * column-major as X in MATLAB.
+ */
+class Table
+{
+public:
+    std::vector<double> values; // the matrix, if read from a CSV file
+    ColumnFile *file;           // the mapped column file, or NULL
+    double *X;                  // feature f of row i at X[i + f * n]
+    long n;                     // number of rows
+    long d;                     // number of columns
+
+    Table();
+    ~Table();
+    void read(const char *path); // a column file, or a CSV file
+};
+
+Table::Table()
+{
+    file = NULL;
+    X = NULL;
+    n = 0;
+    d = 0;
+}
+
+Table::~Table()
+{
+    if (file != NULL) delete file;
+}
+
+/**
+ * @brief Parse the numbers of one CSV line into values.
+ * @return false if a field is not a number.
+ */
+static bool parseLine(char *line, std::vector<double> &values)
+{
+    values.clear();
+    char *p = line;
+    while (true)
+    {
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+        char *end;
+        double value = strtod(p, &end);
+        if (end == p)
+        {
+            // an empty field is a missing value
+            if (*p != ',' && *p != '\r' && *p != '\n' && *p != '\0')
+            {
+                return false;
+            }
+            value = NAN;
+        }
+        values.push_back(value);
+        p = end;
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+        if (*p != ',')
+        {
+            return *p == '\r' || *p == '\n' || *p == '\0';
+        }
+        p++;
+    }
+}
+
+void Table::read(const char *path)
+{
+    if (ColumnFile::isColumnFile(path))
+    {
+        file = new ColumnFile(path, true);
+        n = file->n;
+        d = file->d;
+        X = file->columns();
+        if (X == NULL)
+        {
+            // not mapped, read it at once
+            values.resize(n * d);
+            long stride;
+            const double *rows = file->readRows(0, n, values.data(), stride);
+            X = values.data();
+            if (rows != X)
+            {
+                for (long f = 0; f < d; f++)
+                {
+                    memcpy(X + f * n, rows + f * stride, n * sizeof(double));
+                }
+            }
+        }
+        return;
+    }
+
+    FILE *pFile = fopen(path, "r");
+    if (pFile == NULL)
+    {
+        throw Error(std::string("Cannot open ") + path + ".");
+    }
+    std::vector<char> line;
+    std::vector<double> fields;
+    std::vector<double> rows; // row-major
+    long lineNumber = 0;
+    d = -1;
+    while (Tree::readLine(pFile, line))
+    {
+        lineNumber++;
+        if (line[strspn(line.data(), " \t\r\n")] == '\0')
+        {
+            continue; // blank line
+        }
+        if (!parseLine(line.data(), fields))
+        {
+            if (lineNumber == 1)
+            {
+                continue; // header
+            }
+            fclose(pFile);
+            throw Error(std::string(path) + " has a field that is not a number on line " +
+                        std::to_string(lineNumber) + ".");
+        }
+        if (d == -1)
+        {
+            d = (long)fields.size();
+        }
+        if ((long)fields.size() != d)
+        {
+            fclose(pFile);
+            throw Error(std::string(path) + " has " + std::to_string(fields.size()) + " columns on line " +
+                        std::to_string(lineNumber) + ", instead of " + std::to_string(d) + ".");
+        }
+        rows.insert(rows.end(), fields.begin(), fields.end());
+    }
+    fclose(pFile);
+    if (d <= 0)
+    {
+        throw Error(std::string(path) + " has no data.");
+    }
+
+    n = (long)rows.size() / d;
+    values.resize(n * d);
+    for (long i = 0; i < n; i++)
+    {
+        for (long f = 0; f < d; f++)
+        {
+            values[i + f * n] = rows[i * d + f];
+        }
+    }
+    X = values.data();
+}
+
+/**
+ * @brief Convert a column of labels to integers between 1 and nol.
+ */
+static std::vector<int> toLabels(const double *column, long n, const char *path)
+{
+    std::vector<int> Y(n);
+    for (long i = 0; i < n; i++)
+    {
+        if (!(column[i] >= 1) || column[i] != floor(column[i]) || column[i] > 2147483647.0)
+        {
+            throw Error(std::string("Labels of ") + path + " should be integers between 1 and nol.");
+        }
+        Y[i] = (int)column[i];
+    }
+    return Y;
+}
+
+/**********************************************
+ * Commands
+ **********************************************/
+
+class Options
+{
+public:
+    const char *data;
+    const char *labels;
+    const char *model;
+    const char *out;
+    int trees;
+    int depth;
+    long noc;
+    int numThreads;
+    bool binary;
+    int maxBins;
+    long maxFeatures;
+    double sampleRatio;
+    bool bootstrap;
+    bool levelWise;
+    uint64_t seed;
+    bool probabilities;
+    int simd;
+};
+
+static double seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief The labels of n rows, from a file of one column.
+ */
+static std::vector<int> readLabels(const char *path, long n)
+{
+    Table labels;
+    labels.read(path);
+    if (labels.d != 1 || labels.n != n)
+    {
+        throw Error(std::string(path) + " should have one column of " + std::to_string(n) + " labels.");
+    }
+    return toLabels(labels.X, n, path);
+}
+
+static void train(const Options &o)
+{
+    double start = seconds();
+    ColumnFile *source = NULL;
+    Data *data = NULL;
+    Table table;
+    std::vector<int> Y;
+    long numNodes = 0;
+    double readTime = 0;
+    try
+    {
+        if (ColumnFile::isColumnFile(o.data))
+        {
+            if (o.labels == NULL)
+            {
+                throw Error("Training from a column file needs --labels.");
+            }
+            // streamed, as TrainDecisionTree does with a column file
+            source = new ColumnFile(o.data, false);
+            Y = readLabels(o.labels, source->n);
+            data = new Data(source, Y.data(), NULL, o.maxBins > 0 ? o.maxBins : 256);
+            if (o.maxBins > 0)
+            {
+                data->buildBins(o.maxBins);
+            }
+        }
+        else
+        {
+            table.read(o.data);
+            long d = table.d;
+            if (o.labels != NULL)
+            {
+                Y = readLabels(o.labels, table.n);
+            }
+            else if (d < 2)
+            {
+                throw Error(std::string(o.data) + " needs a column of features and a column of labels.");
+            }
+            else
+            {
+                d--;
+                Y = toLabels(table.X + d * table.n, table.n, o.data);
+            }
+            data = new Data(table.X, Y.data(), table.n, d, NULL, o.maxBins);
+        }
+        readTime = seconds() - start;
+
+        start = seconds();
+        if (o.trees == 1)
+        {
+            Tree tree(o.depth, o.noc, o.seed);
+            tree.setNumThreads(o.numThreads);
+            tree.setHistogramMode(o.maxBins > 0);
+            tree.setFeatureSampling(o.maxFeatures);
+            tree.setRowSampling(o.sampleRatio, o.bootstrap);
+            tree.setLevelWise(o.levelWise);
+            tree.trainTree(data);
+            numNodes = tree.getFlat()->numNodes;
+            if (o.binary)
+            {
+                ModelFile::saveTree((char *)o.model, &tree);
+            }
+            else
+            {
+                tree.saveTree((char *)o.model);
+            }
+        }
+        else
+        {
+            Forest forest(o.trees, o.depth, o.noc, o.seed);
+            forest.setHistogramMode(o.maxBins > 0);
+            forest.setFeatureSampling(o.maxFeatures);
+            forest.setRowSampling(o.sampleRatio, o.bootstrap);
+            forest.setLevelWise(o.levelWise);
+            forest.trainForest(data, o.numThreads);
+            for (int t = 0; t < o.trees; t++)
+            {
+                numNodes += forest.getTree(t)->getFlat()->numNodes;
+            }
+            if (o.binary)
+            {
+                ModelFile::saveForest((char *)o.model, &forest);
+            }
+            else
+            {
+                forest.saveForest((char *)o.model);
+            }
+        }
+    }
+    catch (...)
+    {
+        if (data != NULL) delete data;
+        if (source != NULL) delete source;
+        throw;
+    }
+
+    std::cerr << "trained " << o.trees << " tree(s), " << numNodes << " nodes, on " << data->n << " rows, "
+              << data->d << " features and " << data->nol << " labels in " << seconds() - start
+              << " s (reading " << readTime << " s)" << std::endl;
+    delete data;
+    if (source != NULL) delete source;
+}
+
+static void predict(const Options &o)
+{
+    // the model, as DecisionModel loads it
+    Tree *tree = NULL;
+    Forest *forest = NULL;
+    ModelFile *file = NULL;
+    FlatForest *flat;
+    struct stat info;
+    if (stat(o.model, &info) == 0 && (info.st_mode & S_IFDIR))
+    {
+        forest = new Forest((char *)o.model);
+        flat = forest->getFlat();
+    }
+    else if (ModelFile::isModelFile((char *)o.model))
+    {
+        file = new ModelFile((char *)o.model);
+        std::vector<FlatTree *> trees(file->forestSize());
+        for (int i = 0; i < file->forestSize(); i++)
+        {
+            trees[i] = file->getTree(i);
+        }
+        flat = new FlatForest(trees.data(), file->forestSize(), file->getWeights());
+    }
+    else
+    {
+        tree = new Tree((char *)o.model);
+        FlatTree *trees = tree->getFlat();
+        flat = new FlatForest(&trees, 1);
+    }
+
+    FILE *pFile = NULL;
+    try
+    {
+        Table table;
+        table.read(o.data);
+        long d = table.d;
+        const double *labels = NULL;
+        if (d == flat->d + 1)
+        {
+            d--;
+            labels = table.X + d * table.n;
+        }
+
+        long n = table.n;
+        int nol = flat->nol;
+        std::vector<double> Y(n), P(n * nol);
+        double start = seconds();
+        flat->runDecision(table.X, Y.data(), P.data(), n, d, o.numThreads);
+        double runTime = seconds() - start;
+
+        pFile = o.out == NULL ? stdout : fopen(o.out, "w");
+        if (pFile == NULL)
+        {
+            throw Error(std::string("Cannot open ") + o.out + ".");
+        }
+        for (long i = 0; i < n; i++)
+        {
+            fprintf(pFile, "%d", (int)Y[i]);
+            for (int j = 0; o.probabilities && j < nol; j++)
+            {
+                fprintf(pFile, ",%.17g", P[i + j * n]);
+            }
+            fprintf(pFile, "\n");
+        }
+        bool failed = ferror(pFile) != 0;
+        if (pFile != stdout && fclose(pFile) != 0)
+        {
+            failed = true;
+        }
+        pFile = NULL;
+        if (failed)
+        {
+            throw Error(std::string("Cannot write ") + (o.out == NULL ? "the decisions" : o.out) + ".");
+        }
+
+        std::cerr << "ran " << flat->size << " tree(s) on " << n << " rows in " << runTime << " s, "
+                  << runTime * 1e9 / (n > 0 ? n : 1) << " ns/row";
+        if (labels != NULL)
+        {
+            long correct = 0;
+            for (long i = 0; i < n; i++)
+            {
+                correct += Y[i] == labels[i];
+            }
+            std::cerr << ", accuracy " << (double)correct / (n > 0 ? n : 1);
+        }
+        std::cerr << std::endl;
+    }
+    catch (...)
+    {
+        if (pFile != NULL && pFile != stdout) fclose(pFile);
+        delete flat;
+        if (file != NULL) delete file;
+        if (forest != NULL) delete forest;
+        if (tree != NULL) delete tree;
+        throw;
+    }
+
+    delete flat;
+    if (file != NULL) delete file;
+    if (forest != NULL) delete forest;
+    if (tree != NULL) delete tree;
+}
+
+/**********************************************
+ * Command line
+ **********************************************/
+
+static int usage(const char *message)
+{
+    std::cerr << "Error: " << message << std::endl
+              << "usage: dforest train --data path --model path [options]" << std::endl
+              << "       dforest predict --data path --model path [options]" << std::endl
+              << "See DForest.cpp for the options." << std::endl;
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || (strcmp(argv[1], "train") != 0 && strcmp(argv[1], "predict") != 0))
+    {
+        return usage("the command should be train or predict.");
+    }
+    bool training = strcmp(argv[1], "train") == 0;
+
+    Options o;
+    o.data = NULL;
+    o.labels = NULL;
+    o.model = NULL;
+    o.out = NULL;
+    o.trees = 1;
+    o.depth = 10;
+    o.noc = 100;
+    o.numThreads = 0;
+    o.binary = false;
+    o.maxBins = 0;
+    o.maxFeatures = 0;
+    o.sampleRatio = 1;
+    o.bootstrap = false;
+    o.levelWise = false;
+    o.seed = Random::randomSeed();
+    o.probabilities = false;
+    o.simd = simdLevel();
+
+    for (int i = 2; i < argc; i++)
+    {
+        std::string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (option == "--bootstrap" && training)
+        {
+            o.bootstrap = true;
+        }
+        else if (option == "--level-wise" && training)
+        {
+            o.levelWise = true;
+        }
+        else if (option == "--probabilities" && !training)
+        {
+            o.probabilities = true;
+        }
+        else if (!hasValue)
+        {
+            return usage((option + " is not an option of " + argv[1] + ", or has no value.").c_str());
+        }
+        else if (option == "--data")
+        {
+            o.data = argv[++i];
+        }
+        else if (option == "--model")
+        {
+            o.model = argv[++i];
+        }
+        else if (option == "--threads")
+        {
+            o.numThreads = atoi(argv[++i]);
+        }
+        else if (option == "--out" && !training)
+        {
+            o.out = argv[++i];
+        }
+        else if (option == "--labels" && training)
+        {
+            o.labels = argv[++i];
+        }
+        else if (option == "--trees" && training)
+        {
+            o.trees = atoi(argv[++i]);
+        }
+        else if (option == "--depth" && training)
+        {
+            o.depth = atoi(argv[++i]);
+        }
+        else if (option == "--noc" && training)
+        {
+            o.noc = atol(argv[++i]);
+        }
+        else if (option == "--format" && training)
+        {
+            std::string format = argv[++i];
+            if (format != "text" && format != "binary")
+            {
+                return usage("--format should be text or binary.");
+            }
+            o.binary = format == "binary";
+        }
+        else if (option == "--max-bins" && training)
+        {
+            o.maxBins = atoi(argv[++i]);
+        }
+        else if (option == "--max-features" && training)
+        {
+            o.maxFeatures = atol(argv[++i]);
+        }
+        else if (option == "--sample-ratio" && training)
+        {
+            o.sampleRatio = atof(argv[++i]);
+        }
+        else if (option == "--seed" && training)
+        {
+            o.seed = (uint64_t)strtoull(argv[++i], NULL, 10);
+        }
+        else if (option == "--simd" && !training)
+        {
+            o.simd = simdLevelOfName(argv[++i]);
+            if (o.simd < 0)
+            {
+                return usage("--simd should be scalar, avx2 or avx512.");
+            }
+        }
+        else
+        {
+            return usage((option + " is not an option of " + argv[1] + ".").c_str());
+        }
+    }
+
+    if (o.data == NULL || o.model == NULL)
+    {
+        return usage("--data and --model are needed.");
+    }
+    if (o.trees < 1 || o.depth < 0 || o.noc < 1)
+    {
+        return usage("--trees and --noc should be positive, and --depth non-negative.");
+    }
+    if (o.maxBins != 0 && (o.maxBins < 2 || o.maxBins > 256))
+    {
+        return usage("--max-bins should be 0, or between 2 and 256.");
+    }
+    if (o.maxFeatures < 0)
+    {
+        return usage("--max-features should be 0 (all features) or positive.");
+    }
+    if (!(o.sampleRatio > 0) || (!o.bootstrap && o.sampleRatio > 1))
+    {
+        return usage("--sample-ratio should be positive, and at most 1 without --bootstrap.");
+    }
+
+    try
+    {
+        if (training)
+        {
+            train(o);
+        }
+        else
+        {
+            setSimdLevel(o.simd);
+            predict(o);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
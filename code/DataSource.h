@@ -0,0 +1,406 @@
+/**
+ * @file DataSource.h
+ * @brief C++ implementation of training data sources, in memory or on disk.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @class DataSource
+ * @brief Class to read the features of training data a chunk of rows at a time.
+ * @class MemorySource
+ * @brief Class to read features from a column-major matrix in memory.
+ * @class ColumnFile
+ * @brief Class to read features from a column file, mapped or streamed.
+ * @class ColumnFileWriter
+ * @brief Class to write a column file a chunk of rows at a time.
+ *
+ * A column file holds an n*d matrix of doubles, column by column, as X is
+ * laid out in MATLAB:
+ *
+ *     ColumnHeader      64 bytes
+ *     double X[n * d]   feature f of row i at X[i + f * n]
+ *
+ * All numbers are little-endian. The file can be written from MATLAB with
+ * SaveColumnFile.m, or a chunk of rows at a time with ColumnFileWriter
+ * for data that does not fit in memory.
+ *
+ * A ColumnFile is either mapped, so that the page cache holds as much of
+ * it as fits and the matrix can be used as X directly, or streamed, so
+ * that only one chunk of rows is in memory at a time. Training from a
+ * DataSource reads it in sequential passes of chunks (see
+ * Tree::trainLevels()). Reads are thread-safe.
+ */
+
+#ifndef DataSource_H
+#define DataSource_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+#include "Error.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+class DataSource
+{
+public:
+    long n; // number of instances
+    long d; // dimension of each instance
+
+    virtual ~DataSource() {}
+
+    /**
+     * @brief The whole column-major matrix, if it is addressable in
+     * memory (in memory or mapped), or NULL.
+     */
+    virtual double *columns() = 0;
+
+    /**
+     * @brief Read rows begin, ..., begin+num-1.
+     * @param buffer Room for num * d values, used if the rows have to be copied.
+     * @param stride Output: feature f of row begin+i is at p[i + f * stride].
+     * @return p, the buffer or a pointer into the matrix.
+     */
+    virtual const double *readRows(long begin, long num, double *buffer, long &stride) = 0;
+
+    virtual long chunkRows(); // number of rows read at a time in a pass
+};
+
+class MemorySource : public DataSource
+{
+private:
+    double *X; // not owned
+
+public:
+    MemorySource(double *X_, long n_, long d_);
+    double *columns();
+    const double *readRows(long begin, long num, double *buffer, long &stride);
+};
+
+class ColumnHeader
+{
+public:
+    char magic[8];         // "DFCOLS" and two null characters
+    uint32_t version;      // format version
+    uint32_t reserved;     // zero
+    uint64_t n;            // number of instances
+    uint64_t d;            // dimension of each instance
+    uint64_t reserved2[4]; // zero
+};
+
+class ColumnFile : public DataSource
+{
+private:
+    FILE *pFile;    // streamed file, NULL if mapped
+    char *buffer;   // mapped file, NULL if streamed
+    uint64_t size;  // file size in bytes
+    long chunk;     // rows per chunk
+    std::mutex lock; // protects the position of pFile
+
+public:
+    static const uint32_t version = 1;
+
+    /**
+     * @brief Open a column file.
+     * @param mapped_ Map the file (POSIX only), or stream it a chunk at a time.
+     * @param chunkRows_ Number of rows read at a time.
+     */
+    ColumnFile(const char *path, bool mapped_ = true, long chunkRows_ = 65536);
+    ~ColumnFile();
+    double *columns();
+    const double *readRows(long begin, long num, double *buffer, long &stride);
+    long chunkRows();
+
+    static void save(const char *path, const double *X, long n, long d); // whole matrix
+    static bool isColumnFile(const char *path);                          // check the magic of a file
+};
+
+class ColumnFileWriter
+{
+private:
+    FILE *pFile;
+
+public:
+    long n; // number of instances
+    long d; // dimension of each instance
+
+    ColumnFileWriter(const char *path, long n_, long d_); // create the file
+    ~ColumnFileWriter();                                  // close the file, if close() was not called
+
+    /**
+     * @brief Close the file, throwing an Error if it could not be written.
+     */
+    void close();
+
+    /**
+     * @brief Write rows begin, ..., begin+num-1, given as a column-major
+     * num*d matrix.
+     */
+    void writeRows(long begin, long num, const double *X);
+};
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+static const char columnMagic[8] = {'D', 'F', 'C', 'O', 'L', 'S', '\0', '\0'};
+
+inline bool seekFile(FILE *pFile, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(pFile, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(pFile, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+inline long DataSource::chunkRows()
+{
+    return 65536;
+}
+
+inline MemorySource::MemorySource(double *X_, long n_, long d_)
+{
+    X = X_;
+    n = n_;
+    d = d_;
+}
+
+inline double *MemorySource::columns()
+{
+    return X;
+}
+
+inline const double *MemorySource::readRows(long begin, long, double *, long &stride)
+{
+    stride = n;
+    return X + begin;
+}
+
+inline ColumnFile::ColumnFile(const char *path, bool mapped_, long chunkRows_)
+{
+    uint16_t one = 1;
+    if (*(char *)&one != 1)
+    {
+        throw Error("Column files are not supported on big-endian hosts.");
+    }
+
+    pFile = NULL;
+    buffer = NULL;
+    size = 0;
+    chunk = chunkRows_ > 0 ? chunkRows_ : 65536;
+
+    ColumnHeader header;
+    FILE *headerFile = fopen(path, "rb");
+    if (headerFile == NULL)
+    {
+        throw Error(std::string("Cannot open ") + path + ".");
+    }
+    bool valid = fread(&header, sizeof(ColumnHeader), 1, headerFile) == 1 &&
+                 memcmp(header.magic, columnMagic, 8) == 0;
+#ifdef _WIN32
+    _fseeki64(headerFile, 0, SEEK_END);
+    size = (uint64_t)_ftelli64(headerFile);
+#else
+    fseeko(headerFile, 0, SEEK_END);
+    size = (uint64_t)ftello(headerFile);
+#endif
+    fclose(headerFile);
+    if (!valid)
+    {
+        throw Error(std::string(path) + " is not a column file.");
+    }
+    if (header.version != version)
+    {
+        throw Error(std::string(path) + " has unsupported version " + std::to_string(header.version) + ".");
+    }
+    if (size != sizeof(ColumnHeader) + header.n * header.d * sizeof(double))
+    {
+        throw Error(std::string(path) + " is truncated or corrupted.");
+    }
+    n = (long)header.n;
+    d = (long)header.d;
+
+#ifndef _WIN32
+    if (mapped_)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0)
+        {
+            void *address = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+            if (address != MAP_FAILED)
+            {
+                buffer = (char *)address;
+                // passes read the columns sequentially
+                madvise(address, (size_t)size, MADV_SEQUENTIAL);
+            }
+            close(fd);
+        }
+        if (buffer != NULL)
+        {
+            return;
+        }
+    }
+#endif
+    pFile = fopen(path, "rb");
+    if (pFile == NULL)
+    {
+        throw Error(std::string("Cannot open ") + path + ".");
+    }
+}
+
+inline ColumnFile::~ColumnFile()
+{
+#ifndef _WIN32
+    if (buffer != NULL)
+    {
+        munmap(buffer, (size_t)size);
+    }
+#endif
+    if (pFile != NULL)
+    {
+        fclose(pFile);
+    }
+}
+
+inline double *ColumnFile::columns()
+{
+    return buffer == NULL ? NULL : (double *)(buffer + sizeof(ColumnHeader));
+}
+
+inline const double *ColumnFile::readRows(long begin, long num, double *rows, long &stride)
+{
+    if (buffer != NULL)
+    {
+        stride = n;
+        return columns() + begin;
+    }
+
+    // one sequential read per column
+    std::lock_guard<std::mutex> guard(lock);
+    stride = num;
+    for (long f = 0; f < d; f++)
+    {
+        uint64_t offset = sizeof(ColumnHeader) + ((uint64_t)f * n + begin) * sizeof(double);
+        if (!seekFile(pFile, offset) || fread(rows + f * num, sizeof(double), num, pFile) != (size_t)num)
+        {
+            throw Error("Cannot read column file.");
+        }
+    }
+    return rows;
+}
+
+inline long ColumnFile::chunkRows()
+{
+    return chunk;
+}
+
+inline void ColumnFile::save(const char *path, const double *X, long n, long d)
+{
+    ColumnFileWriter writer(path, n, d);
+    writer.writeRows(0, n, X);
+    writer.close();
+}
+
+inline bool ColumnFile::isColumnFile(const char *path)
+{
+    char magic[8];
+    FILE *pFile = fopen(path, "rb");
+    if (pFile == NULL)
+    {
+        return false;
+    }
+    bool match = fread(magic, 1, 8, pFile) == 8 && memcmp(magic, columnMagic, 8) == 0;
+    fclose(pFile);
+    return match;
+}
+
+inline ColumnFileWriter::ColumnFileWriter(const char *path, long n_, long d_)
+{
+    n = n_;
+    d = d_;
+    pFile = fopen(path, "wb+");
+    if (pFile == NULL)
+    {
+        throw Error(std::string("Cannot open ") + path + ".");
+    }
+
+    ColumnHeader header;
+    memset(&header, 0, sizeof(ColumnHeader));
+    memcpy(header.magic, columnMagic, 8);
+    header.version = ColumnFile::version;
+    header.n = (uint64_t)n;
+    header.d = (uint64_t)d;
+
+    // extend the file to its full size, rows may come in any order
+    double zero = 0;
+    if (fwrite(&header, sizeof(ColumnHeader), 1, pFile) != 1 ||
+        (n * d > 0 && (!seekFile(pFile, sizeof(ColumnHeader) + ((uint64_t)n * d - 1) * sizeof(double)) ||
+                       fwrite(&zero, sizeof(double), 1, pFile) != 1)))
+    {
+        fclose(pFile);
+        throw Error(std::string("Cannot write ") + path + ".");
+    }
+}
+
+inline ColumnFileWriter::~ColumnFileWriter()
+{
+    if (pFile != NULL)
+    {
+        fclose(pFile);
+    }
+}
+
+inline void ColumnFileWriter::close()
+{
+    int result = fclose(pFile);
+    pFile = NULL;
+    if (result != 0)
+    {
+        throw Error("Cannot write column file.");
+    }
+}
+
+inline void ColumnFileWriter::writeRows(long begin, long num, const double *X)
+{
+    for (long f = 0; f < d; f++)
+    {
+        uint64_t offset = sizeof(ColumnHeader) + ((uint64_t)f * n + begin) * sizeof(double);
+        if (!seekFile(pFile, offset) || fwrite(X + f * num, sizeof(double), num, pFile) != (size_t)num)
+        {
+            throw Error("Cannot write column file.");
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,39 @@
+/**
+ * @file DecisionForest.cpp
+ * @brief The compiled part of the decisionforest library.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * The headers in this folder can be used as they are, by including them
+ * in exactly one translation unit of a program, as the MEX functions do.
+ * The decisionforest library built by CMake compiles the implementation
+ * parts of DecisionTree.h and ModelFile.h here instead, once, and programs
+ * linking it define DECISIONFOREST_LIBRARY (CMake does this for them), so
+ * that they can include the headers in any number of translation units.
+ * The other headers are inline.
+ *
+ * Errors are thrown as Error (see Error.h), nothing calls exit().
+ */
+
+#include "DecisionTree.h"
+#include "ModelFile.h"
@@ -0,0 +1,482 @@
+/**
+ * This is the C/MEX code for keeping decision trees and forests in memory
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ *
+ * compile:
+ *     mex DecisionModel.cpp
+ *
+ * usage:
+ *     handle=DecisionModel('load',path)
+ *       path: a tree file in text or binary format, a forest file in binary
+ *           format, or a forest folder of *.tree files
+ *       handle: an opaque handle of the model in memory
+ *     [Y,P]=DecisionModel('run',handle,X,numThreads)
+ *       X: n*d testing data, each row is one instance, double or single
+ *       numThreads (optional): number of threads, 0 for all cores, default 1
+ *       Y: n*1 decision labels, each row is one instance, each number is an integer between 1 and nol
+ *       P: n*nol probabilities, averaged over the trees of a forest, or the weighted
+ *           votes of an AdaBoost ensemble
+ *     report=DecisionModel('compact',handle,thresholds,leaves,X,Y)
+ *       makes 'run' use a compact copy of the model, see CompactModel.h
+ *       thresholds: 'float32' (rounded down, exact for single X), 'uint16'
+ *           (per-feature codes, exact), or 'double' to go back to the model
+ *       leaves: 'uint16' (16-bit probabilities) or 'argmax' (decided label only)
+ *       X, Y (optional): testing data and labels, to compare the compact
+ *           model with the double one
+ *       report (optional): struct with fields bytes, doubleBytes, agreement (fraction
+ *           of the same decisions), maxDeltaP, accuracy and doubleAccuracy
+ *     DecisionModel('export',handle,sourcePath)
+ *       writes the model as C++ source, to be compiled into a shared library
+ *       with a predict(const double *x, double *p) function, see CodeGen.h;
+ *       the double model is written, even if compacted
+ *     DecisionModel('release',handle)
+ *       frees the model once every handle to it is released
+ *     DecisionModel('clear')
+ *       frees all models
+ *
+ * Models are cached by path: loading a path again returns the handle of the
+ * model already in memory, unless the files were modified since, in which
+ * case the model is loaded again under a new handle. The old handle stays
+ * valid until it is released.
+ */
+
+#include "mex.h"
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "DecisionTree.h"
+#include "ModelFile.h"
+#include "CodeGen.h"
+#include "CompactModel.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#define stat _stat
+#endif
+
+class Model
+{
+public:
+    std::string path;  // path the model was loaded from
+    std::string version; // modification times and sizes of the files
+    int refs;          // number of loads not yet released
+    ModelFile *file;   // a binary model file, or
+    Forest *forest;    // a forest folder, or
+    Tree *tree;        // a text tree file
+    FlatForest *flat;  // the trees to run
+    CompactForest *compact; // compact copy of flat run instead, or NULL
+
+    Model(char *path_);
+    ~Model();
+};
+
+static std::map<double, Model *> handles;    // handle -> model
+static std::map<std::string, double> cache; // path -> handle of its latest model
+static double nextHandle = 1;
+
+/* modification time in nanoseconds (100 ns on Windows) and size of a file,
+   empty if it is missing */
+static std::string fileStamp(const std::string &path, bool *isFolder = NULL)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &info))
+    {
+        return "";
+    }
+    if (isFolder != NULL) *isFolder = (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    unsigned long long time =
+        ((unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+    unsigned long long size = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+#else
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+        return "";
+    }
+    if (isFolder != NULL) *isFolder = S_ISDIR(info.st_mode);
+#ifdef __APPLE__
+    unsigned long long time = info.st_mtimespec.tv_sec * 1000000000ULL + info.st_mtimespec.tv_nsec;
+#else
+    unsigned long long time = info.st_mtim.tv_sec * 1000000000ULL + info.st_mtim.tv_nsec;
+#endif
+    unsigned long long size = (unsigned long long)info.st_size;
+#endif
+    return std::to_string(time) + " " + std::to_string(size);
+}
+
+/* stamps of a file, or of a folder and each of its *.tree files in name
+   order, compared as a whole so no change is rounded away */
+static std::string modelVersion(const char *path)
+{
+    bool isFolder = false;
+    std::string version = fileStamp(path, &isFolder);
+    if (version.empty() || !isFolder)
+    {
+        return version;
+    }
+
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA((std::string(path) + "/*.tree").c_str(), &entry);
+    for (bool found = find != INVALID_HANDLE_VALUE; found; found = FindNextFileA(find, &entry) != 0)
+    {
+        names.push_back(entry.cFileName);
+    }
+    if (find != INVALID_HANDLE_VALUE) FindClose(find);
+#else
+    DIR *dir = opendir(path);
+    for (struct dirent *entry = dir ? readdir(dir) : NULL; entry != NULL; entry = readdir(dir))
+    {
+        size_t length = strlen(entry->d_name);
+        if (length >= 5 && strcmp(entry->d_name + length - 5, ".tree") == 0)
+        {
+            names.push_back(entry->d_name);
+        }
+    }
+    if (dir) closedir(dir);
+#endif
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        version += "\n" + names[i] + " " + fileStamp(std::string(path) + "/" + names[i]);
+    }
+    return version;
+}
+
+Model::Model(char *path_)
+{
+    path = path_;
+    version = modelVersion(path_);
+    refs = 1;
+    file = NULL;
+    forest = NULL;
+    tree = NULL;
+    compact = NULL;
+
+    struct stat info;
+    if (stat(path_, &info) == 0 && (info.st_mode & S_IFDIR))
+    {
+        forest = new Forest(path_);
+        flat = forest->getFlat();
+    }
+    else if (ModelFile::isModelFile(path_))
+    {
+        file = new ModelFile(path_);
+        FlatTree **trees = new FlatTree *[file->forestSize()];
+        for (int i = 0; i < file->forestSize(); i++)
+        {
+            trees[i] = file->getTree(i);
+        }
+        flat = new FlatForest(trees, file->forestSize(), file->getWeights());
+        delete[] trees;
+    }
+    else
+    {
+        tree = new Tree(path_);
+        FlatTree *trees = tree->getFlat();
+        flat = new FlatForest(&trees, 1);
+    }
+}
+
+Model::~Model()
+{
+    if (compact != NULL) delete compact;
+    delete flat;
+    if (file != NULL) delete file;
+    if (forest != NULL) delete forest;
+    if (tree != NULL) delete tree;
+}
+
+static void clearModels()
+{
+    for (std::map<double, Model *>::iterator it = handles.begin(); it != handles.end(); ++it)
+    {
+        delete it->second;
+    }
+    handles.clear();
+    cache.clear();
+}
+
+static Model *getModel(const mxArray *handle)
+{
+    if (!mxIsDouble(handle) || mxGetM(handle) * mxGetN(handle) != 1 ||
+        handles.count(mxGetScalar(handle)) == 0)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:DecisionModel:invalidHandle",
+            "Input handle is not a loaded model.");
+    }
+    return handles[mxGetScalar(handle)];
+}
+
+/* the work of the gateway function */
+static void decisionModel(int nlhs, mxArray *plhs[],
+                          int nrhs, const mxArray *prhs[])
+{
+    static bool registered = false;
+    if (!registered)
+    {
+        mexAtExit(clearModels);
+        registered = true;
+    }
+
+    /*  get command */
+    if (nrhs < 1 || !mxIsChar(prhs[0]))
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:DecisionModel:invalidCommand",
+            "First input must be 'load', 'run', 'compact', 'export', 'release' or 'clear'.");
+    }
+    char *command = mxArrayToString(prhs[0]);
+
+    if (strcmp(command, "load") == 0)
+    {
+        if (nrhs != 2 || !mxIsChar(prhs[1]) || nlhs > 1)
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:DecisionModel:invalidLoad",
+                "Usage: handle = DecisionModel('load', path).");
+        }
+        char *path = mxArrayToString(prhs[1]);
+
+        // reuse the cached model if its files were not modified
+        double handle;
+        std::map<std::string, double>::iterator it = cache.find(path);
+        if (it != cache.end() && handles.count(it->second) > 0 &&
+            handles[it->second]->version == modelVersion(path))
+        {
+            handle = it->second;
+            handles[handle]->refs++;
+        }
+        else
+        {
+            handle = nextHandle++;
+            handles[handle] = new Model(path);
+            cache[path] = handle;
+        }
+        plhs[0] = mxCreateDoubleScalar(handle);
+        mxFree(path);
+    }
+    else if (strcmp(command, "run") == 0)
+    {
+        if (nrhs < 3 || nrhs > 4 || nlhs > 2)
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:DecisionModel:invalidRun",
+                "Usage: [Y, P] = DecisionModel('run', handle, X, numThreads).");
+        }
+        Model *model = getModel(prhs[1]);
+
+        /*  get X */
+        if (!mxIsDouble(prhs[2]) && !mxIsSingle(prhs[2]))
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:DecisionModel:invalidX",
+                "Input X must be a double or single matrix.");
+        }
+        long n = mxGetM(prhs[2]);
+        long d = mxGetN(prhs[2]);
+        if (d != model->flat->d)
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:DecisionModel:dimNotMatch",
+                "Dimension of input X does not match the model.");
+        }
+
+        /*  set the output pointers to the output matrix */
+        plhs[0] = mxCreateDoubleMatrix(n, 1, mxREAL);
+        mxArray *P = mxCreateDoubleMatrix(n, model->flat->nol, mxREAL);
+        int numThreads = (nrhs == 4) ? (int)mxGetScalar(prhs[3]) : 1;
+        if (model->compact != NULL && mxIsSingle(prhs[2]))
+        {
+            model->compact->runDecision((float *)mxGetData(prhs[2]), mxGetPr(plhs[0]), mxGetPr(P), n, d, numThreads);
+        }
+        else if (model->compact != NULL)
+        {
+            model->compact->runDecision(mxGetPr(prhs[2]), mxGetPr(plhs[0]), mxGetPr(P), n, d, numThreads);
+        }
+        else if (mxIsSingle(prhs[2]))
+        {
+            // the double model needs double features
+            float *single = (float *)mxGetData(prhs[2]);
+            double *X = new double[n * d];
+            for (long i = 0; i < n * d; i++)
+            {
+                X[i] = single[i];
+            }
+            model->flat->runDecision(X, mxGetPr(plhs[0]), mxGetPr(P), n, d, numThreads);
+            delete[] X;
+        }
+        else
+        {
+            model->flat->runDecision(mxGetPr(prhs[2]), mxGetPr(plhs[0]), mxGetPr(P), n, d, numThreads);
+        }
+        if (nlhs >= 2)
+        {
+            plhs[1] = P;
+        }
+    }
+    else if (strcmp(command, "compact") == 0)
+    {
+        if ((nrhs != 4 && nrhs != 6) || !mxIsChar(prhs[2]) || !mxIsChar(prhs[3]) || nlhs > (nrhs == 6 ? 1 : 0))
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:DecisionModel:invalidCompact",
+                "Usage: report = DecisionModel('compact', handle, thresholds, leaves, X, Y).");
+        }
+        Model *model = getModel(prhs[1]);
+        char *thresholds = mxArrayToString(prhs[2]);
+        char *leaves = mxArrayToString(prhs[3]);
+        int thresholdMode = strcmp(thresholds, "float32") == 0 ? COMPACT_FLOAT32
+                            : strcmp(thresholds, "uint16") == 0 ? COMPACT_UINT16 : -1;
+        int leafMode = strcmp(leaves, "uint16") == 0 ? COMPACT_PROBABILITY
+                       : strcmp(leaves, "argmax") == 0 ? COMPACT_ARGMAX : -1;
+        bool restore = strcmp(thresholds, "double") == 0;
+        mxFree(thresholds);
+        mxFree(leaves);
+        if (!restore && (thresholdMode < 0 || leafMode < 0))
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:DecisionModel:compactWrongValue",
+                "Thresholds must be 'float32', 'uint16' or 'double', and leaves 'uint16' or 'argmax'.");
+        }
+        if (restore && nrhs == 6)
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:DecisionModel:invalidCompact",
+                "A report needs a compact model.");
+        }
+        if (!restore && !CompactForest::supports(model->flat, thresholdMode))
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:DecisionModel:tooManyThresholds",
+                "Some feature has more than 65535 thresholds, or there are 65535 features or more, use 'float32'.");
+        }
+        if (model->compact != NULL)
+        {
+            delete model->compact;
+            model->compact = NULL;
+        }
+        if (!restore)
+        {
+            model->compact = new CompactForest(model->flat, thresholdMode, leafMode);
+        }
+
+        /*  compare with the double model */
+        if (nrhs == 6)
+        {
+            long n = mxGetM(prhs[4]);
+            long d = mxGetN(prhs[4]);
+            if (!mxIsDouble(prhs[4]) || d != model->flat->d ||
+                !mxIsDouble(prhs[5]) || mxGetM(prhs[5]) * mxGetN(prhs[5]) != (size_t)n)
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:DecisionModel:dimNotMatch",
+                    "Input X must be a double matrix matching the model, and Y its labels.");
+            }
+            int *labels = new int[n];
+            for (long i = 0; i < n; i++)
+            {
+                labels[i] = (int)mxGetPr(prhs[5])[i];
+            }
+            CompactReport report = model->compact->compare(model->flat, mxGetPr(prhs[4]), labels, n, d);
+            delete[] labels;
+
+            const char *fields[6] = {"bytes", "doubleBytes", "agreement", "maxDeltaP", "accuracy", "doubleAccuracy"};
+            double values[6] = {(double)report.bytes, (double)report.referenceBytes, report.agreement,
+                                report.maxDeltaP, report.accuracy, report.referenceAccuracy};
+            plhs[0] = mxCreateStructMatrix(1, 1, 6, fields);
+            for (int k = 0; k < 6; k++)
+            {
+                mxSetField(plhs[0], 0, fields[k], mxCreateDoubleScalar(values[k]));
+            }
+        }
+    }
+    else if (strcmp(command, "export") == 0)
+    {
+        if (nrhs != 3 || !mxIsChar(prhs[2]) || nlhs > 0)
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:DecisionModel:invalidExport",
+                "Usage: DecisionModel('export', handle, sourcePath).");
+        }
+        Model *model = getModel(prhs[1]);
+        char *sourcePath = mxArrayToString(prhs[2]);
+        CodeGen::writeSource(sourcePath, model->flat->trees, model->flat->size, model->flat->weights);
+        mxFree(sourcePath);
+    }
+    else if (strcmp(command, "release") == 0)
+    {
+        if (nrhs != 2)
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:DecisionModel:invalidRelease",
+                "Usage: DecisionModel('release', handle).");
+        }
+        Model *model = getModel(prhs[1]);
+        double handle = mxGetScalar(prhs[1]);
+        if (--model->refs == 0)
+        {
+            std::map<std::string, double>::iterator it = cache.find(model->path);
+            if (it != cache.end() && it->second == handle)
+            {
+                cache.erase(it);
+            }
+            handles.erase(handle);
+            delete model;
+        }
+    }
+    else if (strcmp(command, "clear") == 0)
+    {
+        clearModels();
+    }
+    else
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:DecisionModel:invalidCommand",
+            "First input must be 'load', 'run', 'compact', 'export', 'release' or 'clear'.");
+    }
+
+    mxFree(command);
+    return;
+}
+
+/* the gateway function, reporting errors of the library as MATLAB errors */
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    try
+    {
+        decisionModel(nlhs, plhs, nrhs, prhs);
+    }
+    catch (const Error &e)
+    {
+        mexErrMsgIdAndTxt("MATLAB:DecisionModel:error", "%s", e.what());
+    }
+}
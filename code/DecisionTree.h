@@ -30,16 +30,115 @@
  * @brief Class to hold the list of indices of data instances.
  * @class TreeNode
  * @brief Class to represent a node of the tree.
+ * @class FlatNode
+ * @brief Class to represent a node of a compiled tree.
+ * @class FlatTree
+ * @brief Class to represent a compiled tree for fast inference.
+ * @class FlatForest
+ * @brief Class to represent a set of compiled trees voting together.
  * @class Tree
  * @brief Class to represent the decision tree.
+ * @class Forest
+ * @brief Class to represent the decision forest.
  *
- * The connection between Tree and TreeNode is that there is a hash table
- * in Tree, which maps a node index to a TreeNode:
- *     HashTable<TreeNode*> *map;
+ * The connection between Tree and TreeNode is that Tree holds its nodes
+ * in a store that grows with the tree, indexed by node, root first:
+ *     std::vector<TreeNode*> store;
+ * A split node gives the index of its left child, and the right child is
+ * next to it. Node indices are therefore not bounded by 2^depth, and a
+ * tree can be grown until its lists are too small or pure (depth 0). The
+ * candidates of a node are still seeded with its heap index (2k+1, 2k+2),
+ * which wraps around past depth 63, so trees do not depend on the order
+ * of the store.
  *
  * A decision tree can be saved into a text file using the saveTree()
  * function. The first line of the file is tree information, and each of
- * the following lines is one node.
+ * the following lines is one node, breadth-first. Files numbering nodes
+ * by heap index, as saved before the store, are still read.
+ *
+ * A tree can also be trained with several threads (setNumThreads()): the
+ * candidates of a node are scored in parallel and reduced in candidate
+ * order, so the chosen split does not depend on the number of threads;
+ * and the two subtrees of a large node are trained as parallel tasks.
+ * Feature importance is summed breadth-first after training, so it does
+ * not depend on the number of threads either.
+ *
+ * Candidates are scored one feature at a time: the values of the feature
+ * are gathered once, each instance is assigned to the interval between
+ * two sorted candidate thresholds, and the label histograms of all
+ * thresholds of that feature follow from prefix and suffix sums. This
+ * costs O(n log k) instead of O(n k) for k thresholds of one feature.
+ *
+ * In histogram mode (setHistogramMode()), every feature is quantized once
+ * into at most 256 bins stored in Data::B, and candidate thresholds are
+ * snapped to bin edges. Each node keeps one label histogram per feature
+ * and bin: only the smaller child's histogram is built from its instances,
+ * and the larger child's is the parent's minus the smaller one's.
+ *
+ * Thresholds of the candidates are drawn from a Random generator seeded
+ * with the tree's seed and the node's index, so a tree trained with a
+ * given seed is the same for any number of threads. The trees of a forest
+ * are seeded from the forest's seed and their index.
+ *
+ * The features of each node's candidates are a random subset of the
+ * features (setFeatureSampling()), taking turns, and a tree can be trained
+ * on a bootstrap sample or a subsample of the rows (setRowSampling()).
+ * Sampled rows are only a list of indices into the shared Data, and
+ * bootstrap counts are weights of a Data view, so X is never copied.
+ *
+ * Training holds a single list of instance indices. Each node works on a
+ * range of it and partitions that range in place, stably, into the ranges
+ * of its two children, so the lists of all nodes take n indices in total.
+ * Scratch arrays (candidates, scores, label histograms) come from an
+ * Arena of the training thread (see Arena.h), and are freed in O(1) when
+ * the node is done, so the recursion does not go through malloc.
+ *
+ * A tree can also be trained breadth-first (setLevelWise(), trainLevels()):
+ * all open nodes of a level are trained together in one sequential sweep
+ * over the rows, where each row moves on to the node it has reached and
+ * adds its values to that node's statistics, one feature per thread. The
+ * statistics are accumulated in row order, as the recursive trainers do,
+ * so the tree is the same.
+ *
+ * Data can also be read from a DataSource (see DataSource.h), such as a
+ * column file on disk. If its values are not addressable in memory, the
+ * tree is trained level-wise in histogram mode, reading the rows a chunk
+ * at a time. The features are never all in memory, but every row still
+ * has its label, its weight, its index in the row list and the node it
+ * has reached (trainLevels()), about 28 bytes per row, besides the
+ * histograms of one level and a chunk of rows.
+ *
+ * For inference, a trained or loaded tree is compiled into a FlatTree: one
+ * contiguous array of 16-byte nodes in breadth-first order, where the two
+ * children of a node are adjacent, and one dense table of normalized leaf
+ * probabilities. runDecision() walks the FlatTree with no hashing and no
+ * pointer chasing, and gives the same results as decideTree(). On x86
+ * CPUs with AVX-512, several instances are walked at once in the lanes of
+ * a vector (see SimdTraversal.h), chosen at run time.
+ *
+ * A leaf TreeNode only holds the labels of nonzero weight, and split nodes
+ * hold none. With more than FlatTree::maxDenseLabels labels, the leaf
+ * table of the FlatTree and the leaf lines of the tree file are sparse as
+ * well, and a forest adds only the nonzero probabilities of each leaf to
+ * its votes, so a many-class model grows with the labels its leaves hold.
+ *
+ * A FlatForest runs several compiled trees together, a block of rows at a
+ * time: the block is transposed once from the column-major X into a small
+ * row-major buffer that stays in cache, all trees are walked over it, and
+ * their votes are accumulated into one buffer of the block. Blocks are
+ * independent, so they are run in parallel on a ThreadPool. When every
+ * tree has at most 64 leaves, the forest can also be evaluated feature by
+ * feature with leaf bitvectors instead (see QuickScorer.h). Which one is
+ * faster depends on the forest and the CPU, so both are timed on the
+ * first blocks of the first large enough runDecision(), and the faster
+ * one is kept.
+ *
+ * A Forest owns several trees which share one Data instance. The trees
+ * are trained concurrently on a ThreadPool, and the forest is saved as a
+ * folder of tree files named 1.tree, 2.tree, 3.tree, ...
+ *
+ * Invalid data and files that cannot be read or written are reported by
+ * throwing an Error (see Error.h), after freeing what was allocated.
  */
 
 #ifndef DecisionTree_H
@@ -50,8 +149,27 @@
 #include <cstring>
 #include <cmath>
 #include <ctime>
-#include <iostream>
-#include "HashTable.h"
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Arena.h"
+#include "DataSource.h"
+#include "Error.h"
+#include "Random.h"
+#include "ThreadPool.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
 
 /**********************************************
  * Declaration part
@@ -69,14 +187,42 @@ public:
     double *mean; ///< Mean value of each dimension
     double *std;  ///< Standard deviation of each dimension
 
+    unsigned char *B; ///< Binned feature matrix, NULL unless binned
+    int maxBins;      ///< Maximum number of bins of each dimension
+    int *numBins;     ///< Number of bins of each dimension
+    double *binEdges; ///< Upper edges of bins, (maxBins - 1) per dimension
+    bool owner;       ///< Whether mean, std and bins are owned, or shared with another Data
+    DataSource *source; ///< Source of X if read from one, NULL otherwise
+
     /**
      * @brief Constructor.
      * @param X_ Feature matrix.
      * @param Y_ Label vector.
      * @param n_ Number of instances.
      * @param d_ Dimension of each instance.
+     * @param W_ Weight vector, NULL for uniform weights.
+     * @param maxBins_ If positive, also quantize each dimension into at
+     *        most maxBins_ bins (up to 256) for histogram mode.
+     */
+    Data(double *X_, int *Y_, long n_, long d_, double *W_ = NULL, int maxBins_ = 0);
+
+    /**
+     * @brief Constructor from a data source, read in two sequential passes
+     * for mean, std and bin edges. X is the source's matrix if it is
+     * addressable (in memory or mapped), and NULL otherwise, in which case
+     * trees are trained level by level in passes over the source (see
+     * Tree::trainLevels()). B is not built. The source must outlive the Data.
+     * @param maxBins_ Number of bins of each dimension (2 to 256).
+     */
+    Data(DataSource *source_, int *Y_, double *W_ = NULL, int maxBins_ = 256);
+
+    /**
+     * @brief View of another Data with other weights, sharing everything
+     * else, e.g. the bootstrap weights of one tree. base must be binned
+     * before, if needed, and outlive the view.
+     * @param W_ Weight vector, NULL for uniform weights.
      */
-    Data(double *X_, int *Y_, long n_, long d_, double *W_ = NULL);
+    Data(Data *base, double *W_);
 
     /**
      * @brief Destructor.
@@ -90,14 +236,50 @@ public:
      * @return Value of the feature.
      */
     double getFeature(long i, long feature);
+
+    /**
+     * @brief Quantize each dimension into at most maxBins_ bins, with bin
+     * edges at quantiles of the feature values. For a source whose X is
+     * not addressable, see buildBinsFromSource().
+     */
+    void buildBins(int maxBins_);
+
+    /**
+     * @brief Bin all values of a source whose X is not addressable, in one
+     * pass, with the edges set by the constructor. B takes n*d bytes, an
+     * eighth of the values, and training no longer reads the source.
+     */
+    void buildBinsFromSource(int maxBins_);
+
+    /**
+     * @brief Set the bin edges of a dimension from k sorted sample values.
+     */
+    void setBinEdges(long feature, double *sorted, long k);
+
+    /**
+     * @brief Check that labels are between 1 and nol, and set nol.
+     */
+    void checkLabels();
+
+    /**
+     * @brief Get bin of a value. Bin b holds binEdges[b-1] < value <= binEdges[b].
+     */
+    int binOf(long feature, double value);
+
+    /**
+     * @brief Get upper edge of a bin.
+     */
+    double binEdge(long feature, int bin);
 };
 
 class List
 {
 public:
     long *list;
-    long num; // number of instances
+    long num;   // number of instances
+    bool owner; // whether list is owned, or a view into a larger list
     List(long num_);
+    List(long *list_, long num_); // view, not owned
     ~List();
 };
 
@@ -106,60 +288,361 @@ class TreeNode
 public:
     long feature;
     double threshold;
-    double *param; // parameters or probabilities
+    long child;    // split node: index of the left child in the node store, the right child is child + 1
+    int level;     // level of the node while training, 1 for the root
+    uint64_t key;  // heap index of the node (2k+1, 2k+2, wrapping), which seeds its candidates
+    double gain;   // split node: entropy decrease times list size, summed into importance after training
+    int numParams; // number of nonzero parameters, 0 for split nodes
+    int *labels;   // label - 1 of each nonzero parameter, increasing
+    double *param; // nonzero parameters or probabilities, NULL for split nodes
     TreeNode();
-    TreeNode(long feature_, double threshold_, int nol);
+    TreeNode(long feature_, double threshold_);                         // split node
+    TreeNode(int numParams_, const int *labels_, const double *param_); // leaf with the given nonzero weights
     ~TreeNode();
+    void setParams(int numParams_, const int *labels_, const double *param_); // make this node a leaf
+};
+
+class FlatNode
+{
+public:
+    double threshold; // split threshold
+    int feature;      // split feature, -1 for leaf
+    int child;        // split node: index of left child, right child is child + 1
+                      // leaf node: index into the leaf table
+};
+
+#include "SimdTraversal.h"
+
+class FlatTree
+{
+public:
+    long d;            // dimension of each instance
+    int nol;           // number of unique labels
+    long numNodes;     // number of nodes
+    long numLeaves;    // number of leaves
+    FlatNode *nodes;   // nodes in breadth-first order, root first
+    double *leafP;     // numLeaves * nol normalized probabilities, row by row, NULL if sparse
+    int *leafBegin;    // sparse leaves: leaf k has the nonzero probabilities leafBegin[k], ...,
+                       // leafBegin[k+1]-1 of leafLabel and leafValue; NULL if dense
+    int *leafLabel;    // label - 1 of each nonzero probability, increasing within a leaf
+    double *leafValue; // nonzero normalized probabilities
+    long numValues;    // number of nonzero probabilities of sparse leaves, 0 if dense
+    int *leafY;        // decision label of each leaf, between 1 and nol
+    bool owner;        // whether the arrays are owned, or a view into a model file
+
+    static const int maxDenseLabels = 16; // trees with more labels have sparse leaves
+
+    /**
+     * @brief Constructor. Leaves are dense, or sparse with numValues_
+     * nonzero probabilities if numValues_ >= 0.
+     */
+    FlatTree(long numNodes_, long numLeaves_, long d_, int nol_, long numValues_ = -1);
+    FlatTree(FlatNode *nodes_, double *leafP_, int *leafY_,
+             long numNodes_, long numLeaves_, long d_, int nol_); // view, not owned
+    FlatTree(FlatNode *nodes_, int *leafBegin_, int *leafLabel_, double *leafValue_, int *leafY_,
+             long numNodes_, long numLeaves_, long d_, int nol_); // view of sparse leaves, not owned
+    ~FlatTree();
+
+    /**
+     * @brief Add the probabilities of a leaf to vote[0], ..., vote[nol-1],
+     * only the nonzero ones if sparse.
+     */
+    void addLeafP(long leaf, double *vote);
+
+    /**
+     * @brief Copy all nol probabilities of a leaf to p[0], p[stride], ...
+     */
+    void copyLeafP(long leaf, double *p, long stride);
+
+    /**
+     * @brief Find the leaf of one instance.
+     * @param x Feature vector of the instance.
+     * @param stride Distance between consecutive features in x.
+     * @return Index into the leaf table.
+     */
+    long findLeaf(const double *x, long stride);
+
+    /**
+     * @brief Find the leaves of num instances, with SIMD if available.
+     * @param x Feature vector of the first instance.
+     * @param rowStride Distance between consecutive instances in x.
+     * @param featureStride Distance between consecutive features in x.
+     * @param leaves Output indices into the leaf table.
+     */
+    void findLeaves(const double *x, long rowStride, long featureStride, long num, int *leaves);
+    void runDecision(double *X, double *Y, double *P, long n, long d); // make decisions given testing data
+};
+
+#include "QuickScorer.h"
+
+enum ForestEngine
+{
+    ENGINE_AUTO = 0,       // time both engines on the first blocks, then keep the faster
+    ENGINE_TRAVERSAL = 1,  // walk each tree with FlatTree::findLeaves()
+    ENGINE_QUICKSCORER = 2 // QuickScorer, if every tree has at most 64 leaves
+};
+
+class FlatForest
+{
+public:
+    long d;                  // dimension of each instance
+    int nol;                 // number of unique labels
+    int size;                // number of trees
+    FlatTree **trees;        // the trees, not owned
+    double *weights;         // vote weight of each tree, NULL for averaged probabilities
+    double totalWeight;      // sum of weights, in tree order
+    QuickScorer *scorer;     // NULL if some tree has more than 64 leaves, or weighted
+    std::atomic<int> engine; // ForestEngine, ENGINE_AUTO until timed, then set once
+
+    /**
+     * @brief Constructor.
+     * @param weights_ If not NULL, each tree votes for its decided label
+     *        with its weight, as in AdaBoost, and P is the votes divided by
+     *        the total weight. Otherwise P is the average of the trees'
+     *        probabilities.
+     */
+    FlatForest(FlatTree **trees_, int size_, const double *weights_ = NULL);
+    ~FlatForest();
+
+    /**
+     * @brief Choose the inference engine. Both give identical results.
+     * ENGINE_QUICKSCORER falls back to ENGINE_TRAVERSAL if not supported.
+     */
+    void setEngine(int engine_);
+
+    /**
+     * @brief Make decisions given testing data. P is the average of the
+     * trees' probabilities, as in RunDecisionForest, or their weighted
+     * votes, as in RunAdaBoost.
+     */
+    void runDecision(double *X, double *Y, double *P, long n, long d, int numThreads = 1);
+
+    /**
+     * @brief runDecision() for testing data of any layout: feature f of row
+     * i is at X[i * rowStride + f * featureStride]. Column-major X, as in
+     * runDecision(), has strides 1 and n; row-major X has strides d and 1,
+     * and its rows are walked in place. Y and P are column-major.
+     */
+    void runStrided(const double *X, long rowStride, long featureStride, double *Y, double *P, long n, long d,
+                    int numThreads = 1);
+    void runBlock(const double *X, long rowStride, long featureStride, double *Y, double *P, long n, long begin,
+                  long num, double *block, double *votes, int *leaves, uint64_t *bitvectors,
+                  bool quickScorer); // rows begin, ..., begin+num-1
+    long blockSize(); // number of rows whose features fit in 32KB
 };
 
 class Tree
 {
 private:
-    int depth;                  // maximum depth of tree
+    int depth;                  // maximum depth of tree, 0 for fully grown trees
     long noc;                   // number of candidates
     long d;                     // dimension of each instance
     double eps;                 // constant
     double inf;                 // constant
     double searchRange;         // range of threshold K: mu +/- K * sigma
     int minList;                // minimum size of a splittable list
-    HashTable<TreeNode *> *map; // the data structure to hold tree nodes
+    std::vector<TreeNode *> store; // nodes by index, root first; the children of a split node are adjacent
+    uint64_t seed;              // seed of the random candidates
+
+    int numThreads;               // number of threads used to train this tree
+    long parallelMinList;         // minimum size of a list whose subtrees are trained in parallel
+    long parallelMinWork;         // minimum list size * noc to score candidates in parallel
+    std::atomic<int> spareThreads; // threads not yet used by any task
+    std::mutex lock;              // protects store during parallel training
+    bool histogramMode;           // train on binned features and node histograms
+    bool levelWise;               // train breadth-first, see trainLevels()
+    long maxFeatures;             // features sampled at each node, 0 for all
+    double sampleRatio;           // rows sampled for the tree, as a fraction of n
+    bool bootstrap;               // sample rows with replacement
+    ArenaPool arenas;             // scratch memory of the training threads
+    FlatTree *flat;               // compiled tree for inference
+    int claimThreads(int wanted); // claim up to wanted spare threads
+    void releaseThreads(int num);
 
 public:
     int nol;           // number of unique labels
     void initialize(); // called by constructors to set constants
-    Tree(int depth_, long noc_);
+    Tree(int depth_, long noc_, uint64_t seed_ = Random::randomSeed());
     Tree(char *path); // load a tree from a file
+    static bool readLine(FILE *pFile, std::vector<char> &line); // read a line of any length, null-terminated
     ~Tree();
     void saveTree(char *path); // save tree to file
+    void setNumThreads(int numThreads_); // number of training threads, 0 for all cores
+    void setHistogramMode(bool histogramMode_); // train on Data::B, binned if needed
+    void setLevelWise(bool levelWise_);         // train breadth-first instead of recursively
+
+    /**
+     * @brief Draw the features of each node's candidates from a random
+     * subset of maxFeatures_ features, without replacement. 0 (default)
+     * uses all features, in a random order for each node.
+     */
+    void setFeatureSampling(long maxFeatures_);
+
+    /**
+     * @brief Train the tree on round(sampleRatio_ * n) rows drawn with the
+     * tree's seed: a bootstrap sample (with replacement, rows weighted by
+     * how often they are drawn) or a subsample (without replacement,
+     * sampleRatio_ <= 1). Default 1 without bootstrap uses all rows.
+     */
+    void setRowSampling(double sampleRatio_, bool bootstrap_);
 
     long leftChild(long n);
     long rightChild(long n);
-    long parent(long n);
     int treeLevel(long n);
+    bool deepEnough(long n); // whether node n is at the maximum depth
+
+    TreeNode *getCandidates(long n, Data *data, Arena *arena); // get candidates for node n, allocated in arena
+    void trainTree(Data *data);                        // train decision tree using data
+    List *sampleRows(Data *data, double *&weights);    // rows of the tree, and their weights if changed
+    void trainTreeNode(long n, List *list, Data *data, Arena *arena); // train one node (recursive)
+    void trainTreeNodeHist(long n, List *list, Data *data, double *hist, Arena *arena); // train one node in histogram mode (recursive)
+    void buildHistogram(Data *data, List *list, double *hist, Arena *arena); // label histogram of each feature and bin
+
+    /**
+     * @brief Choose the best candidate of node n from its histogram, with
+     * its threshold snapped to a bin edge. The candidates are allocated in
+     * arena.
+     * @param bin Output: the candidate goes left if its bin is <= bin.
+     * @param entropyDecrease Output: entropy decrease of the candidate.
+     */
+    TreeNode *chooseHistSplit(long n, Data *data, double *hist, Arena *arena, int &bin, double &entropyDecrease);
 
-    TreeNode *getCandidates(Data *data);                // get candidates for one node
-    void trainTree(Data *data);                         // train decision tree using data
-    void trainTreeNode(long n, List *list, Data *data); // train one node (recursive)
-    double getEntropyDecrease(Data *data, TreeNode node, List *list);
+    /**
+     * @brief Train the tree breadth-first, one level at a time, with the
+     * same splits as trainTreeNode(), or trainTreeNodeHist() in histogram
+     * mode. Each level is one sequential sweep over the rows of list (more
+     * if the statistics of the level do not fit in memory): every row
+     * keeps the node it has reached, and adds its values to the statistics
+     * of that node, each task one feature. Used for setLevelWise(), and for
+     * Data whose values are only readable through data->source.
+     */
+    void trainLevels(List *list, Data *data);
+
+    /**
+     * @brief Reorder list in place so that instances going left come first,
+     * each side keeping its order.
+     * @param goesLeft Function of an instance index.
+     * @return Number of instances going left.
+     */
+    template <class F>
+    long partitionList(List *list, F goesLeft, Arena *arena);
+    void addLeaf(long n, List *list, Data *data);
+    void addLeaf(long n, double *labelWeight); // leaf with the weight of each label
+    void addSplit(long n, TreeNode *node, double entropyDecrease, long num); // also adds the two open children
+    long groupByFeature(TreeNode *candidates, long *order, long *groupBegin); // returns number of groups
+    double getEntropyDecrease(Data *data, TreeNode node, List *list); // score one candidate (reference)
+    void getEntropyDecreases(Data *data, TreeNode *candidates, List *list, double *entropyDecrease,
+                             Arena *arena); // score all candidates
+    void scoreFeature(Data *data, TreeNode *candidates, long *order, long k, List *list,
+                      int *label, double *weight, double *entropyDecrease, Arena *arena); // k candidates of one feature
+
+    /**
+     * @brief Score k candidates of one feature, sorted by threshold, from
+     * the label histogram of the k+1 intervals between their thresholds.
+     * @param binWeight Total weight of each interval.
+     */
+    void scoreIntervals(long *order, long k, double *hist, double *binWeight, double *entropyDecrease, Arena *arena);
+    double entropyDecreaseOf(double *leftLabel, double *rightLabel, double leftWeight, double rightWeight);
     bool pureList(List *list, Data *data); // check if a list contains only one kind of label
     double *importance; // feature importance
     double *getImportance();
 
-    TreeNode *decideTree(long n, double *feature);                     // make decisions given one instance (recursive)
+    void compile();       // build the FlatTree from store
+    std::vector<long> breadthFirst(); // indices of store breadth-first, the children of a split node adjacent
+    FlatTree *getFlat();  // compiled tree, built if needed
+
+    TreeNode *decideTree(long n, double *feature);                     // make decisions given one instance, from node n
     void runDecision(double *X, double *Y, double *P, long n, long d); // make decisions given testing data
 };
 
+class Forest
+{
+private:
+    int size;            // number of trees
+    Tree **trees;        // the trees of the forest
+    double *importance;  // feature importance summed over trees
+    bool histogramMode;  // train trees on binned features
+    FlatForest *flat;    // compiled forest of runDecision(), built on its first call
+    std::mutex flatLock; // protects flat
+
+public:
+    long d;  // dimension of each instance
+    int nol; // number of unique labels
+    Forest(int size_, int depth_, long noc_, uint64_t seed = Random::randomSeed()); // tree i is seeded from seed and i
+    Forest(char *path); // load all *.tree files of a folder, in name order
+    ~Forest();
+    int forestSize();
+    Tree *getTree(int i);
+    void setHistogramMode(bool histogramMode_);
+    void setLevelWise(bool levelWise_);                       // see Tree::setLevelWise()
+    void setFeatureSampling(long maxFeatures_);               // see Tree::setFeatureSampling()
+    void setRowSampling(double sampleRatio_, bool bootstrap_); // see Tree::setRowSampling()
+
+    void trainForest(Data *data, int numThreads = 0); // train all trees on a thread pool sharing data
+    void saveForest(char *path);                      // save trees to path/1.tree, path/2.tree, ...
+    double *getImportance();
+    FlatForest *getFlat(); // compiled forest to be deleted by the caller, valid while the forest is
+    void runDecision(double *X, double *Y, double *P, long n, long d, int numThreads = 1); // make decisions given testing data
+};
+
 /**********************************************
  * Implementation part
  **********************************************/
 
-Data::Data(double *X_, int *Y_, long n_, long d_, double *W_)
+inline void FlatTree::addLeafP(long leaf, double *vote)
+{
+    if (leafP != NULL)
+    {
+        double *p = leafP + leaf * nol;
+        for (int j = 0; j < nol; j++)
+        {
+            vote[j] += p[j];
+        }
+        return;
+    }
+    for (int k = leafBegin[leaf]; k < leafBegin[leaf + 1]; k++)
+    {
+        vote[leafLabel[k]] += leafValue[k];
+    }
+}
+
+inline long FlatTree::findLeaf(const double *x, long stride)
+{
+    FlatNode *node = nodes;
+    while (node->feature >= 0)
+    {
+        // NaN is never <= threshold, so it goes right as in decideTree
+        node = nodes + node->child + !(x[node->feature * stride] <= node->threshold);
+    }
+    return node->child;
+}
+
+// The functions below are compiled into the decisionforest library (see
+// DecisionForest.cpp), and left out of programs linking it, which define
+// DECISIONFOREST_LIBRARY. Inline functions, used by the other headers, are
+// always here.
+#ifndef DECISIONFOREST_LIBRARY
+
+Data::Data(double *X_, int *Y_, long n_, long d_, double *W_, int maxBins_)
 {
     X = X_;
     Y = Y_;
     n = n_;
     d = d_;
     W = W_;
+    B = NULL;
+    maxBins = 0;
+    numBins = NULL;
+    binEdges = NULL;
+    owner = true;
+    source = NULL;
+
+    // the arguments are checked before anything is allocated
+    if (maxBins_ > 0 && (maxBins_ < 2 || maxBins_ > 256))
+    {
+        throw Error("Number of bins should be between 2 and 256.");
+    }
+    checkLabels();
 
     mean = new double[d];
     std = new double[d];
@@ -183,13 +666,123 @@ Data::Data(double *X_, int *Y_, long n_, long d_, double *W_)
         std[i] = sqrt(sum / n);
     }
 
+    if (maxBins_ > 0)
+    {
+        buildBins(maxBins_);
+    }
+}
+
+Data::Data(DataSource *source_, int *Y_, double *W_, int maxBins_)
+{
+    if (maxBins_ < 2 || maxBins_ > 256)
+    {
+        throw Error("Number of bins should be between 2 and 256.");
+    }
+    source = source_;
+    X = source->columns();
+    Y = Y_;
+    n = source->n;
+    d = source->d;
+    W = W_;
+    B = NULL;
+    maxBins = maxBins_;
+    checkLabels();
+    numBins = new int[d];
+    binEdges = new double[(maxBins - 1) * d];
+    owner = true;
+
+    mean = new double[d];
+    std = new double[d];
+    for (long f = 0; f < d; f++)
+    {
+        mean[f] = 0;
+        std[f] = 0;
+    }
+
+    // bin edges come from the same evenly spaced instances as buildBins(),
+    // as long as their values fit in 256MB
+    long m = n < 200000 ? n : 200000;
+    long maxSamples = (256L << 20) / (8 * (d > 0 ? d : 1));
+    m = m < maxSamples ? m : maxSamples;
+    double *samples = new double[m * d];
+
+    // pass 1: sums and samples; pass 2: squared deviations from the mean.
+    // Each sum runs over the instances in order, as in the constructor
+    // from X, so mean and std are the same.
+    long chunk = source->chunkRows();
+    double *buffer = new double[chunk * d];
+    for (int pass = 0; pass < 2; pass++)
+    {
+        long j = 0; // next sample
+        for (long begin = 0; begin < n; begin += chunk)
+        {
+            long num = (n - begin < chunk) ? n - begin : chunk;
+            long stride;
+            const double *rows = source->readRows(begin, num, buffer, stride);
+            for (long f = 0; f < d; f++)
+            {
+                const double *column = rows + f * stride;
+                double sum = pass == 0 ? mean[f] : std[f];
+                for (long i = 0; i < num; i++)
+                {
+                    sum += pass == 0 ? column[i] : (column[i] - mean[f]) * (column[i] - mean[f]);
+                }
+                if (pass == 0)
+                {
+                    mean[f] = sum;
+                }
+                else
+                {
+                    std[f] = sum;
+                }
+            }
+            for (; pass == 0 && j < m && j * n / m < begin + num; j++)
+            {
+                for (long f = 0; f < d; f++)
+                {
+                    samples[j + f * m] = rows[j * n / m - begin + f * stride];
+                }
+            }
+        }
+        for (long f = 0; f < d; f++)
+        {
+            if (pass == 0)
+            {
+                mean[f] /= n;
+            }
+            else
+            {
+                std[f] = sqrt(std[f] / n);
+            }
+        }
+    }
+    delete[] buffer;
+
+    for (long f = 0; f < d; f++)
+    {
+        double *sorted = samples + f * m;
+        long k = 0;
+        for (long j = 0; j < m; j++)
+        {
+            if (sorted[j] == sorted[j])
+            {
+                sorted[k++] = sorted[j];
+            }
+        }
+        std::sort(sorted, sorted + k);
+        setBinEdges(f, sorted, k);
+    }
+    delete[] samples;
+}
+
+void Data::checkLabels()
+{
     nol = 0;
     for (long i = 0; i < n; i++)
     {
         if (Y[i] < 1)
         {
-            std::cout << "Error: entries of Y should be between 1 and nol. \n";
-            exit(1);
+            throw Error("Entries of Y should be between 1 and nol.");
         }
 
         if (Y[i] > nol)
@@ -199,16 +792,29 @@ Data::Data(double *X_, int *Y_, long n_, long d_, double *W_)
 
         if (nol == 0)
         {
-            std::cout << "Error: entries of Y should be between 1 and nol. \n";
-            exit(1);
+            throw Error("Entries of Y should be between 1 and nol.");
         }
     }
 }
 
+Data::Data(Data *base, double *W_)
+{
+    *this = *base;
+    W = W_;
+    owner = false;
+}
+
 Data::~Data()
 {
+    if (!owner)
+    {
+        return;
+    }
     delete[] mean;
     delete[] std;
+    if (B != NULL) delete[] B;
+    if (numBins != NULL) delete[] numBins;
+    if (binEdges != NULL) delete[] binEdges;
 }
 
 double Data::getFeature(long i, long feature)
@@ -216,53 +822,391 @@ double Data::getFeature(long i, long feature)
     return X[i + feature * n];
 }
 
+void Data::buildBins(int maxBins_)
+{
+    if (maxBins_ < 2 || maxBins_ > 256)
+    {
+        throw Error("Number of bins should be between 2 and 256.");
+    }
+    if (X == NULL)
+    {
+        buildBinsFromSource(maxBins_);
+        return;
+    }
+    if (B != NULL) delete[] B;
+    if (numBins != NULL) delete[] numBins;
+    if (binEdges != NULL) delete[] binEdges;
+
+    maxBins = maxBins_;
+    B = new unsigned char[n * d];
+    numBins = new int[d];
+    binEdges = new double[(maxBins - 1) * d];
+
+    // quantiles are estimated from at most this many evenly spaced instances
+    long m = n < 200000 ? n : 200000;
+    double *sorted = new double[m];
+
+    for (long f = 0; f < d; f++)
+    {
+        long k = 0;
+        for (long j = 0; j < m; j++)
+        {
+            double value = X[j * n / m + f * n];
+            if (value == value)
+            {
+                sorted[k++] = value;
+            }
+        }
+        std::sort(sorted, sorted + k);
+        setBinEdges(f, sorted, k);
+
+        for (long i = 0; i < n; i++)
+        {
+            B[i + f * n] = (unsigned char)binOf(f, X[i + f * n]);
+        }
+    }
+
+    delete[] sorted;
+}
+
+void Data::buildBinsFromSource(int maxBins_)
+{
+    if (maxBins_ != maxBins)
+    {
+        throw Error("The number of bins of a data source is set by its constructor.");
+    }
+    if (B == NULL)
+    {
+        B = new unsigned char[n * d];
+    }
+
+    // the edges are already set, one pass bins all values
+    long chunk = source->chunkRows();
+    double *buffer = new double[chunk * d];
+    for (long begin = 0; begin < n; begin += chunk)
+    {
+        long num = (n - begin < chunk) ? n - begin : chunk;
+        long stride;
+        const double *rows = source->readRows(begin, num, buffer, stride);
+        for (long f = 0; f < d; f++)
+        {
+            for (long i = 0; i < num; i++)
+            {
+                B[begin + i + f * n] = (unsigned char)binOf(f, rows[i + f * stride]);
+            }
+        }
+    }
+    delete[] buffer;
+}
+
+void Data::setBinEdges(long f, double *sorted, long k)
+{
+    long distinct = 0;
+    for (long j = 0; j < k; j++)
+    {
+        if (j == 0 || sorted[j] > sorted[j - 1])
+        {
+            distinct++;
+        }
+    }
+
+    // edges are the distinct values if they fit, or quantiles otherwise
+    double *edges = binEdges + (maxBins - 1) * f;
+    int numEdges = 0;
+    for (long j = 0; j < k && distinct <= maxBins - 1; j++)
+    {
+        if (j == 0 || sorted[j] > sorted[j - 1])
+        {
+            edges[numEdges++] = sorted[j];
+        }
+    }
+    for (int b = 1; b < maxBins && distinct > maxBins - 1; b++)
+    {
+        double value = sorted[b * k / maxBins - 1];
+        if (numEdges == 0 || value > edges[numEdges - 1])
+        {
+            edges[numEdges++] = value;
+        }
+    }
+    if (numEdges == 0)
+    {
+        edges[numEdges++] = 0; // all values are NaN
+    }
+    numBins[f] = numEdges + 1;
+}
+
+int Data::binOf(long feature, double value)
+{
+    double *edges = binEdges + (maxBins - 1) * feature;
+    int numEdges = numBins[feature] - 1;
+    if (value != value)
+    {
+        return numEdges; // NaN is never <= threshold, so it goes right
+    }
+
+    // branchless lower_bound: the first edge not below value
+    const double *base = edges;
+    int length = numEdges;
+    while (length > 1)
+    {
+        int half = length / 2;
+        base = (base[half - 1] < value) ? base + half : base;
+        length -= half;
+    }
+    return (int)(base - edges) + (*base < value ? 1 : 0);
+}
+
+double Data::binEdge(long feature, int bin)
+{
+    return binEdges[(maxBins - 1) * feature + bin];
+}
+
 List::List(long num_)
 {
     num = num_;
     list = new long[num];
+    owner = true;
+}
+
+List::List(long *list_, long num_)
+{
+    num = num_;
+    list = list_;
+    owner = false;
 }
 
 List::~List()
 {
-    delete[] list;
+    if (owner)
+    {
+        delete[] list;
+    }
 }
 
 TreeNode::TreeNode()
 {
+    child = -1;
+    level = 0;
+    key = 0;
+    gain = 0;
+    numParams = 0;
+    labels = NULL;
     param = NULL;
 }
 
-TreeNode::TreeNode(long feature_, double threshold_, int nol)
+TreeNode::TreeNode(long feature_, double threshold_)
 {
     feature = feature_;
     threshold = threshold_;
-    param = new double[nol];
-    for (int i = 0; i < nol; i++)
-    {
-        param[i] = 0;
-    }
+    child = -1;
+    level = 0;
+    key = 0;
+    gain = 0;
+    numParams = 0;
+    labels = NULL;
+    param = NULL;
+}
+
+TreeNode::TreeNode(int numParams_, const int *labels_, const double *param_)
+{
+    child = -1;
+    level = 0;
+    key = 0;
+    gain = 0;
+    numParams = 0;
+    labels = NULL;
+    param = NULL;
+    setParams(numParams_, labels_, param_);
 }
 
 TreeNode::~TreeNode()
 {
+    if (labels != NULL)
+    {
+        delete[] labels;
+    }
     if (param != NULL)
     {
         delete[] param;
     }
 }
 
+void TreeNode::setParams(int numParams_, const int *labels_, const double *param_)
+{
+    if (labels != NULL) delete[] labels;
+    if (param != NULL) delete[] param;
+    feature = -1;
+    threshold = 0;
+    child = -1;
+    numParams = numParams_;
+    labels = new int[numParams];
+    param = new double[numParams];
+    for (int k = 0; k < numParams; k++)
+    {
+        labels[k] = labels_[k];
+        param[k] = param_[k];
+    }
+}
+
+FlatTree::FlatTree(long numNodes_, long numLeaves_, long d_, int nol_, long numValues_)
+{
+    numNodes = numNodes_;
+    numLeaves = numLeaves_;
+    d = d_;
+    nol = nol_;
+    nodes = new FlatNode[numNodes];
+    leafP = NULL;
+    leafBegin = NULL;
+    leafLabel = NULL;
+    leafValue = NULL;
+    numValues = 0;
+    if (numValues_ >= 0)
+    {
+        numValues = numValues_;
+        leafBegin = new int[numLeaves + 1];
+        leafLabel = new int[numValues];
+        leafValue = new double[numValues];
+    }
+    else
+    {
+        leafP = new double[numLeaves * nol];
+    }
+    leafY = new int[numLeaves];
+    owner = true;
+}
+
+FlatTree::FlatTree(FlatNode *nodes_, double *leafP_, int *leafY_,
+                   long numNodes_, long numLeaves_, long d_, int nol_)
+{
+    numNodes = numNodes_;
+    numLeaves = numLeaves_;
+    d = d_;
+    nol = nol_;
+    nodes = nodes_;
+    leafP = leafP_;
+    leafBegin = NULL;
+    leafLabel = NULL;
+    leafValue = NULL;
+    numValues = 0;
+    leafY = leafY_;
+    owner = false;
+}
+
+FlatTree::FlatTree(FlatNode *nodes_, int *leafBegin_, int *leafLabel_, double *leafValue_, int *leafY_,
+                   long numNodes_, long numLeaves_, long d_, int nol_)
+{
+    numNodes = numNodes_;
+    numLeaves = numLeaves_;
+    d = d_;
+    nol = nol_;
+    nodes = nodes_;
+    leafP = NULL;
+    leafBegin = leafBegin_;
+    leafLabel = leafLabel_;
+    leafValue = leafValue_;
+    numValues = leafBegin[numLeaves];
+    leafY = leafY_;
+    owner = false;
+}
+
+FlatTree::~FlatTree()
+{
+    if (owner)
+    {
+        delete[] nodes;
+        delete[] leafP;
+        delete[] leafBegin;
+        delete[] leafLabel;
+        delete[] leafValue;
+        delete[] leafY;
+    }
+}
+
+void FlatTree::copyLeafP(long leaf, double *p, long stride)
+{
+    if (leafP != NULL)
+    {
+        for (int j = 0; j < nol; j++)
+        {
+            p[j * stride] = leafP[leaf * nol + j];
+        }
+        return;
+    }
+    for (int j = 0; j < nol; j++)
+    {
+        p[j * stride] = 0;
+    }
+    for (int k = leafBegin[leaf]; k < leafBegin[leaf + 1]; k++)
+    {
+        p[leafLabel[k] * stride] = leafValue[k];
+    }
+}
+
+void FlatTree::findLeaves(const double *x, long rowStride, long featureStride, long num, int *leaves)
+{
+    long done = 0;
+    int level = simdLevel();
+    if (level >= SIMD_AVX512)
+    {
+        done = findLeavesAVX512(nodes, numNodes, x, rowStride, featureStride, num, leaves);
+    }
+    else if (level >= SIMD_AVX2)
+    {
+        done = findLeavesAVX2(nodes, numNodes, x, rowStride, featureStride, num, leaves);
+    }
+    for (long i = done; i < num; i++)
+    {
+        leaves[i] = (int)findLeaf(x + i * rowStride, featureStride);
+    }
+}
+
+void FlatTree::runDecision(double *X, double *Y, double *P, long n_, long d_)
+{
+    if (d != d_)
+    {
+        throw Error("Testing data dimension does not match.");
+    }
+
+    // features are read in place from the column-major X, a chunk of rows at a time
+    const long chunk = 256;
+    int leaves[chunk];
+    for (long begin = 0; begin < n_; begin += chunk)
+    {
+        long num = (n_ - begin < chunk) ? n_ - begin : chunk;
+        findLeaves(X + begin, 1, n_, num, leaves);
+        for (long k = 0; k < num; k++)
+        {
+            long i = begin + k;
+            long leaf = leaves[k];
+            copyLeafP(leaf, P + i, n_);
+            Y[i] = leafY[leaf];
+        }
+    }
+}
+
 void Tree::initialize()
 {
     eps = 0.00000000001;
     inf = 1000000000000;
     minList = 10;
     searchRange = 3;
-    map = new HashTable<TreeNode *>(10000);
+    numThreads = 1;
+    histogramMode = false;
+    levelWise = false;
+    flat = NULL;
+    parallelMinList = 10000;
+    parallelMinWork = 100000;
+    spareThreads = 0;
+    seed = 0;
+    maxFeatures = 0;
+    sampleRatio = 1;
+    bootstrap = false;
 }
 
-Tree::Tree(int depth_, long noc_)
+Tree::Tree(int depth_, long noc_, uint64_t seed_)
 {
     initialize();
+    seed = seed_;
 
     depth = depth_;
     noc = noc_;
@@ -270,6 +1214,22 @@ Tree::Tree(int depth_, long noc_)
     importance = NULL;
 }
 
+bool Tree::readLine(FILE *pFile, std::vector<char> &line)
+{
+    line.resize(256);
+    size_t length = 0;
+    while (fgets(line.data() + length, (int)(line.size() - length), pFile) != NULL)
+    {
+        length += strlen(line.data() + length);
+        if (line[length - 1] == '\n')
+        {
+            return true;
+        }
+        line.resize(line.size() * 2);
+    }
+    return length > 0;
+}
+
 Tree::Tree(char *path)
 {
     initialize();
@@ -278,108 +1238,299 @@ Tree::Tree(char *path)
     pFile = fopen(path, "r");
     if (pFile == NULL)
     {
-        std::cout << "Error opening " << path << std::endl;
-        exit(1);
+        throw Error(std::string("Cannot open ") + path + ".");
     }
 
-    char *line = new char[200];
+    std::vector<char> line;
     char *word;
+    std::vector<TreeNode *> lines;
+    importance = NULL;
+
+    // nothing of a file that is not valid is kept
+    auto fail = [&](const std::string &message) {
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            delete lines[i];
+        }
+        store.clear();
+        delete[] importance;
+        fclose(pFile);
+        throw Error(std::string(path) + message);
+    };
+    auto nextWord = [&](char *text) {
+        char *next = strtok(text, "\t\r\n");
+        if (next == NULL)
+        {
+            fail(" is not a valid tree file.");
+        }
+        return next;
+    };
 
     // read information
-    if (fgets(line, 200, pFile) == NULL)
+    if (!readLine(pFile, line))
     {
-        std::cerr << "Error reading " << path << std::endl;
+        fail(" is not a valid tree file.");
     }
-    word = strtok(line, "\t\r\n");
+    word = nextWord(line.data());
     depth = atoi(word); // depth of tree
-    word = strtok(NULL, "\t\r\n");
+    word = nextWord(NULL);
     d = atoi(word); // dimension of instances
-    importance = new double[d]; // Initialize importance even when loading
-    for (int i = 0; i < d; i++) importance[i] = 0;
-
-    word = strtok(NULL, "\t\r\n");
+    word = nextWord(NULL);
     nol = atoi(word); // number of unique labels
-    word = strtok(NULL, "\t\r\n");
+    word = nextWord(NULL);
     int numLines = atoi(word); // number of nodes
+    if (d <= 0 || nol <= 0 || numLines <= 0)
+    {
+        fail(" is not a valid tree file.");
+    }
+    importance = new double[d]; // Initialize importance even when loading
+    for (int i = 0; i < d; i++) importance[i] = 0;
 
+    // nodes as in the file: each split line gives the index of its left
+    // child, or, in files of the implicit heap numbering, nothing
+    std::vector<long> index(numLines);
+    lines.assign(numLines, NULL);
+    bool heap = false;
+    std::vector<std::pair<int, double> > params;
     for (long i = 0; i < numLines; i++)
     {
-        TreeNode *node = new TreeNode(0, 0, nol);
-
-        if (fgets(line, 200, pFile) == NULL)
+        if (!readLine(pFile, line))
         {
-            std::cerr << "Error reading " << path << std::endl;
+            fail(" is truncated.");
         }
 
-        word = strtok(line, "\t\r\n");
-        long n = atol(word); // node index
+        word = nextWord(line.data());
+        index[i] = atol(word); // node index
 
-        word = strtok(NULL, "\t\r\n");
-        node->feature = atol(word); // feature
+        word = nextWord(NULL);
+        long feature = atol(word); // feature
 
-        word = strtok(NULL, "\t\r\n");
-        node->threshold = atof(word); // threshold
+        word = nextWord(NULL);
+        double threshold = atof(word); // threshold
 
-        // parameters
-        if (node->feature == -1)
+        if (feature < -1 || feature >= d)
         {
-            for (int j = 0; j < nol; j++)
+            fail(" has a feature out of range.");
+        }
+        if (feature != -1)
+        {
+            lines[i] = new TreeNode(feature, threshold);
+            word = strtok(NULL, "\t\r\n");
+            if (word == NULL)
+            {
+                heap = true;
+            }
+            else
+            {
+                lines[i]->child = atol(word); // left child
+            }
+            continue;
+        }
+
+        // parameters: nol numbers, or label:weight pairs of the nonzero ones
+        params.clear();
+        int j = 0;
+        while ((word = strtok(NULL, "\t\r\n")) != NULL)
+        {
+            char *colon = strchr(word, ':');
+            int label = colon == NULL ? j++ : atoi(word) - 1;
+            double weight = atof(colon == NULL ? word : colon + 1);
+            if (label < 0 || label >= nol)
+            {
+                fail(" has a label out of range.");
+            }
+            if (weight != 0)
+            {
+                params.push_back(std::make_pair(label, weight));
+            }
+        }
+        std::sort(params.begin(), params.end());
+
+        std::vector<int> labels(params.size());
+        std::vector<double> weights(params.size());
+        for (size_t k = 0; k < params.size(); k++)
+        {
+            labels[k] = params[k].first;
+            weights[k] = params[k].second;
+        }
+        lines[i] = new TreeNode((int)params.size(), labels.data(), weights.data());
+    }
+
+    // put the nodes in the store, breadth-first from the root for the heap
+    // numbering, where the children of node k are 2k+1 and 2k+2
+    bool corrupted = false;
+    if (heap)
+    {
+        std::unordered_map<long, TreeNode *> byIndex;
+        for (long i = 0; i < numLines; i++)
+        {
+            byIndex[index[i]] = lines[i];
+        }
+        std::vector<long> heapIndex(1, 0);
+        for (size_t i = 0; i < heapIndex.size() && !corrupted; i++)
+        {
+            auto found = byIndex.find(heapIndex[i]);
+            corrupted = found == byIndex.end() || found->second == NULL;
+            if (corrupted)
+            {
+                break;
+            }
+            TreeNode *node = found->second;
+            found->second = NULL;
+            store.push_back(node);
+            if (node->feature != -1)
+            {
+                node->child = (long)heapIndex.size();
+                heapIndex.push_back(heapIndex[i] * 2 + 1);
+                heapIndex.push_back(heapIndex[i] * 2 + 2);
+            }
+        }
+        corrupted = corrupted || (long)store.size() != numLines;
+    }
+    else
+    {
+        store.assign(numLines, NULL);
+        for (long i = 0; i < numLines && !corrupted; i++)
+        {
+            corrupted = index[i] < 0 || index[i] >= numLines || store[index[i]] != NULL;
+            if (!corrupted)
             {
-                word = strtok(NULL, "\t\r\n");
-                node->param[j] = atof(word);
+                store[index[i]] = lines[i];
             }
         }
-        map->add(n, node);
+        for (long i = 0; i < numLines && !corrupted; i++)
+        {
+            corrupted = store[i]->feature != -1 && (store[i]->child <= i || store[i]->child + 1 >= numLines);
+        }
+    }
+    if (corrupted)
+    {
+        fail(" is not a valid tree file.");
     }
 
-    delete[] line;
     fclose(pFile);
+
+    compile();
 }
 
 Tree::~Tree()
 {
-    delete map;
+    for (size_t i = 0; i < store.size(); i++)
+    {
+        delete store[i];
+    }
+    if (flat != NULL) delete flat;
     if (importance != NULL) delete[] importance;
 }
 
+void Tree::setNumThreads(int numThreads_)
+{
+    numThreads = numThreads_ < 1 ? ThreadPool::hardwareThreads() : numThreads_;
+}
+
+void Tree::setHistogramMode(bool histogramMode_)
+{
+    histogramMode = histogramMode_;
+}
+
+void Tree::setLevelWise(bool levelWise_)
+{
+    levelWise = levelWise_;
+}
+
+void Tree::setFeatureSampling(long maxFeatures_)
+{
+    maxFeatures = maxFeatures_;
+}
+
+void Tree::setRowSampling(double sampleRatio_, bool bootstrap_)
+{
+    sampleRatio = sampleRatio_;
+    bootstrap = bootstrap_;
+}
+
+int Tree::claimThreads(int wanted)
+{
+    int available = spareThreads.load();
+    while (available > 0)
+    {
+        int claimed = available < wanted ? available : wanted;
+        if (spareThreads.compare_exchange_weak(available, available - claimed))
+        {
+            return claimed;
+        }
+    }
+    return 0;
+}
+
+void Tree::releaseThreads(int num)
+{
+    spareThreads += num;
+}
+
 long Tree::leftChild(long n)
 {
-    return n * 2 + 1;
+    std::lock_guard<std::mutex> guard(lock);
+    return store[n]->child;
 }
 
 long Tree::rightChild(long n)
 {
-    return n * 2 + 2;
+    std::lock_guard<std::mutex> guard(lock);
+    return store[n]->child + 1;
 }
 
-long Tree::parent(long n)
+int Tree::treeLevel(long n)
 {
-    return (long)((n - 1) / 2);
+    std::lock_guard<std::mutex> guard(lock);
+    return store[n]->level;
 }
 
-int Tree::treeLevel(long n)
+bool Tree::deepEnough(long n)
 {
-    return (int)floor(log((double)n + 1) / log(2.0) + eps) + 1;
+    return depth > 0 && treeLevel(n) >= depth;
 }
 
-TreeNode *Tree::getCandidates(Data *data)
+TreeNode *Tree::getCandidates(long n, Data *data, Arena *arena)
 {
     int feature;
     double threshold;
-    TreeNode *candidates = new TreeNode[noc];
+    TreeNode *candidates = arena->allocate<TreeNode>(noc);
 
-    srand(time(NULL));
+    // each node has its own stream, so candidates do not depend on the
+    // order in which threads train the nodes
+    uint64_t key;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        key = store[n]->key;
+    }
+    Random random(seed, key);
+
+    // features of this node: the first m of a partial random permutation
+    long m = (maxFeatures > 0 && maxFeatures < d) ? maxFeatures : d;
+    long *features = arena->allocate<long>(d);
+    for (long j = 0; j < d; j++)
+    {
+        features[j] = j;
+    }
+    for (long j = 0; j < m; j++)
+    {
+        std::swap(features[j], features[j + random.below(d - j)]);
+    }
 
     for (long i = 0; i < noc; i++)
     {
-        // feature
-        feature = i % d;
+        // feature, the m features take turns
+        feature = features[i % m];
         candidates[i].feature = feature;
 
         // threshold
-        double r = ((double)rand() / (RAND_MAX)) * 2 - 1;
+        double r = random.uniform() * 2 - 1;
         threshold = data->mean[feature] + data->std[feature] * searchRange * r;
         candidates[i].threshold = threshold;
+        candidates[i].numParams = 0;
+        candidates[i].labels = NULL;
+        candidates[i].param = NULL;
     }
     return candidates;
 }
@@ -393,51 +1544,182 @@ void Tree::trainTree(Data *data)
     importance = new double[d];
     for (int i = 0; i < d; i++) importance[i] = 0;
 
-    List *list = new List(data->n);
-    for (long i = 0; i < data->n; i++)
+    if (histogramMode && data->B == NULL && data->X != NULL)
+    {
+        data->buildBins(256);
+    }
+
+    // the store starts with the open root, and grows as nodes are split
+    for (size_t i = 0; i < store.size(); i++)
+    {
+        delete store[i];
+    }
+    store.assign(1, new TreeNode(-1, 0));
+    store[0]->level = 1;
+
+    // the only index buffer: every node works on a range of it; with
+    // bootstrap, a view of data carries the weights of the drawn rows
+    double *weights = NULL;
+    List *list = sampleRows(data, weights);
+    Data *sample = data;
+    if (weights != NULL)
     {
-        list->list[i] = i;
+        sample = new Data(data, weights);
     }
+    data = sample;
 
-    if (minList < data->n / 1000)
+    if (minList < list->num / 1000)
     {
-        minList = data->n / 1000;
+        minList = list->num / 1000;
     }
 
     // recursive call
-    trainTreeNode(0, list, data);
+    spareThreads = numThreads - 1;
+    Arena *arena = arenas.acquire();
+    if (levelWise || data->X == NULL)
+    {
+        trainLevels(list, data); // also when features can only be read in passes
+    }
+    else if (histogramMode)
+    {
+        double *hist = arena->allocate<double>(d * data->maxBins * nol);
+        buildHistogram(data, list, hist, arena);
+        trainTreeNodeHist(0, list, data, hist, arena);
+    }
+    else
+    {
+        trainTreeNode(0, list, data, arena);
+    }
+    arenas.release(arena);
+    arenas.clear();
 
     delete list;
+    if (weights != NULL)
+    {
+        delete sample;
+        delete[] weights;
+    }
+
+    // importance summed breadth-first, so it does not depend on the order
+    // in which threads split nodes
+    std::vector<long> order = breadthFirst();
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        TreeNode *node = store[order[k]];
+        if (node->feature >= 0 && node->feature < d)
+        {
+            importance[node->feature] += node->gain;
+        }
+    }
+
+    compile();
 }
 
-void Tree::trainTreeNode(long n, List *list, Data *data)
+List *Tree::sampleRows(Data *data, double *&weights)
 {
-    // Case 1: leaf node, stop splitting
-    int level = treeLevel(n);
-    if (level == depth || list->num < minList || pureList(list, data))
+    long n = data->n;
+    weights = NULL;
+    if (sampleRatio == 1 && !bootstrap)
     {
-        TreeNode *node = new TreeNode(-1, 0, data->nol);
+        List *list = new List(n);
+        for (long i = 0; i < n; i++)
+        {
+            list->list[i] = i;
+        }
+        return list;
+    }
 
-        for (long i = 0; i < list->num; i++)
+    // rows are drawn from a stream that no node uses
+    Random random(seed, ~(uint64_t)0);
+    long m = (long)floor(sampleRatio * n + 0.5);
+    m = m < 1 ? 1 : m;
+    long num = 0;
+    long *rows = new long[bootstrap ? n : (m < n ? m : n)];
+
+    if (bootstrap)
+    {
+        // count the draws of each row, and weight each drawn row by its count
+        weights = new double[n];
+        for (long i = 0; i < n; i++)
+        {
+            weights[i] = 0;
+        }
+        for (long k = 0; k < m; k++)
+        {
+            weights[random.below(n)] += 1;
+        }
+        for (long i = 0; i < n; i++)
+        {
+            if (weights[i] > 0)
+            {
+                rows[num++] = i;
+                weights[i] *= (data->W == NULL) ? 1.0 : data->W[i];
+            }
+        }
+    }
+    else
+    {
+        // selection sampling: keep row i with probability (needed / left)
+        for (long i = 0; i < n && num < m; i++)
+        {
+            if (random.uniform() * (n - i) < m - num)
+            {
+                rows[num++] = i;
+            }
+        }
+    }
+
+    List *list = new List(rows, num);
+    list->owner = true;
+    return list;
+}
+
+template <class F>
+long Tree::partitionList(List *list, F goesLeft, Arena *arena)
+{
+    // left instances are moved down in place, right ones wait in scratch
+    Arena::Mark mark = arena->mark();
+    long *right = arena->allocate<long>(list->num);
+    long numLeft = 0;
+    long numRight = 0;
+    for (long i = 0; i < list->num; i++)
+    {
+        long index = list->list[i];
+        if (goesLeft(index))
         {
-            double weight = (data->W == NULL) ? 1.0 : data->W[list->list[i]];
-            node->param[data->Y[list->list[i]] - 1] += weight;
+            list->list[numLeft++] = index;
         }
-        map->add(n, node);
+        else
+        {
+            right[numRight++] = index;
+        }
+    }
+    memcpy(list->list + numLeft, right, numRight * sizeof(long));
+    arena->release(mark);
+    return numLeft;
+}
+
+void Tree::trainTreeNode(long n, List *list, Data *data, Arena *arena)
+{
+    // Case 1: leaf node, stop splitting
+    if (deepEnough(n) || list->num < minList || pureList(list, data))
+    {
+        addLeaf(n, list, data);
         return;
     }
 
     // Case 2: non-leaf node
-    TreeNode *bestNode;
-    double *entropyDecrease = new double[noc];
+    Arena::Mark mark = arena->mark();
+    double *entropyDecrease = arena->allocate<double>(noc);
     double largestEntropyDecrease = -inf;
 
-    TreeNode *candidates = getCandidates(data);
+    TreeNode *candidates = getCandidates(n, data, arena);
+    TreeNode *bestNode = &candidates[0]; // kept if every decrease is NaN
 
-    // get best node
+    // get best node, reducing in candidate order
+    getEntropyDecreases(data, candidates, list, entropyDecrease, arena);
     for (long i = 0; i < noc; i++)
     {
-        entropyDecrease[i] = getEntropyDecrease(data, candidates[i], list);
         if (entropyDecrease[i] > largestEntropyDecrease)
         {
             bestNode = &candidates[i];
@@ -445,67 +1727,731 @@ void Tree::trainTreeNode(long n, List *list, Data *data)
         }
     }
     
-    // Update importance
-    if (bestNode->feature >= 0 && bestNode->feature < d) {
-        importance[bestNode->feature] += largestEntropyDecrease * list->num; // Approximation: entropy decrease * samples
+    addSplit(n, bestNode, largestEntropyDecrease, list->num);
+
+    // split the list in place into the lists of the children
+    long feature = bestNode->feature;
+    double threshold = bestNode->threshold;
+    long numLeft = partitionList(list, [&](long i) { return data->getFeature(i, feature) <= threshold; }, arena);
+    List leftList(list->list, numLeft);
+    List rightList(list->list + numLeft, list->num - numLeft);
+
+    // candidates are no longer used, children reuse their memory
+    arena->release(mark);
+
+    // recursive call, the right subtree as a parallel task if it is large
+    // enough and a spare thread is available
+    if (leftList.num >= parallelMinList && rightList.num >= parallelMinList &&
+        claimThreads(1) == 1)
+    {
+        ThreadPool pool(2);
+        pool.run(2, [&](long i) {
+            if (i == 0)
+            {
+                trainTreeNode(leftChild(n), &leftList, data, arena);
+                return;
+            }
+            Arena *rightArena = arenas.acquire();
+            trainTreeNode(rightChild(n), &rightList, data, rightArena);
+            arenas.release(rightArena);
+        });
+        releaseThreads(1);
+        return;
     }
 
-    map->add(n, new TreeNode(bestNode->feature, bestNode->threshold, nol));
-
-    delete[] entropyDecrease;
+    trainTreeNode(leftChild(n), &leftList, data, arena);
+    trainTreeNode(rightChild(n), &rightList, data, arena);
+}
 
-    // generate lists for children
-    List *leftList = new List(list->num);
-    List *rightList = new List(list->num);
-    leftList->num = 0;
-    rightList->num = 0;
+void Tree::addLeaf(long n, List *list, Data *data)
+{
+    // sort the instances by label, keeping their order within a label, so
+    // the weights of each label are summed in list order without a dense
+    // table of all labels
+    std::vector<std::pair<int, double> > weights(list->num);
+    for (long i = 0; i < list->num; i++)
+    {
+        double weight = (data->W == NULL) ? 1.0 : data->W[list->list[i]];
+        weights[i] = std::make_pair(data->Y[list->list[i]] - 1, weight);
+    }
+    std::stable_sort(weights.begin(), weights.end(),
+                     [](const std::pair<int, double> &a, const std::pair<int, double> &b) { return a.first < b.first; });
 
+    std::vector<int> labels;
+    std::vector<double> param;
     for (long i = 0; i < list->num; i++)
     {
-        double feature = data->getFeature(list->list[i], bestNode->feature);
-        if (feature <= bestNode->threshold)
+        if (labels.empty() || labels.back() != weights[i].first)
         {
-            leftList->list[leftList->num] = list->list[i];
-            leftList->num++;
+            labels.push_back(weights[i].first);
+            param.push_back(0);
         }
-        else
+        param.back() += weights[i].second;
+    }
+
+    // labels of zero weight are left out, as in TreeNode(labelWeight, nol)
+    long k = 0;
+    for (size_t j = 0; j < labels.size(); j++)
+    {
+        if (param[j] != 0)
         {
-            rightList->list[rightList->num] = list->list[i];
-            rightList->num++;
+            labels[k] = labels[j];
+            param[k++] = param[j];
         }
     }
-
-    // only delete candidates after bestNode is not used
-    delete[] candidates;
-
-    // recursive call
-    trainTreeNode(leftChild(n), leftList, data);
-    delete leftList;
-
-    trainTreeNode(rightChild(n), rightList, data);
-    delete rightList;
+    std::lock_guard<std::mutex> guard(lock);
+    store[n]->setParams((int)k, labels.data(), param.data());
 }
 
-double Tree::getEntropyDecrease(Data *data, TreeNode node, List *list)
+void Tree::addLeaf(long n, double *labelWeight)
 {
-    double feature;
+    std::vector<int> labels;
+    std::vector<double> param;
+    for (int c = 0; c < nol; c++)
+    {
+        if (labelWeight[c] != 0)
+        {
+            labels.push_back(c);
+            param.push_back(labelWeight[c]);
+        }
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    store[n]->setParams((int)labels.size(), labels.data(), param.data());
+}
 
-    double entropyDecrease = 0;
-    double leftEntropy = 0;
-    double rightEntropy = 0;
-    double leftWeight = 0;
-    double rightWeight = 0;
+void Tree::addSplit(long n, TreeNode *node, double entropyDecrease, long num)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    TreeNode *split = store[n];
+    split->feature = node->feature;
+    split->threshold = node->threshold;
+    split->gain = entropyDecrease * num; // Approximation: entropy decrease * samples
+    split->child = (long)store.size();
+    for (int i = 1; i <= 2; i++)
+    {
+        TreeNode *child = new TreeNode(-1, 0);
+        child->level = split->level + 1;
+        child->key = split->key * 2 + i;
+        store.push_back(child);
+    }
+}
 
-    double *leftLabel = new double[nol];
-    double *rightLabel = new double[nol];
-    for (int i = 0; i < nol; i++)
+void Tree::trainTreeNodeHist(long n, List *list, Data *data, double *hist, Arena *arena)
+{
+    // Case 1: leaf node, stop splitting
+    if (deepEnough(n) || list->num < minList || pureList(list, data))
     {
-        leftLabel[i] = 0;
-        rightLabel[i] = 0;
+        addLeaf(n, list, data);
+        return;
     }
 
-    // splitting
-    for (long i = 0; i < list->num; i++)
+    // Case 2: non-leaf node
+    Arena::Mark mark = arena->mark();
+    int maxBins = data->maxBins;
+    int bin;
+    double entropyDecrease;
+    TreeNode *bestNode = chooseHistSplit(n, data, hist, arena, bin, entropyDecrease);
+    long feature = bestNode->feature;
+    addSplit(n, bestNode, entropyDecrease, list->num);
+
+    // split the list in place from the binned features
+    unsigned char *column = data->B + feature * data->n;
+    long numLeft = partitionList(list, [&](long i) { return column[i] <= bin; }, arena);
+    List leftList(list->list, numLeft);
+    List rightList(list->list + numLeft, list->num - numLeft);
+    arena->release(mark);
+
+    // build the smaller child's histogram, and turn the parent's histogram
+    // into the larger child's by subtraction; the smaller one stays in the
+    // arena until both subtrees are trained
+    long histSize = d * maxBins * nol;
+    bool leftSmaller = leftList.num <= rightList.num;
+    double *smallHist = arena->allocate<double>(histSize);
+    buildHistogram(data, leftSmaller ? &leftList : &rightList, smallHist, arena);
+    for (long i = 0; i < histSize; i++)
+    {
+        hist[i] -= smallHist[i];
+    }
+    double *leftHist = leftSmaller ? smallHist : hist;
+    double *rightHist = leftSmaller ? hist : smallHist;
+
+    // recursive call, the right subtree as a parallel task if it is large
+    // enough and a spare thread is available
+    if (leftList.num >= parallelMinList && rightList.num >= parallelMinList &&
+        claimThreads(1) == 1)
+    {
+        ThreadPool pool(2);
+        pool.run(2, [&](long i) {
+            if (i == 0)
+            {
+                trainTreeNodeHist(leftChild(n), &leftList, data, leftHist, arena);
+                return;
+            }
+            Arena *rightArena = arenas.acquire();
+            trainTreeNodeHist(rightChild(n), &rightList, data, rightHist, rightArena);
+            arenas.release(rightArena);
+        });
+        releaseThreads(1);
+    }
+    else
+    {
+        trainTreeNodeHist(leftChild(n), &leftList, data, leftHist, arena);
+        trainTreeNodeHist(rightChild(n), &rightList, data, rightHist, arena);
+    }
+
+    arena->release(mark);
+}
+
+void Tree::trainLevels(List *list, Data *data)
+{
+    // a source in memory for Data constructed from X
+    MemorySource memory(data->X, data->n, data->d);
+    DataSource *source = data->source != NULL ? data->source : &memory;
+    bool exact = !histogramMode && data->X != NULL; // values not in memory are always binned
+    int maxBins = data->maxBins;
+    long histSize = exact ? 0 : d * maxBins * nol;
+    long chunk = source->chunkRows();
+
+    // nodes built so far, children of a split node are adjacent
+    struct LevelNode
+    {
+        long index;       // index of the node in store
+        long feature;     // feature of a split node
+        double threshold; // threshold of a split node
+        int bin;          // bin of the threshold, in histogram mode
+        long left;        // position of the left child, -1 if not split
+        long slot;        // statistics of an open node in the current pass, -1 if none
+    };
+
+    // statistics of an open node: in exact mode, its candidates grouped
+    // by feature, and the label histogram of the intervals between the
+    // sorted thresholds of each group, as in scoreFeature(); in histogram
+    // mode, its label histogram of each feature and bin
+    struct LevelSlot
+    {
+        TreeNode *candidates;
+        long *order;          // candidates sorted by feature and threshold
+        long *groupBegin;     // group g is order[groupBegin[g]], ..., order[groupBegin[g+1]-1]
+        long *groupOf;        // group of each feature, -1 if none
+        double *thresholds;   // thresholds in order
+        double *intervals;    // group g has k+1 intervals from (groupBegin[g] + g) * nol
+        double *intervalWeight;
+        double *hist;
+    };
+
+    std::vector<LevelNode> nodes(1);
+    nodes[0].index = 0;
+    nodes[0].left = -1;
+    nodes[0].slot = -1;
+    std::vector<long> frontier(1, 0); // open nodes of the current level
+    std::vector<long> nextFrontier;
+    std::vector<long> nodeOf(list->num, 0); // node reached by each row of list
+
+    // as many nodes as fit in 256MB get their statistics in one pass
+    long slotBytes = exact ? noc * (long)(sizeof(TreeNode) + 2 * sizeof(long) + sizeof(double)) +
+                                 d * (long)sizeof(long) + (noc + d) * (nol + 1) * (long)sizeof(double)
+                           : histSize * (long)sizeof(double);
+    long maxSlots = (256L << 20) / slotBytes;
+    maxSlots = maxSlots < 1 ? 1 : maxSlots;
+
+    // values are read for exact splits, or when they are not binned in memory
+    bool readValues = exact || data->B == NULL;
+    double *buffer = (readValues && source->columns() == NULL) ? new double[chunk * d] : NULL;
+    // rows of the chunk whose nodes take values: row of list, slot, label, weight
+    std::vector<long> active(chunk);
+    std::vector<long> slotOf(chunk);
+    std::vector<int> chunkLabel(chunk);
+    std::vector<double> chunkWeight(chunk);
+    std::vector<long> slotNum;
+    std::vector<long> labelNum;
+    std::vector<double> labelWeight;
+    ThreadPool pool(numThreads);
+    Arena *arena = arenas.acquire();
+
+    while (!frontier.empty())
+    {
+        for (size_t g0 = 0; g0 < frontier.size(); g0 += maxSlots)
+        {
+            long groupSize = (long)(frontier.size() - g0) < maxSlots ? (long)(frontier.size() - g0) : maxSlots;
+            Arena::Mark mark = arena->mark();
+            std::vector<LevelSlot> slots(groupSize);
+            std::vector<char> featureUsed(d, exact ? 0 : 1); // whether any node has candidates of a feature
+            for (long s = 0; s < groupSize; s++)
+            {
+                LevelNode &node = nodes[frontier[g0 + s]];
+                LevelSlot &slot = slots[s];
+                node.slot = s;
+                if (!exact)
+                {
+                    slot.hist = arena->allocate<double>(histSize);
+                    std::fill(slot.hist, slot.hist + histSize, 0.0);
+                    continue;
+                }
+                slot.groupOf = arena->allocate<long>(d);
+                std::fill(slot.groupOf, slot.groupOf + d, -1L);
+                slot.intervals = NULL;
+                if (deepEnough(node.index))
+                {
+                    continue; // a leaf whatever its rows
+                }
+                slot.candidates = getCandidates(node.index, data, arena);
+                slot.order = arena->allocate<long>(noc);
+                slot.groupBegin = arena->allocate<long>(noc + 1);
+                long numGroups = groupByFeature(slot.candidates, slot.order, slot.groupBegin);
+                slot.thresholds = arena->allocate<double>(noc);
+                for (long j = 0; j < noc; j++)
+                {
+                    slot.thresholds[j] = slot.candidates[slot.order[j]].threshold;
+                }
+                for (long g = 0; g < numGroups; g++)
+                {
+                    long f = slot.candidates[slot.order[slot.groupBegin[g]]].feature;
+                    slot.groupOf[f] = g;
+                    featureUsed[f] = 1;
+                }
+                slot.intervals = arena->allocate<double>((noc + numGroups) * nol);
+                slot.intervalWeight = arena->allocate<double>(noc + numGroups);
+                std::fill(slot.intervals, slot.intervals + (noc + numGroups) * nol, 0.0);
+                std::fill(slot.intervalWeight, slot.intervalWeight + noc + numGroups, 0.0);
+            }
+            slotNum.assign(groupSize, 0);
+            labelNum.assign(groupSize * nol, 0);
+            labelWeight.assign(groupSize * nol, 0.0);
+
+            // one sweep over the rows, a chunk at a time: each row moves on
+            // from its node through the splits made since the last sweep,
+            // then each task adds the values of one feature to the
+            // statistics of the rows' nodes, in row order
+            long k = 0; // next row of list
+            for (long begin = 0; begin < data->n && k < list->num; begin += chunk)
+            {
+                long num = (data->n - begin < chunk) ? data->n - begin : chunk;
+                long kBegin = k;
+                while (k < list->num && list->list[k] < begin + num)
+                {
+                    k++;
+                }
+                if (k == kBegin)
+                {
+                    continue;
+                }
+                long stride = 0;
+                const double *rows = readValues ? source->readRows(begin, num, buffer, stride) : NULL;
+                long numActive = 0;
+                for (long j = kBegin; j < k; j++)
+                {
+                    long row = list->list[j];
+                    long position = nodeOf[j];
+                    while (nodes[position].left >= 0)
+                    {
+                        long f = nodes[position].feature;
+                        bool goesLeft = (rows == NULL) ? data->B[row + f * data->n] <= nodes[position].bin
+                                                       : rows[row - begin + f * stride] <= nodes[position].threshold;
+                        position = nodes[position].left + (goesLeft ? 0 : 1);
+                    }
+                    nodeOf[j] = position;
+                    long s = nodes[position].slot;
+                    if (s < 0)
+                    {
+                        continue;
+                    }
+                    int label = data->Y[row] - 1;
+                    double weight = (data->W == NULL) ? 1.0 : data->W[row];
+                    slotNum[s]++;
+                    labelNum[s * nol + label]++;
+                    labelWeight[s * nol + label] += weight;
+                    if (exact && slots[s].intervals == NULL)
+                    {
+                        continue; // a leaf, only counted
+                    }
+                    active[numActive] = j;
+                    slotOf[numActive] = s;
+                    chunkLabel[numActive] = label;
+                    chunkWeight[numActive] = weight;
+                    numActive++;
+                }
+                pool.run(d, [&](long f) {
+                    if (!featureUsed[f])
+                    {
+                        return;
+                    }
+                    const double *column = (rows == NULL) ? NULL : rows + f * stride;
+                    for (long a = 0; a < numActive; a++)
+                    {
+                        long row = list->list[active[a]];
+                        int label = chunkLabel[a];
+                        double weight = chunkWeight[a];
+                        LevelSlot &slot = slots[slotOf[a]];
+                        if (!exact)
+                        {
+                            int b = (data->B != NULL) ? data->B[row + f * data->n] : data->binOf(f, column[row - begin]);
+                            slot.hist[(f * maxBins + b) * nol + label] += weight;
+                            continue;
+                        }
+                        long g = slot.groupOf[f];
+                        if (g < 0)
+                        {
+                            continue;
+                        }
+                        double value = column[row - begin];
+                        double *thresholds = slot.thresholds + slot.groupBegin[g];
+                        long numThresholds = slot.groupBegin[g + 1] - slot.groupBegin[g];
+                        long b = (value != value) ? numThresholds
+                                                  : std::lower_bound(thresholds, thresholds + numThresholds, value) - thresholds;
+                        long interval = slot.groupBegin[g] + g + b;
+                        slot.intervals[interval * nol + label] += weight;
+                        slot.intervalWeight[interval] += weight;
+                    }
+                });
+            }
+
+            // split or close each node, as trainTreeNode() and
+            // trainTreeNodeHist() do
+            for (long s = 0; s < groupSize; s++)
+            {
+                long position = frontier[g0 + s];
+                LevelSlot &slot = slots[s];
+                nodes[position].slot = -1;
+                long n = nodes[position].index;
+                int labels = 0;
+                for (int c = 0; c < nol; c++)
+                {
+                    labels += labelNum[s * nol + c] > 0 ? 1 : 0;
+                }
+                if (deepEnough(n) || slotNum[s] < minList || labels <= 1)
+                {
+                    addLeaf(n, &labelWeight[s * nol]);
+                    continue;
+                }
+
+                TreeNode *bestNode;
+                double entropyDecrease;
+                int bin = 0;
+                if (exact)
+                {
+                    // score each group from its intervals, reduce in candidate order
+                    double *decrease = arena->allocate<double>(noc);
+                    for (long g = 0; slot.groupBegin[g] < noc; g++)
+                    {
+                        scoreIntervals(slot.order + slot.groupBegin[g], slot.groupBegin[g + 1] - slot.groupBegin[g],
+                                       slot.intervals + (slot.groupBegin[g] + g) * nol,
+                                       slot.intervalWeight + slot.groupBegin[g] + g, decrease, arena);
+                    }
+                    bestNode = &slot.candidates[0];
+                    entropyDecrease = -inf;
+                    for (long i = 0; i < noc; i++)
+                    {
+                        if (decrease[i] > entropyDecrease)
+                        {
+                            bestNode = &slot.candidates[i];
+                            entropyDecrease = decrease[i];
+                        }
+                    }
+                }
+                else
+                {
+                    bestNode = chooseHistSplit(n, data, slot.hist, arena, bin, entropyDecrease);
+                }
+                addSplit(n, bestNode, entropyDecrease, slotNum[s]);
+                nodes[position].feature = bestNode->feature;
+                nodes[position].threshold = bestNode->threshold;
+                nodes[position].bin = bin;
+
+                nodes[position].left = (long)nodes.size();
+                for (int child = 0; child < 2; child++)
+                {
+                    LevelNode node;
+                    node.index = child == 0 ? leftChild(n) : rightChild(n);
+                    node.left = -1;
+                    node.slot = -1;
+                    nextFrontier.push_back((long)nodes.size());
+                    nodes.push_back(node);
+                }
+            }
+            arena->release(mark);
+        }
+        frontier.swap(nextFrontier);
+        nextFrontier.clear();
+    }
+
+    arenas.release(arena);
+    if (buffer != NULL) delete[] buffer;
+}
+
+TreeNode *Tree::chooseHistSplit(long n, Data *data, double *hist, Arena *arena, int &bin, double &entropyDecrease)
+{
+    int maxBins = data->maxBins;
+    TreeNode *candidates = getCandidates(n, data, arena);
+
+    // snap thresholds to bin edges: bin <= b is equivalent to value <= edge b
+    int *bins = arena->allocate<int>(noc);
+    for (long i = 0; i < noc; i++)
+    {
+        long f = candidates[i].feature;
+        int b = data->binOf(f, candidates[i].threshold);
+        if (b > 0 && (b == data->numBins[f] - 1 || data->binEdge(f, b) > candidates[i].threshold))
+        {
+            b--; // the largest edge not above the threshold
+        }
+        bins[i] = b < data->numBins[f] - 2 ? b : data->numBins[f] - 2;
+        candidates[i].threshold = data->binEdge(f, bins[i]);
+    }
+
+    // score the candidates of each feature from the cumulative histogram
+    long *order = arena->allocate<long>(noc);
+    long *groupBegin = arena->allocate<long>(noc + 1);
+    long numGroups = groupByFeature(candidates, order, groupBegin);
+    double *decrease = arena->allocate<double>(noc);
+
+    int extra = 0;
+    if (numThreads > 1 && numGroups > 1 && numGroups * maxBins * nol >= parallelMinWork)
+    {
+        extra = claimThreads(numThreads - 1);
+    }
+    ThreadPool pool(extra + 1);
+    pool.run(numGroups, [&](long g) {
+        Arena *scratch = arenas.acquire();
+        long f = candidates[order[groupBegin[g]]].feature;
+        double *cumulative = scratch->allocate<double>(maxBins * nol);
+        double *rightLabel = scratch->allocate<double>(nol);
+        for (int b = 0; b < data->numBins[f]; b++)
+        {
+            for (int c = 0; c < nol; c++)
+            {
+                double previous = (b == 0) ? 0 : cumulative[(b - 1) * nol + c];
+                cumulative[b * nol + c] = previous + hist[(f * maxBins + b) * nol + c];
+            }
+        }
+        double *total = cumulative + (data->numBins[f] - 1) * nol;
+        double totalWeight = 0;
+        for (int c = 0; c < nol; c++)
+        {
+            totalWeight += total[c];
+        }
+        for (long j = groupBegin[g]; j < groupBegin[g + 1]; j++)
+        {
+            double *leftLabel = cumulative + bins[order[j]] * nol;
+            double leftWeight = 0;
+            for (int c = 0; c < nol; c++)
+            {
+                leftWeight += leftLabel[c];
+                rightLabel[c] = total[c] - leftLabel[c];
+            }
+            decrease[order[j]] = entropyDecreaseOf(leftLabel, rightLabel, leftWeight, totalWeight - leftWeight);
+        }
+        arenas.release(scratch);
+    });
+    releaseThreads(extra);
+
+    // get best node, reducing in candidate order
+    long best = 0;
+    for (long i = 1; i < noc; i++)
+    {
+        if (decrease[i] > decrease[best])
+        {
+            best = i;
+        }
+    }
+    bin = bins[best];
+    entropyDecrease = decrease[best];
+    return &candidates[best];
+}
+
+void Tree::buildHistogram(Data *data, List *list, double *hist, Arena *arena)
+{
+    Arena::Mark mark = arena->mark();
+    int maxBins = data->maxBins;
+    int *label = arena->allocate<int>(list->num);
+    double *weight = arena->allocate<double>(list->num);
+    for (long i = 0; i < list->num; i++)
+    {
+        label[i] = data->Y[list->list[i]] - 1;
+        weight[i] = (data->W == NULL) ? 1.0 : data->W[list->list[i]];
+    }
+
+    // features are independent, each task fills the histogram of one feature
+    int extra = 0;
+    if (numThreads > 1 && list->num * d >= parallelMinWork)
+    {
+        extra = claimThreads(numThreads - 1);
+    }
+    ThreadPool pool(extra + 1);
+    pool.run(d, [&](long f) {
+        double *featureHist = hist + f * maxBins * nol;
+        for (long j = 0; j < maxBins * nol; j++)
+        {
+            featureHist[j] = 0;
+        }
+        unsigned char *column = data->B + f * data->n;
+        for (long i = 0; i < list->num; i++)
+        {
+            featureHist[column[list->list[i]] * nol + label[i]] += weight[i];
+        }
+    });
+    releaseThreads(extra);
+
+    arena->release(mark);
+}
+
+long Tree::groupByFeature(TreeNode *candidates, long *order, long *groupBegin)
+{
+    // sort candidates by feature then threshold, and group them by feature
+    for (long i = 0; i < noc; i++)
+    {
+        order[i] = i;
+    }
+    std::sort(order, order + noc, [&](long a, long b) {
+        if (candidates[a].feature != candidates[b].feature)
+        {
+            return candidates[a].feature < candidates[b].feature;
+        }
+        return candidates[a].threshold < candidates[b].threshold;
+    });
+
+    long numGroups = 0;
+    for (long i = 0; i < noc; i++)
+    {
+        if (i == 0 || candidates[order[i]].feature != candidates[order[i - 1]].feature)
+        {
+            groupBegin[numGroups++] = i;
+        }
+    }
+    groupBegin[numGroups] = noc;
+    return numGroups;
+}
+
+void Tree::getEntropyDecreases(Data *data, TreeNode *candidates, List *list, double *entropyDecrease,
+                               Arena *arena)
+{
+    Arena::Mark mark = arena->mark();
+    long *order = arena->allocate<long>(noc);
+    long *groupBegin = arena->allocate<long>(noc + 1);
+    long numGroups = groupByFeature(candidates, order, groupBegin);
+
+    // labels and weights are shared by all features
+    int *label = arena->allocate<int>(list->num);
+    double *weight = arena->allocate<double>(list->num);
+    for (long i = 0; i < list->num; i++)
+    {
+        label[i] = data->Y[list->list[i]] - 1;
+        weight[i] = (data->W == NULL) ? 1.0 : data->W[list->list[i]];
+    }
+
+    // features are independent, each task scores all thresholds of one feature
+    int extra = 0;
+    if (numThreads > 1 && numGroups > 1 && list->num * numGroups >= parallelMinWork)
+    {
+        extra = claimThreads(numThreads - 1);
+    }
+    ThreadPool pool(extra + 1);
+    pool.run(numGroups, [&](long g) {
+        Arena *scratch = arenas.acquire();
+        scoreFeature(data, candidates, order + groupBegin[g], groupBegin[g + 1] - groupBegin[g],
+                     list, label, weight, entropyDecrease, scratch);
+        arenas.release(scratch);
+    });
+    releaseThreads(extra);
+
+    arena->release(mark);
+}
+
+void Tree::scoreFeature(Data *data, TreeNode *candidates, long *order, long k, List *list,
+                        int *label, double *weight, double *entropyDecrease, Arena *arena)
+{
+    Arena::Mark mark = arena->mark();
+    long feature = candidates[order[0]].feature;
+    double *thresholds = arena->allocate<double>(k);
+    for (long j = 0; j < k; j++)
+    {
+        thresholds[j] = candidates[order[j]].threshold;
+    }
+
+    // bin b holds instances with thresholds[b-1] < value <= thresholds[b],
+    // so an instance in bin b goes left for thresholds b, b+1, ..., k-1
+    double *hist = arena->allocate<double>((k + 1) * nol);
+    double *binWeight = arena->allocate<double>(k + 1);
+    for (long b = 0; b <= k; b++)
+    {
+        binWeight[b] = 0;
+        for (int c = 0; c < nol; c++)
+        {
+            hist[b * nol + c] = 0;
+        }
+    }
+    for (long i = 0; i < list->num; i++)
+    {
+        double value = data->getFeature(list->list[i], feature);
+        long b = (value != value) ? k : std::lower_bound(thresholds, thresholds + k, value) - thresholds;
+        hist[b * nol + label[i]] += weight[i];
+        binWeight[b] += weight[i];
+    }
+    scoreIntervals(order, k, hist, binWeight, entropyDecrease, arena);
+
+    arena->release(mark);
+}
+
+void Tree::scoreIntervals(long *order, long k, double *hist, double *binWeight, double *entropyDecrease,
+                          Arena *arena)
+{
+    Arena::Mark mark = arena->mark();
+
+    // suffix sums, rightLabel of bin j+1 is the right side of threshold j
+    double *rightLabel = arena->allocate<double>((k + 1) * nol);
+    double *rightWeight = arena->allocate<double>(k + 1);
+    rightWeight[k] = binWeight[k];
+    for (int c = 0; c < nol; c++)
+    {
+        rightLabel[k * nol + c] = hist[k * nol + c];
+    }
+    for (long b = k - 1; b >= 1; b--)
+    {
+        rightWeight[b] = rightWeight[b + 1] + binWeight[b];
+        for (int c = 0; c < nol; c++)
+        {
+            rightLabel[b * nol + c] = rightLabel[(b + 1) * nol + c] + hist[b * nol + c];
+        }
+    }
+
+    // prefix sums for the left side, one threshold at a time
+    double *leftLabel = arena->allocate<double>(nol);
+    double leftWeight = 0;
+    for (int c = 0; c < nol; c++)
+    {
+        leftLabel[c] = 0;
+    }
+    for (long j = 0; j < k; j++)
+    {
+        leftWeight += binWeight[j];
+        for (int c = 0; c < nol; c++)
+        {
+            leftLabel[c] += hist[j * nol + c];
+        }
+        entropyDecrease[order[j]] = entropyDecreaseOf(leftLabel, rightLabel + (j + 1) * nol,
+                                                      leftWeight, rightWeight[j + 1]);
+    }
+
+    arena->release(mark);
+}
+
+double Tree::getEntropyDecrease(Data *data, TreeNode node, List *list)
+{
+    double feature;
+
+    double entropyDecrease = 0;
+    double leftWeight = 0;
+    double rightWeight = 0;
+
+    // one buffer for both sides
+    double *leftLabel = new double[2 * nol];
+    double *rightLabel = leftLabel + nol;
+    for (int i = 0; i < nol; i++)
+    {
+        leftLabel[i] = 0;
+        rightLabel[i] = 0;
+    }
+
+    // splitting
+    for (long i = 0; i < list->num; i++)
     {
         feature = data->getFeature(list->list[i], node.feature);
         double w = (data->W == NULL) ? 1.0 : data->W[list->list[i]];
@@ -522,15 +2468,27 @@ double Tree::getEntropyDecrease(Data *data, TreeNode node, List *list)
         }
     }
 
+    entropyDecrease = entropyDecreaseOf(leftLabel, rightLabel, leftWeight, rightWeight);
+
+    delete[] leftLabel;
+
+    return entropyDecrease;
+}
+
+double Tree::entropyDecreaseOf(double *leftLabel, double *rightLabel, double leftWeight, double rightWeight)
+{
+    double leftEntropy = 0;
+    double rightEntropy = 0;
+
     // get left entropy
     if (leftWeight > eps)
     {
         for (int i = 0; i < nol; i++)
         {
-            leftLabel[i] /= leftWeight;
-            if (leftLabel[i] > eps)
+            double p = leftLabel[i] / leftWeight;
+            if (p > eps)
             {
-                leftEntropy -= leftLabel[i] * log(leftLabel[i]);
+                leftEntropy -= p * log(p);
             }
         }
     }
@@ -540,22 +2498,17 @@ double Tree::getEntropyDecrease(Data *data, TreeNode node, List *list)
     {
         for (int i = 0; i < nol; i++)
         {
-            rightLabel[i] /= rightWeight;
-            if (rightLabel[i] > eps)
+            double p = rightLabel[i] / rightWeight;
+            if (p > eps)
             {
-                rightEntropy -= rightLabel[i] * log(rightLabel[i]);
+                rightEntropy -= p * log(p);
             }
         }
     }
 
     // get entropy decrease
     double totalWeight = leftWeight + rightWeight;
-    entropyDecrease = -(double)leftWeight / totalWeight * (leftEntropy) - (double)rightWeight / totalWeight * (rightEntropy);
-
-    delete[] leftLabel;
-    delete[] rightLabel;
-
-    return entropyDecrease;
+    return -(double)leftWeight / totalWeight * (leftEntropy) - (double)rightWeight / totalWeight * (rightEntropy);
 }
 
 void Tree::saveTree(char *path)
@@ -564,31 +2517,50 @@ void Tree::saveTree(char *path)
     pFile = fopen(path, "w");
     if (pFile == NULL)
     {
-        std::cout << "Error opening " << path << std::endl;
-        exit(1);
+        throw Error(std::string("Cannot open ") + path + ".");
     }
 
     // save information
-    fprintf(pFile, "%d\t%ld\t%d\t%ld\n", depth, d, nol, map->size());
-
-    // save nodes
-    for (map->begin(); map->hasNext();)
+    long numNodes = (long)store.size();
+    fprintf(pFile, "%d\t%ld\t%d\t%ld\n", depth, d, nol, numNodes);
+
+    // save nodes breadth-first, numbered by position, so the file does not
+    // depend on the order in which threads added them
+    std::vector<long> order = breadthFirst();
+    long tail = 1;
+    for (long k = 0; k < numNodes; k++)
     {
-        HashNode<TreeNode *> *hnode = map->next();
-        long n = hnode->key;
-        TreeNode *node = hnode->data;
-        fprintf(pFile, "%ld\t%ld\t%f\t", n, node->feature, node->threshold);
-        if (node->feature == -1)
+        TreeNode *node = store[order[k]];
+        fprintf(pFile, "%ld\t%ld\t%.17g\t", k, node->feature, node->threshold);
+        if (node->feature != -1)
+        {
+            fprintf(pFile, "%ld\t", tail);
+            tail += 2;
+        }
+        if (node->feature == -1 && nol > FlatTree::maxDenseLabels)
         {
-            for (int i = 0; i < nol; i++)
+            // label:weight pairs of the nonzero weights
+            for (int i = 0; i < node->numParams; i++)
             {
-                fprintf(pFile, "%f\t", node->param[i]);
+                fprintf(pFile, "%d:%.17g\t", node->labels[i] + 1, node->param[i]);
+            }
+        }
+        else if (node->feature == -1)
+        {
+            for (int i = 0, j = 0; i < nol; i++)
+            {
+                bool nonzero = j < node->numParams && node->labels[j] == i;
+                fprintf(pFile, "%.17g\t", nonzero ? node->param[j++] : 0.0);
             }
         }
         fprintf(pFile, "\n");
     }
 
-    fclose(pFile);
+    bool failed = ferror(pFile) != 0;
+    if (fclose(pFile) != 0 || failed)
+    {
+        throw Error(std::string("Cannot write ") + path + ".");
+    }
 }
 
 bool Tree::pureList(List *list, Data *data)
@@ -606,73 +2578,607 @@ bool Tree::pureList(List *list, Data *data)
 
 TreeNode *Tree::decideTree(long n, double *feature)
 {
-    TreeNode *node = map->get(n);
-    if (node->feature == -1)
+    TreeNode *node = store[n];
+    while (node->feature != -1)
     {
-        return node;
+        node = store[node->child + (feature[node->feature] <= node->threshold ? 0 : 1)];
     }
+    return node;
+}
 
-    // recursive call
-    if (feature[node->feature] <= node->threshold)
+std::vector<long> Tree::breadthFirst()
+{
+    // position i holds node order[i], children are appended to the end in pairs
+    std::vector<long> order;
+    order.reserve(store.size());
+    order.push_back(0);
+    for (size_t i = 0; i < order.size(); i++)
     {
-        return decideTree(leftChild(n), feature);
+        TreeNode *node = store[order[i]];
+        if (node->feature != -1)
+        {
+            order.push_back(node->child);
+            order.push_back(node->child + 1);
+        }
     }
-    else
+    return order;
+}
+
+void Tree::runDecision(double *X, double *Y, double *P, long n_, long d_)
+{
+    getFlat()->runDecision(X, Y, P, n_, d_);
+}
+
+void Tree::compile()
+{
+    if (flat != NULL) delete flat;
+
+    long numNodes = (long)store.size();
+    long numLeaves = 0;
+    long numValues = 0;
+    for (long i = 0; i < numNodes; i++)
     {
-        return decideTree(rightChild(n), feature);
+        TreeNode *node = store[i];
+        if (node->feature == -1)
+        {
+            numLeaves++;
+            numValues += node->numParams;
+        }
+    }
+    bool sparse = nol > FlatTree::maxDenseLabels;
+    flat = new FlatTree(numNodes, numLeaves, d, nol, sparse ? numValues : -1);
+
+    // breadth-first, so the children of a node are adjacent at tail
+    std::vector<long> order = breadthFirst();
+    long tail = 1;
+    long leaf = 0;
+    long begin = 0;
+    for (long i = 0; i < numNodes; i++)
+    {
+        TreeNode *node = store[order[i]];
+        FlatNode *flatNode = flat->nodes + i;
+        flatNode->feature = (int)node->feature;
+        flatNode->threshold = node->threshold;
+        if (node->feature != -1)
+        {
+            flatNode->child = (int)tail;
+            tail += 2;
+            continue;
+        }
+
+        // leaves store what runDecision outputs: normalized probabilities
+        // and the first label of largest probability
+        flatNode->child = (int)leaf;
+        double sum = 0;
+        for (int k = 0; k < node->numParams; k++)
+        {
+            sum += node->param[k];
+        }
+        if (sparse)
+        {
+            flat->leafBegin[leaf] = (int)begin;
+        }
+        else
+        {
+            for (int j = 0; j < nol; j++)
+            {
+                flat->leafP[leaf * nol + j] = 0;
+            }
+        }
+
+        // labels of zero weight change neither the sum nor the first
+        // label of largest probability
+        flat->leafY[leaf] = 1;
+        double maxP = 0;
+        for (int k = 0; k < node->numParams; k++)
+        {
+            double p = node->param[k] / (sum + eps);
+            if (sparse)
+            {
+                flat->leafLabel[begin] = node->labels[k];
+                flat->leafValue[begin++] = p;
+            }
+            else
+            {
+                flat->leafP[leaf * nol + node->labels[k]] = p;
+            }
+            if (p > maxP)
+            {
+                maxP = p;
+                flat->leafY[leaf] = node->labels[k] + 1;
+            }
+        }
+        leaf++;
+    }
+    if (sparse)
+    {
+        flat->leafBegin[numLeaves] = (int)begin;
     }
 }
 
-void Tree::runDecision(double *X, double *Y, double *P, long n_, long d_)
+FlatTree *Tree::getFlat()
+{
+    if (flat == NULL)
+    {
+        compile();
+    }
+    return flat;
+}
+
+double *Tree::getImportance()
+{
+    return importance;
+}
+
+Forest::Forest(int size_, int depth_, long noc_, uint64_t seed)
+{
+    size = size_;
+    trees = new Tree *[size];
+    for (int i = 0; i < size; i++)
+    {
+        trees[i] = new Tree(depth_, noc_, Random(seed, i).next());
+    }
+    importance = NULL;
+    histogramMode = false;
+    flat = NULL;
+    d = 0;
+    nol = 0;
+}
+
+Forest::Forest(char *path)
+{
+    // list tree files in name order, as dir() does in RunDecisionForest.m
+    int capacity = 16;
+    char **names = new char *[capacity];
+    size = 0;
+#ifdef _WIN32
+    char *pattern = new char[strlen(path) + 16];
+    sprintf(pattern, "%s/*.tree", path);
+    struct _finddata_t entry;
+    intptr_t handle = _findfirst(pattern, &entry);
+    delete[] pattern;
+    for (int found = (handle == -1) ? -1 : 0; found == 0; found = _findnext(handle, &entry))
+    {
+        const char *name = entry.name;
+#else
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        delete[] names;
+        throw Error(std::string("Cannot open ") + path + ".");
+    }
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir))
+    {
+        const char *name = entry->d_name;
+        size_t length = strlen(name);
+        if (length < 5 || strcmp(name + length - 5, ".tree") != 0)
+        {
+            continue;
+        }
+#endif
+        if (size == capacity)
+        {
+            char **larger = new char *[capacity * 2];
+            memcpy(larger, names, capacity * sizeof(char *));
+            delete[] names;
+            names = larger;
+            capacity *= 2;
+        }
+        names[size] = new char[strlen(name) + 1];
+        strcpy(names[size], name);
+        size++;
+    }
+#ifdef _WIN32
+    if (handle != -1) _findclose(handle);
+#else
+    closedir(dir);
+#endif
+
+    if (size == 0)
+    {
+        delete[] names;
+        throw Error(std::string("No decision trees found in ") + path + ".");
+    }
+    std::sort(names, names + size, [](const char *a, const char *b) { return strcmp(a, b) < 0; });
+
+    trees = new Tree *[size];
+    char *treePath = new char[strlen(path) + 1];
+    for (int i = 0; i < size; i++)
+    {
+        delete[] treePath;
+        treePath = new char[strlen(path) + strlen(names[i]) + 2];
+        sprintf(treePath, "%s/%s", path, names[i]);
+        try
+        {
+            trees[i] = new Tree(treePath);
+        }
+        catch (...)
+        {
+            // free the trees loaded so far and the remaining names
+            for (int j = 0; j < i; j++)
+            {
+                delete trees[j];
+            }
+            for (int j = i; j < size; j++)
+            {
+                delete[] names[j];
+            }
+            delete[] trees;
+            delete[] treePath;
+            delete[] names;
+            throw;
+        }
+        delete[] names[i];
+    }
+    delete[] treePath;
+    delete[] names;
+
+    for (int i = 1; i < size; i++)
+    {
+        if (trees[i]->getFlat()->d != trees[0]->getFlat()->d || trees[i]->nol != trees[0]->nol)
+        {
+            for (int j = 0; j < size; j++)
+            {
+                delete trees[j];
+            }
+            delete[] trees;
+            throw Error(std::string("Trees in ") + path + " do not all have the same dimension and number of labels.");
+        }
+    }
+
+    importance = NULL;
+    histogramMode = false;
+    flat = NULL;
+    nol = trees[0]->nol;
+    d = trees[0]->getFlat()->d;
+}
+
+Forest::~Forest()
+{
+    for (int i = 0; i < size; i++)
+    {
+        delete trees[i];
+    }
+    delete[] trees;
+    if (importance != NULL) delete[] importance;
+    delete flat;
+}
+
+int Forest::forestSize()
+{
+    return size;
+}
+
+Tree *Forest::getTree(int i)
+{
+    return trees[i];
+}
+
+void Forest::setHistogramMode(bool histogramMode_)
+{
+    histogramMode = histogramMode_;
+    for (int i = 0; i < size; i++)
+    {
+        trees[i]->setHistogramMode(histogramMode);
+    }
+}
+
+void Forest::setLevelWise(bool levelWise_)
+{
+    for (int i = 0; i < size; i++)
+    {
+        trees[i]->setLevelWise(levelWise_);
+    }
+}
+
+void Forest::setFeatureSampling(long maxFeatures_)
+{
+    for (int i = 0; i < size; i++)
+    {
+        trees[i]->setFeatureSampling(maxFeatures_);
+    }
+}
+
+void Forest::setRowSampling(double sampleRatio_, bool bootstrap_)
+{
+    for (int i = 0; i < size; i++)
+    {
+        trees[i]->setRowSampling(sampleRatio_, bootstrap_);
+    }
+}
+
+void Forest::trainForest(Data *data, int numThreads)
+{
+    d = data->d;
+    nol = data->nol;
+    delete flat; // its trees are compiled again
+    flat = NULL;
+
+    // features are binned once for all trees
+    if (histogramMode && data->B == NULL && data->X != NULL)
+    {
+        data->buildBins(256);
+    }
+
+    // trees only read data, so they can be trained concurrently; threads
+    // left over when there are fewer trees than threads go to each tree
+    ThreadPool pool(numThreads);
+    int treeThreads = pool.size() > size ? pool.size() / size : 1;
+    pool.run(size, [&](long i) {
+        trees[i]->setNumThreads(treeThreads);
+        trees[i]->trainTree(data);
+    });
+
+    if (importance != NULL) delete[] importance;
+    importance = new double[d];
+    for (long j = 0; j < d; j++)
+    {
+        importance[j] = 0;
+        for (int i = 0; i < size; i++)
+        {
+            importance[j] += trees[i]->getImportance()[j];
+        }
+    }
+}
+
+void Forest::saveForest(char *path)
+{
+#ifdef _WIN32
+    _mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+
+    for (int i = 0; i < size; i++)
+    {
+        std::string treePath = std::string(path) + "/" + std::to_string(i + 1) + ".tree";
+        trees[i]->saveTree(&treePath[0]);
+    }
+}
+
+double *Forest::getImportance()
+{
+    return importance;
+}
+
+FlatForest *Forest::getFlat()
+{
+    FlatTree **flats = new FlatTree *[size];
+    for (int i = 0; i < size; i++)
+    {
+        flats[i] = trees[i]->getFlat();
+    }
+    FlatForest *flat = new FlatForest(flats, size);
+    delete[] flats;
+    return flat;
+}
+
+void Forest::runDecision(double *X, double *Y, double *P, long n_, long d_, int numThreads)
+{
+    FlatForest *compiled;
+    {
+        std::lock_guard<std::mutex> guard(flatLock);
+        if (flat == NULL) flat = getFlat();
+        compiled = flat;
+    }
+    compiled->runDecision(X, Y, P, n_, d_, numThreads);
+}
+
+FlatForest::FlatForest(FlatTree **trees_, int size_, const double *weights_)
+{
+    // the vote buffers are sized from the first tree
+    for (int i = 1; i < size_; i++)
+    {
+        if (trees_[i]->d != trees_[0]->d || trees_[i]->nol != trees_[0]->nol)
+        {
+            throw Error("Trees of a forest must all have the same dimension and number of labels.");
+        }
+    }
+    size = size_;
+    trees = new FlatTree *[size];
+    for (int i = 0; i < size; i++)
+    {
+        trees[i] = trees_[i];
+    }
+    d = trees[0]->d;
+    nol = trees[0]->nol;
+    weights = NULL;
+    totalWeight = size;
+    if (weights_ != NULL)
+    {
+        weights = new double[size];
+        totalWeight = 0;
+        for (int i = 0; i < size; i++)
+        {
+            weights[i] = weights_[i];
+            totalWeight += weights[i];
+        }
+    }
+
+    // QuickScorer adds probabilities, not weighted labels
+    scorer = NULL;
+    if (weights == NULL && QuickScorer::supports(trees, size))
+    {
+        scorer = new QuickScorer(trees, size);
+    }
+    engine = ENGINE_AUTO;
+}
+
+FlatForest::~FlatForest()
+{
+    delete scorer;
+    delete[] trees;
+    if (weights != NULL) delete[] weights;
+}
+
+void FlatForest::setEngine(int engine_)
+{
+    engine = (engine_ == ENGINE_QUICKSCORER && scorer == NULL) ? ENGINE_TRAVERSAL : engine_;
+}
+
+void FlatForest::runDecision(double *X, double *Y, double *P, long n, long d_, int numThreads)
+{
+    runStrided(X, 1, n, Y, P, n, d_, numThreads);
+}
+
+void FlatForest::runStrided(const double *X, long rowStride, long featureStride, double *Y, double *P, long n,
+                            long d_, int numThreads)
 {
     if (d != d_)
     {
-        std::cout << "Error: testing data dimension does not match. \n";
-        exit(1);
+        throw Error("Testing data dimension does not match.");
     }
 
-    double *feature = new double[d];
-    for (long i = 0; i < n_; i++)
+    // QuickScorer reads each feature of consecutive rows at once
+    bool canScore = scorer != NULL && rowStride == 1;
+    long rows = blockSize();
+    long numBlocks = (n + rows - 1) / rows;
+
+    // scratch buffers of one thread, reused for all of its blocks
+    class Scratch
+    {
+    public:
+        std::vector<double> block, votes;
+        std::vector<int> leaves;
+        std::vector<uint64_t> bitvectorBuffer;
+        uint64_t *bitvectors; // 64-byte aligned
+
+        Scratch(long rows, long d, int nol, int size)
+            : block(rows * d), votes(rows * nol), leaves(rows), bitvectorBuffer(8 * size + 8)
+        {
+            bitvectors = bitvectorBuffer.data() + (8 - ((size_t)bitvectorBuffer.data() / 8) % 8) % 8;
+        }
+    };
+    auto run = [&](long b, bool quickScorer, Scratch &scratch) {
+        long begin = b * rows;
+        runBlock(X, rowStride, featureStride, Y, P, n, begin, (n - begin < rows) ? n - begin : rows,
+                 scratch.block.data(), scratch.votes.data(), scratch.leaves.data(), scratch.bitvectors, quickScorer);
+    };
+
+    // time both engines on this thread, on samples of blocks of about 1024
+    // rows: one warm-up sample each, then the fastest of four alternate
+    // samples each, so that one slow sample does not decide. QuickScorer has
+    // to be clearly faster to be kept. Concurrent first runs may both time;
+    // the first to finish sets the engine for good.
+    long first = 0;
+    long group = (1024 + rows - 1) / rows;
+    int current = engine.load();
+    if (current == ENGINE_AUTO && canScore && numBlocks >= 10 * group)
     {
-        // constructing features
-        for (long j = 0; j < d; j++)
+        Scratch scratch(rows, d, nol, size);
+        double fastest[2] = {1e300, 1e300};
+        for (int sample = 0; sample < 10; sample++)
         {
-            feature[j] = X[i + j * n_];
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (long b = 0; b < group; b++, first++)
+            {
+                run(first, sample % 2 == 1, scratch);
+            }
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (sample >= 2 && elapsed < fastest[sample % 2]) fastest[sample % 2] = elapsed;
         }
+        int chosen = fastest[1] < 0.9 * fastest[0] ? ENGINE_QUICKSCORER : ENGINE_TRAVERSAL;
+        engine.compare_exchange_strong(current, chosen);
+        current = engine.load();
+    }
 
-        // recursive call
-        TreeNode *node = decideTree(0, feature);
+    // each worker claims blocks until none is left
+    bool quickScorer = current == ENGINE_QUICKSCORER && canScore;
+    ThreadPool pool(numThreads);
+    std::atomic<long> next(first);
+    long numWorkers = pool.size() < numBlocks - first ? pool.size() : numBlocks - first;
+    pool.run(numWorkers, [&](long) {
+        Scratch scratch(rows, d, nol, size);
+        for (long b = next++; b < numBlocks; b = next++)
+        {
+            run(b, quickScorer, scratch);
+        }
+    });
+}
 
-        // computing probabilities
-        double sum = 0;
-        for (long j = 0; j < nol; j++)
+void FlatForest::runBlock(const double *X, long rowStride, long featureStride, double *Y, double *P, long n,
+                          long begin, long num, double *block, double *votes, int *leaves, uint64_t *bitvectors,
+                          bool quickScorer)
+{
+    for (long i = 0; i < num * nol; i++)
+    {
+        votes[i] = 0;
+    }
+
+    if (quickScorer)
+    {
+        // QuickScorer reads the column-major X in place
+        scorer->addVotes(X + begin, featureStride, num, votes, bitvectors);
+    }
+    else
+    {
+        // transpose the block once, so each row's features are contiguous,
+        // unless they already are
+        const double *x = X + begin * rowStride;
+        long stride = rowStride;
+        if (featureStride != 1)
+        {
+            for (long j = 0; j < d; j++)
+            {
+                const double *column = x + j * featureStride;
+                for (long i = 0; i < num; i++)
+                {
+                    block[i * d + j] = column[i * rowStride];
+                }
+            }
+            x = block;
+            stride = d;
+        }
+
+        // walk all trees over the block, accumulating votes in tree order
+        for (int t = 0; t < size; t++)
         {
-            P[i + j * n_] = node->param[j];
-            sum += P[i + j * n_];
+            FlatTree *tree = trees[t];
+            tree->findLeaves(x, stride, 1, num, leaves);
+            if (weights != NULL)
+            {
+                for (long i = 0; i < num; i++)
+                {
+                    votes[i * nol + tree->leafY[leaves[i]] - 1] += weights[t];
+                }
+                continue;
+            }
+            for (long i = 0; i < num; i++)
+            {
+                tree->addLeafP(leaves[i], votes + i * nol);
+            }
         }
-        for (long j = 0; j < nol; j++)
+    }
+
+    for (long i = 0; i < num; i++)
+    {
+        double *vote = votes + i * nol;
+        double *p = P + begin + i;
+        for (int j = 0; j < nol; j++)
         {
-            P[i + j * n_] /= (sum + eps);
+            p[j * n] = vote[j] / totalWeight;
         }
 
         // decide labels
-        Y[i] = 1;
-        double maxP = P[i];
-        for (long j = 1; j < nol; j++)
+        Y[begin + i] = 1;
+        double maxP = p[0];
+        for (int j = 1; j < nol; j++)
         {
-            if (P[i + j * n_] > maxP)
+            if (p[j * n] > maxP)
             {
-                maxP = P[i + j * n_];
-                Y[i] = j + 1;
+                maxP = p[j * n];
+                Y[begin + i] = j + 1;
             }
         }
     }
-    delete[] feature;
 }
 
-double *Tree::getImportance()
+long FlatForest::blockSize()
 {
-    return importance;
+    long rows = d > 0 ? 4096 / d : 512;
+    return rows < 8 ? 8 : (rows > 512 ? 512 : rows);
 }
 
+#endif // DECISIONFOREST_LIBRARY
+
 #endif
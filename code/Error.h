@@ -0,0 +1,60 @@
+/**
+ * @file Error.h
+ * @brief C++ implementation of the errors reported by the library.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @class Error
+ * @brief Class for the errors thrown by the library.
+ *
+ * Invalid data or arguments, and files that cannot be read or written,
+ * are reported by throwing an Error with a message, so that the program
+ * using the library (a MEX function, the dforest tool, a service) decides
+ * what to do. Out of memory is reported by std::bad_alloc as usual.
+ */
+
+#ifndef Error_H
+#define Error_H
+
+#include <stdexcept>
+#include <string>
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+class Error : public std::runtime_error
+{
+public:
+    explicit Error(const std::string &message);
+};
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+inline Error::Error(const std::string &message) : std::runtime_error(message)
+{
+}
+
+#endif
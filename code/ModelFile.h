@@ -0,0 +1,582 @@
+/**
+ * @file ModelFile.h
+ * @brief C++ implementation of the binary model file format.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @class ModelHeader
+ * @brief Class to represent the fixed header of a model file.
+ * @class ModelTreeEntry
+ * @brief Class to represent one entry of the tree table of a model file.
+ * @class ModelFile
+ * @brief Class to save and map binary model files.
+ *
+ * A model file holds one tree or a whole forest in the compiled FlatTree
+ * layout, so it is used in place after mapping, without any parsing:
+ *
+ *     ModelHeader       64 bytes
+ *     ModelTreeEntry    32 bytes per tree
+ *     for each tree:    FlatNode nodes[numNodes]       16 bytes each
+ *                       double leafP[numLeaves * nol]
+ *                       int leafY[numLeaves], padded to 8 bytes
+ *
+ * An AdaBoost ensemble (see AdaBoost.h) is saved as version 2, with the
+ * vote weight (alpha) of each tree in its entry of the tree table; files
+ * without weights are still saved as version 1.
+ *
+ * Trees with sparse leaves (more than FlatTree::maxDenseLabels labels) are
+ * saved as version 3, where the flags of the header tell whether the trees
+ * are weighted, and the leaf table of each tree is
+ *
+ *                       int leafBegin[numLeaves + 1]
+ *                       int leafLabel[numValues], padded to 8 bytes
+ *                       double leafValue[numValues]
+ *                       int leafY[numLeaves], padded to 8 bytes
+ *
+ * with numValues = leafBegin[numLeaves] nonzero probabilities.
+ *
+ * All numbers are little-endian, and offsets are in bytes from the start
+ * of the file. The checksum covers everything after the header, read as
+ * 64-bit words. Whether or not the checksum is verified, loading checks
+ * that every count fits in the file, and the structure of every tree as
+ * the tree file loader does: features below d, each child after its
+ * parent, leaf indices and labels in range, so that a corrupt file is
+ * rejected instead of read out of bounds. On POSIX systems the file is mapped read-only and shared,
+ * so processes loading the same model share the page cache.
+ */
+
+#ifndef ModelFile_H
+#define ModelFile_H
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include "DecisionTree.h"
+#include "AdaBoost.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+class ModelHeader
+{
+public:
+    char magic[8];         // "DFMODEL" and a null character
+    uint32_t version;      // format version
+    uint32_t numTrees;     // number of trees
+    uint64_t d;            // dimension of each instance
+    uint32_t nol;          // number of unique labels
+    uint32_t flags;        // ModelFlags in version 3, zero before
+    uint64_t size;         // file size in bytes
+    uint64_t checksum;     // checksum of everything after the header
+    uint64_t reserved2[2]; // zero
+};
+
+enum ModelFlags
+{
+    MODEL_WEIGHTED = 1, // the trees vote with the weights of the tree table
+    MODEL_SPARSE = 2    // leaves are sparse
+};
+
+class ModelTreeEntry
+{
+public:
+    uint64_t offset;    // offset of the node array
+    uint64_t numNodes;  // number of nodes
+    uint64_t numLeaves; // number of leaves
+    double weight;      // vote weight of the tree if weighted, zero otherwise
+};
+
+class ModelFile
+{
+private:
+    char *buffer;          // mapped or loaded file
+    uint64_t size;         // file size in bytes
+    bool mapped;           // whether buffer is mapped or allocated
+    FlatTree **trees;      // views into buffer
+    double *weights;       // vote weights of the trees, NULL unless weighted
+    int numTrees;
+    FlatForest *forest;    // the trees of runDecision(), built on its first call
+    std::mutex forestLock; // protects forest
+
+    void release(); // free everything, also of a file that failed to load
+
+public:
+    static const uint32_t version = 3; // latest version read
+    long d;  // dimension of each instance
+    int nol; // number of unique labels
+
+    ModelFile(char *path, bool verify = true); // map a model file
+    ~ModelFile();
+    int forestSize();
+    FlatTree *getTree(int i);
+    double *getWeights(); // vote weight of each tree, NULL unless weighted
+
+    /**
+     * @brief Make decisions given testing data. With several trees, P is
+     * the average of the trees' probabilities, as in RunDecisionForest, or
+     * their weighted votes, as in RunAdaBoost.
+     */
+    void runDecision(double *X, double *Y, double *P, long n, long d);
+
+    /**
+     * @brief Save trees to one model file.
+     * @param weights If not NULL, the vote weight of each tree, saved as
+     *        version 2, or version 3 with sparse leaves.
+     */
+    static void save(char *path, FlatTree **trees, int numTrees, const double *weights = NULL);
+    static void saveTree(char *path, Tree *tree);
+    static void saveForest(char *path, Forest *forest);
+    static void saveBoost(char *path, AdaBoost *boost); // trees and their alphas
+    static bool isModelFile(char *path); // check the magic of a file
+    static uint64_t checksum(const char *data, uint64_t size);
+};
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+// compiled into the decisionforest library, as the implementation part of
+// DecisionTree.h
+#ifndef DECISIONFOREST_LIBRARY
+
+static const char modelMagic[8] = {'D', 'F', 'M', 'O', 'D', 'E', 'L', '\0'};
+
+ModelFile::ModelFile(char *path, bool verify)
+{
+    uint16_t one = 1;
+    if (*(char *)&one != 1)
+    {
+        throw Error("Model files are not supported on big-endian hosts.");
+    }
+
+    buffer = NULL;
+    size = 0;
+    mapped = false;
+    trees = NULL;
+    weights = NULL;
+    numTrees = 0;
+    forest = NULL;
+
+    auto fail = [&](const std::string &message) {
+        release();
+        throw Error(message);
+    };
+
+#ifdef _WIN32
+    FILE *pFile = fopen(path, "rb");
+    if (pFile != NULL)
+    {
+        fseek(pFile, 0, SEEK_END);
+        size = (uint64_t)ftell(pFile);
+        fseek(pFile, 0, SEEK_SET);
+        buffer = new char[size > 0 ? size : 1];
+        if (fread(buffer, 1, size, pFile) != size)
+        {
+            size = 0;
+        }
+        fclose(pFile);
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        off_t end = lseek(fd, 0, SEEK_END);
+        if (end > 0)
+        {
+            void *address = mmap(NULL, (size_t)end, PROT_READ, MAP_SHARED, fd, 0);
+            if (address != MAP_FAILED)
+            {
+                buffer = (char *)address;
+                size = (uint64_t)end;
+                mapped = true;
+            }
+        }
+        close(fd);
+    }
+#endif
+    if (buffer == NULL)
+    {
+        fail(std::string("Cannot open ") + path + ".");
+    }
+
+    // validate the header and the tree table
+    ModelHeader *header = (ModelHeader *)buffer;
+    if (size < sizeof(ModelHeader) || memcmp(header->magic, modelMagic, 8) != 0)
+    {
+        fail(std::string(path) + " is not a model file.");
+    }
+    if (header->version < 1 || header->version > version)
+    {
+        fail(std::string(path) + " has unsupported version " + std::to_string(header->version) + ".");
+    }
+    if (header->size != size || header->numTrees == 0 ||
+        sizeof(ModelHeader) + header->numTrees * sizeof(ModelTreeEntry) > size)
+    {
+        fail(std::string(path) + " is truncated or corrupted.");
+    }
+    if (verify && checksum(buffer + sizeof(ModelHeader), size - sizeof(ModelHeader)) != header->checksum)
+    {
+        fail(std::string("Checksum of ") + path + " does not match.");
+    }
+
+    if (header->d == 0 || header->d > INT_MAX || header->nol == 0 || header->nol > INT_MAX)
+    {
+        fail(std::string(path) + " is truncated or corrupted.");
+    }
+    d = (long)header->d;
+    nol = (int)header->nol;
+    numTrees = (int)header->numTrees;
+    trees = new FlatTree *[numTrees]();
+    uint32_t flags = header->version == 3 ? header->flags : (header->version == 2 ? MODEL_WEIGHTED : 0);
+    weights = (flags & MODEL_WEIGHTED) ? new double[numTrees] : NULL;
+
+    // every count is bounded by the file size before it is multiplied, so
+    // the offsets below cannot overflow
+    ModelTreeEntry *table = (ModelTreeEntry *)(buffer + sizeof(ModelHeader));
+    for (int i = 0; i < numTrees; i++)
+    {
+        uint64_t offset = table[i].offset;
+        uint64_t numNodes = table[i].numNodes;
+        uint64_t numLeaves = table[i].numLeaves;
+        if (offset % 8 != 0 || offset > size || numNodes == 0 || numNodes > size / sizeof(FlatNode) ||
+            numNodes > INT_MAX || numLeaves == 0 || numLeaves > size / sizeof(int))
+        {
+            fail(std::string(path) + " is truncated or corrupted.");
+        }
+        uint64_t numValues = 0;
+        uint64_t leafBytes;
+        if (flags & MODEL_SPARSE)
+        {
+            // numValues is read from the end of leafBegin, once that is known to be in the file
+            uint64_t valuesAt = offset + numNodes * sizeof(FlatNode) + numLeaves * sizeof(int);
+            if (valuesAt + sizeof(int) > size || *(int *)(buffer + valuesAt) < 0)
+            {
+                fail(std::string(path) + " is truncated or corrupted.");
+            }
+            numValues = (uint64_t)*(int *)(buffer + valuesAt);
+            leafBytes = ((numLeaves + 1 + numValues) * sizeof(int) + 7) / 8 * 8 + numValues * sizeof(double);
+        }
+        else
+        {
+            if (numLeaves > size / sizeof(double) / nol)
+            {
+                fail(std::string(path) + " is truncated or corrupted.");
+            }
+            leafBytes = numLeaves * nol * sizeof(double);
+        }
+        uint64_t end = offset + numNodes * sizeof(FlatNode) + leafBytes + numLeaves * sizeof(int);
+        if (end > size)
+        {
+            fail(std::string(path) + " is truncated or corrupted.");
+        }
+
+        FlatNode *nodes = (FlatNode *)(buffer + offset);
+        int *leafY;
+        if (flags & MODEL_SPARSE)
+        {
+            int *leafBegin = (int *)(nodes + numNodes);
+            int *leafLabel = leafBegin + numLeaves + 1;
+            double *leafValue = (double *)((char *)nodes + numNodes * sizeof(FlatNode) +
+                                           ((numLeaves + 1 + numValues) * sizeof(int) + 7) / 8 * 8);
+            leafY = (int *)(leafValue + numValues);
+
+            // each leaf's labels are increasing and below nol
+            if (leafBegin[0] != 0)
+            {
+                fail(std::string(path) + " has an invalid leaf table.");
+            }
+            for (uint64_t k = 0; k < numLeaves; k++)
+            {
+                if (leafBegin[k + 1] < leafBegin[k])
+                {
+                    fail(std::string(path) + " has an invalid leaf table.");
+                }
+                for (int j = leafBegin[k]; j < leafBegin[k + 1]; j++)
+                {
+                    if (leafLabel[j] < 0 || leafLabel[j] >= nol || (j > leafBegin[k] && leafLabel[j] <= leafLabel[j - 1]))
+                    {
+                        fail(std::string(path) + " has a label out of range.");
+                    }
+                }
+            }
+            trees[i] = new FlatTree(nodes, leafBegin, leafLabel, leafValue, leafY, (long)numNodes, (long)numLeaves,
+                                    d, nol);
+        }
+        else
+        {
+            double *leafP = (double *)(nodes + numNodes);
+            leafY = (int *)(leafP + numLeaves * nol);
+            trees[i] = new FlatTree(nodes, leafP, leafY, (long)numNodes, (long)numLeaves, d, nol);
+        }
+
+        // as the tree file loader: features in range, and children after
+        // their parent, so every walk ends at a leaf
+        for (uint64_t k = 0; k < numNodes; k++)
+        {
+            if (nodes[k].feature == -1)
+            {
+                if (nodes[k].child < 0 || (uint64_t)nodes[k].child >= numLeaves)
+                {
+                    fail(std::string(path) + " has a leaf out of range.");
+                }
+            }
+            else if (nodes[k].feature < 0 || nodes[k].feature >= d)
+            {
+                fail(std::string(path) + " has a feature out of range.");
+            }
+            else if ((uint64_t)nodes[k].child <= k || (uint64_t)nodes[k].child + 1 >= numNodes)
+            {
+                fail(std::string(path) + " has a child out of range.");
+            }
+        }
+        for (uint64_t k = 0; k < numLeaves; k++)
+        {
+            if (leafY[k] < 1 || leafY[k] > nol)
+            {
+                fail(std::string(path) + " has a label out of range.");
+            }
+        }
+        if (weights != NULL)
+        {
+            weights[i] = table[i].weight;
+        }
+    }
+}
+
+ModelFile::~ModelFile()
+{
+    release();
+}
+
+void ModelFile::release()
+{
+    delete forest;
+    if (trees != NULL)
+    {
+        for (int i = 0; i < numTrees; i++)
+        {
+            delete trees[i];
+        }
+        delete[] trees;
+    }
+    if (weights != NULL) delete[] weights;
+
+#ifndef _WIN32
+    if (mapped)
+    {
+        munmap(buffer, (size_t)size);
+        return;
+    }
+#endif
+    delete[] buffer;
+}
+
+int ModelFile::forestSize()
+{
+    return numTrees;
+}
+
+FlatTree *ModelFile::getTree(int i)
+{
+    return trees[i];
+}
+
+double *ModelFile::getWeights()
+{
+    return weights;
+}
+
+void ModelFile::runDecision(double *X, double *Y, double *P, long n, long d_)
+{
+    FlatForest *compiled;
+    {
+        std::lock_guard<std::mutex> guard(forestLock);
+        if (forest == NULL) forest = new FlatForest(trees, numTrees, weights);
+        compiled = forest;
+    }
+    compiled->runDecision(X, Y, P, n, d_);
+}
+
+void ModelFile::save(char *path, FlatTree **trees, int numTrees, const double *weights)
+{
+    static_assert(sizeof(FlatNode) == 16, "FlatNode must be 16 bytes");
+    static_assert(sizeof(ModelHeader) == 64, "ModelHeader must be 64 bytes");
+    static_assert(sizeof(ModelTreeEntry) == 32, "ModelTreeEntry must be 32 bytes");
+
+    bool sparse = trees[0]->leafBegin != NULL;
+    for (int i = 1; i < numTrees; i++)
+    {
+        if ((trees[i]->leafBegin != NULL) != sparse)
+        {
+            throw Error("Trees of a model file must all have sparse leaves or dense leaves.");
+        }
+    }
+
+    // lay out the file in memory, then write it at once
+    uint64_t size = sizeof(ModelHeader) + numTrees * sizeof(ModelTreeEntry);
+    uint64_t *offsets = new uint64_t[numTrees];
+    for (int i = 0; i < numTrees; i++)
+    {
+        FlatTree *tree = trees[i];
+        offsets[i] = size;
+        size += tree->numNodes * sizeof(FlatNode);
+        if (sparse)
+        {
+            size += ((tree->numLeaves + 1 + tree->numValues) * sizeof(int) + 7) / 8 * 8 +
+                    tree->numValues * sizeof(double);
+        }
+        else
+        {
+            size += tree->numLeaves * tree->nol * sizeof(double);
+        }
+        size += tree->numLeaves * sizeof(int);
+        size = (size + 7) / 8 * 8;
+    }
+
+    char *buffer = new char[size];
+    memset(buffer, 0, size);
+
+    ModelHeader *header = (ModelHeader *)buffer;
+    memcpy(header->magic, modelMagic, 8);
+    header->version = sparse ? 3 : (weights == NULL ? 1 : 2);
+    header->flags = sparse ? (MODEL_SPARSE | (weights == NULL ? 0 : MODEL_WEIGHTED)) : 0;
+    header->numTrees = (uint32_t)numTrees;
+    header->d = (uint64_t)trees[0]->d;
+    header->nol = (uint32_t)trees[0]->nol;
+    header->size = size;
+
+    ModelTreeEntry *table = (ModelTreeEntry *)(buffer + sizeof(ModelHeader));
+    for (int i = 0; i < numTrees; i++)
+    {
+        FlatTree *tree = trees[i];
+        table[i].offset = offsets[i];
+        table[i].numNodes = tree->numNodes;
+        table[i].numLeaves = tree->numLeaves;
+        table[i].weight = weights == NULL ? 0 : weights[i];
+
+        char *p = buffer + offsets[i];
+        memcpy(p, tree->nodes, tree->numNodes * sizeof(FlatNode));
+        p += tree->numNodes * sizeof(FlatNode);
+        if (sparse)
+        {
+            memcpy(p, tree->leafBegin, (tree->numLeaves + 1) * sizeof(int));
+            memcpy(p + (tree->numLeaves + 1) * sizeof(int), tree->leafLabel, tree->numValues * sizeof(int));
+            p += ((tree->numLeaves + 1 + tree->numValues) * sizeof(int) + 7) / 8 * 8;
+            memcpy(p, tree->leafValue, tree->numValues * sizeof(double));
+            p += tree->numValues * sizeof(double);
+        }
+        else
+        {
+            memcpy(p, tree->leafP, tree->numLeaves * tree->nol * sizeof(double));
+            p += tree->numLeaves * tree->nol * sizeof(double);
+        }
+        memcpy(p, tree->leafY, tree->numLeaves * sizeof(int));
+    }
+    header->checksum = checksum(buffer + sizeof(ModelHeader), size - sizeof(ModelHeader));
+
+    delete[] offsets;
+
+    FILE *pFile = fopen(path, "wb");
+    bool opened = pFile != NULL;
+    bool written = opened && fwrite(buffer, 1, size, pFile) == size;
+    if (opened && fclose(pFile) != 0)
+    {
+        written = false;
+    }
+    delete[] buffer;
+    if (!written)
+    {
+        throw Error(std::string(opened ? "Cannot write " : "Cannot open ") + path + ".");
+    }
+}
+
+void ModelFile::saveTree(char *path, Tree *tree)
+{
+    FlatTree *flat = tree->getFlat();
+    save(path, &flat, 1);
+}
+
+void ModelFile::saveForest(char *path, Forest *forest)
+{
+    int numTrees = forest->forestSize();
+    FlatTree **flats = new FlatTree *[numTrees];
+    for (int i = 0; i < numTrees; i++)
+    {
+        flats[i] = forest->getTree(i)->getFlat();
+    }
+    save(path, flats, numTrees);
+    delete[] flats;
+}
+
+void ModelFile::saveBoost(char *path, AdaBoost *boost)
+{
+    int numTrees = boost->boostSize();
+    FlatTree **flats = new FlatTree *[numTrees];
+    for (int i = 0; i < numTrees; i++)
+    {
+        flats[i] = boost->getTree(i)->getFlat();
+    }
+    save(path, flats, numTrees, boost->getAlphas());
+    delete[] flats;
+}
+
+bool ModelFile::isModelFile(char *path)
+{
+    char magic[8];
+    FILE *pFile = fopen(path, "rb");
+    if (pFile == NULL)
+    {
+        return false;
+    }
+    bool result = fread(magic, 1, 8, pFile) == 8 && memcmp(magic, modelMagic, 8) == 0;
+    fclose(pFile);
+    return result;
+}
+
+uint64_t ModelFile::checksum(const char *data, uint64_t size)
+{
+    // FNV-1a over 64-bit words
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint64_t i = 0; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash ^= word;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+#endif // DECISIONFOREST_LIBRARY
+
+#endif
@@ -0,0 +1,335 @@
+/**
+ * @file QuickScorer.h
+ * @brief C++ implementation of QuickScorer forest evaluation.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @class QuickScorer
+ * @brief Class to evaluate a forest of small trees with leaf bitvectors.
+ *
+ * QuickScorer (Lucchese et al., SIGIR 2015) evaluates a forest feature by
+ * feature instead of tree by tree. The leaves of each tree are numbered
+ * from left to right, and each instance keeps one 64-bit vector per tree
+ * with a bit for each leaf that can still be its exit leaf. A split node
+ * whose test fails (the instance goes right) rules out the leaves of its
+ * left subtree, so it is stored as a mask with those bits cleared.
+ *
+ * The split nodes of all trees are sorted by feature, then by threshold.
+ * For each feature, the instance goes right at exactly the nodes whose
+ * threshold is below its value, which are a prefix of that feature's
+ * list, so the scan stops at the first threshold not below the value. NaN
+ * goes right at every node, as in decideTree(). The exit leaf of each tree
+ * is then the lowest bit left in its vector.
+ *
+ * The scan is sequential, with no data-dependent branch per node, which
+ * is faster than walking many shallow trees node by node. With AVX-512,
+ * 8 instances are scanned together, reading one feature of all 8 with one
+ * load from the column-major X, and the scan of a feature stops when no
+ * lane is above the threshold. It needs every tree to have at most 64
+ * leaves, and gives the same leaves, so the same results, as
+ * FlatTree::findLeaf().
+ *
+ * This header is included by DecisionTree.h after FlatTree is declared.
+ */
+
+#ifndef QuickScorer_H
+#define QuickScorer_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+class QuickScorer
+{
+private:
+    long numConditions;  // number of split nodes of all trees
+    long *featureBegin;  // conditions of feature f are featureBegin[f], ..., featureBegin[f+1]-1
+    double *thresholds;  // thresholds sorted within each feature
+    int *conditionTree;  // tree of each condition
+    uint64_t *masks;     // leaves kept when the instance goes right
+    int *leafIndex;      // size * 64, index into the leaf table of the k-th leaf from the left
+
+    int numberLeaves(int t, long node, int first, std::vector<long> &conditionNodes,
+                     std::vector<uint64_t> &conditionMasks, std::vector<int> &conditionTrees);
+
+public:
+    long d;           // dimension of each instance
+    int nol;          // number of unique labels
+    int size;         // number of trees
+    FlatTree **trees; // the trees, not owned
+
+    QuickScorer(FlatTree **trees_, int size_);
+    ~QuickScorer();
+
+    /**
+     * @brief Whether every tree has at most 64 leaves and no NaN threshold,
+     * and all trees have the d and nol of the first, which size the tables.
+     */
+    static bool supports(FlatTree **trees, int size);
+
+    /**
+     * @brief Add the probabilities of all trees to the votes of num instances.
+     * @param X Column-major features of the instances, X[i + j * n].
+     * @param votes Votes of the instances, num * nol, row by row.
+     * @param bitvectors Buffer of 8 * size words.
+     */
+    void addVotes(const double *X, long n, long num, double *votes, uint64_t *bitvectors);
+
+    /**
+     * @brief Add the votes of the leaves left in the bitvectors of
+     * instances begin, ..., begin+num-1 (num <= 8), stored 8 per tree.
+     */
+    void addLeafVotes(long begin, long num, double *votes, uint64_t *bitvectors);
+
+    long addVotesAVX512(const double *X, long n, long num, double *votes, uint64_t *bitvectors);
+};
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+inline int lowestBit(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(v);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return (int)i;
+#else
+    int i = 0;
+    while (!(v & 1))
+    {
+        v >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+inline QuickScorer::QuickScorer(FlatTree **trees_, int size_)
+{
+    size = size_;
+    trees = new FlatTree *[size];
+    for (int t = 0; t < size; t++)
+    {
+        trees[t] = trees_[t];
+    }
+    d = trees[0]->d;
+    nol = trees[0]->nol;
+
+    // number the leaves of each tree and collect its split nodes
+    std::vector<long> conditionNodes; // node of each condition in its tree
+    std::vector<uint64_t> conditionMasks;
+    std::vector<int> conditionTrees;
+    leafIndex = new int[size * 64];
+    for (int t = 0; t < size; t++)
+    {
+        numberLeaves(t, 0, 0, conditionNodes, conditionMasks, conditionTrees);
+    }
+
+    // sort the conditions by feature, then threshold
+    numConditions = (long)conditionTrees.size();
+    std::vector<long> sorted(numConditions);
+    std::vector<const FlatNode *> nodeOf(numConditions);
+    for (long k = 0; k < numConditions; k++)
+    {
+        sorted[k] = k;
+        nodeOf[k] = trees[conditionTrees[k]]->nodes + conditionNodes[k];
+    }
+    std::sort(sorted.begin(), sorted.end(), [&](long a, long b) {
+        if (nodeOf[a]->feature != nodeOf[b]->feature)
+        {
+            return nodeOf[a]->feature < nodeOf[b]->feature;
+        }
+        return nodeOf[a]->threshold < nodeOf[b]->threshold;
+    });
+
+    featureBegin = new long[d + 1];
+    thresholds = new double[numConditions > 0 ? numConditions : 1];
+    conditionTree = new int[numConditions > 0 ? numConditions : 1];
+    masks = new uint64_t[numConditions > 0 ? numConditions : 1];
+    for (long f = 0; f <= d; f++)
+    {
+        featureBegin[f] = 0;
+    }
+    for (long k = 0; k < numConditions; k++)
+    {
+        const FlatNode *node = nodeOf[sorted[k]];
+        thresholds[k] = node->threshold;
+        conditionTree[k] = conditionTrees[sorted[k]];
+        masks[k] = conditionMasks[sorted[k]];
+        featureBegin[node->feature + 1]++;
+    }
+    for (long f = 0; f < d; f++)
+    {
+        featureBegin[f + 1] += featureBegin[f];
+    }
+}
+
+inline QuickScorer::~QuickScorer()
+{
+    delete[] trees;
+    delete[] featureBegin;
+    delete[] thresholds;
+    delete[] conditionTree;
+    delete[] masks;
+    delete[] leafIndex;
+}
+
+inline int QuickScorer::numberLeaves(int t, long node, int first, std::vector<long> &conditionNodes,
+                                     std::vector<uint64_t> &conditionMasks, std::vector<int> &conditionTrees)
+{
+    FlatNode *nodes = trees[t]->nodes;
+    if (nodes[node].feature < 0)
+    {
+        leafIndex[t * 64 + first] = nodes[node].child;
+        return 1;
+    }
+
+    int left = numberLeaves(t, nodes[node].child, first, conditionNodes, conditionMasks, conditionTrees);
+    int right = numberLeaves(t, nodes[node].child + 1, first + left, conditionNodes, conditionMasks, conditionTrees);
+
+    // going right rules out leaves first, ..., first+left-1
+    conditionNodes.push_back(node);
+    conditionMasks.push_back(~((((uint64_t)1 << left) - 1) << first));
+    conditionTrees.push_back(t);
+    return left + right;
+}
+
+inline bool QuickScorer::supports(FlatTree **trees, int size)
+{
+    for (int t = 0; t < size; t++)
+    {
+        if (trees[t]->numLeaves > 64 || trees[t]->d != trees[0]->d || trees[t]->nol != trees[0]->nol)
+        {
+            return false;
+        }
+        for (long k = 0; k < trees[t]->numNodes; k++)
+        {
+            double threshold = trees[t]->nodes[k].threshold;
+            if (trees[t]->nodes[k].feature >= 0 && threshold != threshold)
+            {
+                return false; // cannot be sorted
+            }
+        }
+    }
+    return size > 0;
+}
+
+inline void QuickScorer::addVotes(const double *X, long n, long num, double *votes, uint64_t *bitvectors)
+{
+    long done = 0;
+    if (simdLevel() >= SIMD_AVX512)
+    {
+        done = addVotesAVX512(X, n, num, votes, bitvectors);
+    }
+
+    for (long i = done; i < num; i++)
+    {
+        for (int t = 0; t < size; t++)
+        {
+            bitvectors[t * 8] = ~(uint64_t)0;
+        }
+        for (long f = 0; f < d; f++)
+        {
+            double value = X[i + f * n];
+            long end = featureBegin[f + 1];
+            // the instance goes right where !(value <= threshold); NaN goes right everywhere
+            for (long k = featureBegin[f]; k < end && !(value <= thresholds[k]); k++)
+            {
+                bitvectors[conditionTree[k] * 8] &= masks[k];
+            }
+        }
+        addLeafVotes(i, 1, votes, bitvectors);
+    }
+}
+
+inline void QuickScorer::addLeafVotes(long begin, long num, double *votes, uint64_t *bitvectors)
+{
+    // accumulate in tree order, as the traversal does
+    for (long i = 0; i < num; i++)
+    {
+        double *vote = votes + (begin + i) * nol;
+        for (int t = 0; t < size; t++)
+        {
+            long leaf = leafIndex[t * 64 + lowestBit(bitvectors[t * 8 + i])];
+            trees[t]->addLeafP(leaf, vote);
+        }
+    }
+}
+
+#ifdef DF_SIMD_X86
+
+__attribute__((target("avx512f"))) inline long QuickScorer::addVotesAVX512(
+    const double *X, long n, long num, double *votes, uint64_t *bitvectors)
+{
+    const __m512i ones = _mm512_set1_epi64(-1);
+    long i = 0;
+    for (; i + 8 <= num; i += 8)
+    {
+        for (int t = 0; t < size; t++)
+        {
+            _mm512_storeu_si512((void *)(bitvectors + t * 8), ones);
+        }
+        for (long f = 0; f < d; f++)
+        {
+            __m512d value = _mm512_loadu_pd(X + i + f * n);
+            long end = featureBegin[f + 1];
+            for (long k = featureBegin[f]; k < end; k++)
+            {
+                // lanes going right: !(value <= threshold), true for NaN
+                __mmask8 right = _mm512_cmp_pd_mask(value, _mm512_set1_pd(thresholds[k]), _CMP_NLE_UQ);
+                if (right == 0)
+                {
+                    break;
+                }
+                uint64_t *bitvector = bitvectors + conditionTree[k] * 8;
+                __m512i v = _mm512_loadu_si512((const void *)bitvector);
+                v = _mm512_mask_and_epi64(v, right, v, _mm512_set1_epi64((long long)masks[k]));
+                _mm512_storeu_si512((void *)bitvector, v);
+            }
+        }
+        addLeafVotes(i, 8, votes, bitvectors);
+    }
+    return i;
+}
+
+#else
+
+inline long QuickScorer::addVotesAVX512(const double *, long, long, double *, uint64_t *)
+{
+    return 0;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,138 @@
+/**
+ * @file Random.h
+ * @brief C++ implementation of a seedable random number generator.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @class Random
+ * @brief Class for a small, fast random number generator.
+ *
+ * Implemented functionalities:
+ *   1. Generate 64-bit numbers with xoshiro256** (Blackman and Vigna).
+ *   2. Generate doubles in [0, 1) and integers in [0, n).
+ *   3. Seed independent streams from one seed and a stream number, so
+ *      that each tree, or each node of a tree, has its own generator.
+ *
+ * The state is expanded from the seed and stream with splitmix64. A
+ * generator has no shared state, so generators used by different threads
+ * give the same numbers however the threads are scheduled.
+ */
+
+#ifndef Random_H
+#define Random_H
+
+#include <stdint.h>
+#include <chrono>
+#include <random>
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+class Random
+{
+private:
+    uint64_t state[4];
+
+public:
+    Random(uint64_t seed = 0, uint64_t stream = 0);
+    void setSeed(uint64_t seed, uint64_t stream = 0);
+
+    uint64_t next();    // 64 random bits
+    double uniform();   // uniform in [0, 1)
+    long below(long n); // uniform integer in [0, n), n > 0
+
+    static uint64_t mix(uint64_t x); // splitmix64 finalizer
+    static uint64_t randomSeed();    // a different seed for every call
+};
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+inline Random::Random(uint64_t seed, uint64_t stream)
+{
+    setSeed(seed, stream);
+}
+
+inline void Random::setSeed(uint64_t seed, uint64_t stream)
+{
+    uint64_t x = mix(seed) ^ mix(stream + 0x632be59bd9b4e019ULL);
+    for (int i = 0; i < 4; i++)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        state[i] = mix(x);
+    }
+}
+
+inline uint64_t Random::mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline uint64_t Random::next()
+{
+    uint64_t s1 = state[1] * 5;
+    uint64_t result = ((s1 << 7) | (s1 >> 57)) * 9;
+    uint64_t t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = (state[3] << 45) | (state[3] >> 19);
+    return result;
+}
+
+inline double Random::uniform()
+{
+    // the top 53 bits, scaled by 2^-53
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+inline long Random::below(long n)
+{
+    // reject the low end of the range so that all results are equally likely
+    uint64_t range = (uint64_t)n;
+    uint64_t threshold = (0 - range) % range;
+    while (true)
+    {
+        uint64_t x = next();
+        if (x >= threshold)
+        {
+            return (long)(x % range);
+        }
+    }
+}
+
+inline uint64_t Random::randomSeed()
+{
+    std::random_device device;
+    uint64_t seed = ((uint64_t)device() << 32) ^ device();
+    seed ^= (uint64_t)std::chrono::high_resolution_clock::now().time_since_epoch().count();
+    return mix(seed);
+}
+
+#endif
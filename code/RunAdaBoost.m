@@ -4,9 +4,13 @@ function [Y, P] = RunAdaBoost(X, forestPath)
 %   Usage:
 %       [Y, P] = RunAdaBoost(X, forestPath)
 %
+%   An ensemble trained by the compiled TrainAdaBoost.cpp is one binary
+%   model file holding the trees and their weights; one trained by
+%   TrainAdaBoost.m is a folder of tree files with weights.mat.
+%
 %   Inputs:
 %       X           - n*d matrix, testing data.
-%       forestPath  - String, the folder path where the ensemble is saved.
+%       forestPath  - String, the model file or the folder of the ensemble.
 %
 %   Outputs:
 %       Y           - n*1 vector, decision labels.
@@ -31,6 +35,17 @@ function [Y, P] = RunAdaBoost(X, forestPath)
 %       and Lighting Applications".
 %       Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
 
+if exist(forestPath, 'file') == 2
+    if exist('DecisionModel', 'file') == 3
+        handle = DecisionModel('load', forestPath);
+        [Y, P] = DecisionModel('run', handle, X);
+        DecisionModel('release', handle);
+    else
+        [Y, P] = RunDecisionTree(X, forestPath);
+    end
+    return;
+end
+
 % Load weights
 weightsFile = fullfile(forestPath, 'weights.mat');
 if exist(weightsFile, 'file')
@@ -6,7 +6,8 @@ function [Y, P] = RunDecisionForest(X, forestPath)
 %
 %   Inputs:
 %       X           - n*d matrix, testing data, each row is one instance.
-%       forestPath  - String, the folder path where the forest is saved.
+%       forestPath  - String, the folder path where the forest is saved, or
+%                     the file path of a forest saved in binary format.
 %
 %   Outputs:
 %       Y           - n*1 vector, decision labels for each instance.
@@ -34,6 +35,21 @@ function [Y, P] = RunDecisionForest(X, forestPath)
 %       and Lighting Applications".
 %       Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
 
+% the compiled DecisionModel runs all trees together, a block of rows at a
+% time, without one n*nol matrix per tree
+if exist('DecisionModel', 'file') == 3
+    handle = DecisionModel('load', forestPath);
+    [Y, P] = DecisionModel('run', handle, X);
+    DecisionModel('release', handle);
+    return;
+end
+
+% a forest saved in binary format is one file
+if exist(forestPath, 'file') == 2
+    [Y, P] = RunDecisionTree(X, forestPath);
+    return;
+end
+
 treeFiles=dir([forestPath '/*.tree']);
 
 forestSize=length(treeFiles);
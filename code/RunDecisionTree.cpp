@@ -25,7 +25,8 @@
  * usage:
  *     [Y,P]=RunDecisionTree(X,path)
  *       X: n*d testing data, each row is one instance, double
- *       path: the file path of the resulting tree
+ *       path: the file path of the tree, in text format, or in binary format
+ *           which may also hold a whole forest, whose probabilities are averaged
  *       Y: n*1 decision labels, each row is one instance, each number is an integer between 1 and nol
  *       P: n*nol probabilities
  */
@@ -35,11 +36,13 @@
 #include <cstdio>
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include "DecisionTree.h"
+#include "ModelFile.h"
 
-/* the gateway function */
-void mexFunction(int nlhs, mxArray *plhs[],
-                 int nrhs, const mxArray *prhs[])
+/* the work of the gateway function */
+static void runDecisionTree(int nlhs, mxArray *plhs[],
+                            int nrhs, const mxArray *prhs[])
 {
     double *X;
     double *Y;
@@ -70,8 +73,19 @@ void mexFunction(int nlhs, mxArray *plhs[],
     /*  get path */
     path = mxArrayToString(prhs[1]);
 
+    /*  binary model files are mapped instead of parsed */
+    if (ModelFile::isModelFile(path))
+    {
+        std::unique_ptr<ModelFile> model(new ModelFile(path));
+        plhs[0] = mxCreateDoubleMatrix(n, 1, mxREAL);
+        plhs[1] = mxCreateDoubleMatrix(n, model->nol, mxREAL);
+        model->runDecision(X, mxGetPr(plhs[0]), mxGetPr(plhs[1]), n, d);
+        mxFree(path);
+        return;
+    }
+
     /*  call the C++ subroutine */
-    Tree *tree = new Tree(path);
+    std::unique_ptr<Tree> tree(new Tree(path));
 
     /*  set the output pointers to the output matrix */
     plhs[0] = mxCreateDoubleMatrix(n, 1, mxREAL);
@@ -84,7 +98,21 @@ void mexFunction(int nlhs, mxArray *plhs[],
     /*  call the C++ subroutine */
     tree->runDecision(X, Y, P, n, d);
 
-    delete tree;
+    mxFree(path);
 
     return;
 }
+
+/* the gateway function, reporting errors of the library as MATLAB errors */
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    try
+    {
+        runDecisionTree(nlhs, plhs, nrhs, prhs);
+    }
+    catch (const Error &e)
+    {
+        mexErrMsgIdAndTxt("MATLAB:RunDecisionTree:error", "%s", e.what());
+    }
+}
@@ -0,0 +1,52 @@
+function SaveColumnFile(X, path)
+%SaveColumnFile Saves training data as a column file.
+%
+%   A column file holds the training data on disk, column by column, so
+%   that TrainDecisionTree and TrainDecisionForest can train from it
+%   without loading it: pass the path of the file instead of X. The file
+%   starts with a 64-byte header, followed by X as little-endian doubles,
+%   in the same column-major order as in memory.
+%
+%   Larger files can be written a chunk of rows at a time with the
+%   ColumnFileWriter class of DataSource.h.
+%
+%   Usage:
+%       SaveColumnFile(X, path)
+%
+%   Inputs:
+%       X    - n*d matrix, training data, each row is one instance.
+%       path - String, the path of the column file.
+%
+%   See also TrainDecisionTree, TrainDecisionForest.
+
+%   Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>
+%   Signal Analysis and Machine Perception Laboratory
+%   Department of Electrical, Computer, and Systems Engineering
+%   Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+%
+%   Related publications:
+%   [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim, 
+%       "Tracking Tetrahymena Pyriformis Cells using Decision Trees", 
+%       2012 21st International Conference on Pattern Recognition (ICPR), 
+%       Pages 1843-1847, 11-15 Nov. 2012.
+%   [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua 
+%       Kevin Zhou, "Semantic Context Forests for Learning-Based Knee 
+%       Cartilage Segmentation in 3D MR Images", 
+%       MICCAI 2013: Workshop on Medical Computer Vision.
+%   [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+%       and Lighting Applications".
+%       Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+
+fid = fopen(path, 'w', 'ieee-le');
+if fid < 0
+    error('SaveColumnFile:cannotOpen', 'Cannot open %s.', path);
+end
+
+% header: magic, version, reserved, n, d, reserved
+fwrite(fid, ['DFCOLS' 0 0], 'uint8');
+fwrite(fid, [1 0], 'uint32');
+fwrite(fid, size(X), 'uint64');
+fwrite(fid, zeros(1, 4), 'uint64');
+
+fwrite(fid, double(X), 'double');
+fclose(fid);
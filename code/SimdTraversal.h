@@ -0,0 +1,330 @@
+/**
+ * @file SimdTraversal.h
+ * @brief SIMD implementation of compiled tree traversal.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @brief Functions to walk several instances through one FlatTree at once.
+ *
+ * Each lane of a vector follows one instance: the lane gathers its node's
+ * threshold, feature and child from the node array, gathers the instance's
+ * feature value, and moves to the left or right child with one vector
+ * compare. Lanes that reached a leaf stay there until all lanes have. Two
+ * independent vectors are walked together to hide the latency of gathers.
+ *
+ * AVX2 walks 2 x 4 instances at a time and AVX-512 walks 2 x 8. With
+ * AVX-512, the first 16 nodes are also kept in registers and looked up by
+ * permutes instead of gathers, as all lanes start at the top of the tree.
+ *
+ * The level is detected at run time, so the package is built without any
+ * -m flag. By default AVX-512 is used where supported, and the scalar
+ * FlatTree::findLeaf() elsewhere: AVX2 gathers were measured slower than
+ * the scalar walk, so AVX2 is only used if chosen by setSimdLevel(), or by
+ * the --simd option of dforest predict and BenchmarkSuite. The compare is
+ * the ordered "<=" of the scalar code, so NaN goes right, and all levels
+ * give results bit-identical to decideTree().
+ *
+ * This header is included by DecisionTree.h after FlatNode is declared.
+ */
+
+#ifndef SimdTraversal_H
+#define SimdTraversal_H
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define DF_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+enum SimdLevel
+{
+    SIMD_SCALAR = 0,
+    SIMD_AVX2 = 1,
+    SIMD_AVX512 = 2
+};
+
+int supportedSimdLevel(); // best level supported by the CPU
+int simdLevel();          // level used for traversal
+
+/**
+ * @brief Choose the level used for traversal, e.g. SIMD_SCALAR to compare
+ * against the scalar code. Levels not supported by the CPU are lowered.
+ */
+void setSimdLevel(int level);
+
+const char *simdLevelName(int level);    // "scalar", "avx2" or "avx512"
+int simdLevelOfName(const char *name);   // level of a name, -1 if unknown
+
+/**
+ * @brief Find the leaves of num instances with vectors.
+ * Instance i has feature f at x[i * rowStride + f * featureStride].
+ * @return Number of instances done; the rest are left to the scalar code.
+ */
+long findLeavesAVX2(const FlatNode *nodes, long numNodes, const double *x,
+                    long rowStride, long featureStride, long num, int *leaves);
+long findLeavesAVX512(const FlatNode *nodes, long numNodes, const double *x,
+                      long rowStride, long featureStride, long num, int *leaves);
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+inline int supportedSimdLevel()
+{
+    static int level = -1;
+    if (level < 0)
+    {
+        int detected = SIMD_SCALAR;
+#ifdef DF_SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            detected = SIMD_AVX2;
+        }
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            detected = SIMD_AVX512;
+        }
+#endif
+        level = detected;
+    }
+    return level;
+}
+
+inline int &simdSetting()
+{
+    static int level = supportedSimdLevel() >= SIMD_AVX512 ? SIMD_AVX512 : SIMD_SCALAR;
+    return level;
+}
+
+inline int simdLevel()
+{
+    return simdSetting();
+}
+
+inline void setSimdLevel(int level)
+{
+    int supported = supportedSimdLevel();
+    simdSetting() = level < SIMD_SCALAR ? SIMD_SCALAR : (level > supported ? supported : level);
+}
+
+inline const char *simdLevelName(int level)
+{
+    const char *names[] = {"scalar", "avx2", "avx512"};
+    return names[level < SIMD_SCALAR ? SIMD_SCALAR : (level > SIMD_AVX512 ? SIMD_AVX512 : level)];
+}
+
+inline int simdLevelOfName(const char *name)
+{
+    for (int level = SIMD_SCALAR; level <= SIMD_AVX512; level++)
+    {
+        if (strcmp(name, simdLevelName(level)) == 0)
+        {
+            return level;
+        }
+    }
+    return -1;
+}
+
+#ifdef DF_SIMD_X86
+
+#if defined(__GNUC__) && !defined(__clang__)
+// the AVX-512 intrinsics of GCC start from self-initialized vectors
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx2"))) inline long findLeavesAVX2(
+    const FlatNode *nodes, long, const double *x,
+    long rowStride, long featureStride, long num, int *leaves)
+{
+    // features are multiplied with 32-bit lane products
+    if (featureStride < 0 || featureStride > 0x7fffffffL)
+    {
+        return 0;
+    }
+
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i low = _mm256_set1_epi64x(0xffffffffLL);
+    const __m256i stride = _mm256_set1_epi64x(featureStride);
+    const char *base = (const char *)nodes;
+    long long child[4];
+
+    long i = 0;
+    for (; i + 8 <= num; i += 8)
+    {
+        __m256i node[2], row[2], info[2];
+        for (int g = 0; g < 2; g++)
+        {
+            long k = i + 4 * g;
+            node[g] = _mm256_setzero_si256();
+            row[g] = _mm256_set_epi64x((k + 3) * rowStride, (k + 2) * rowStride,
+                                       (k + 1) * rowStride, k * rowStride);
+        }
+        for (bool done = false; !done;)
+        {
+            done = true;
+            for (int g = 0; g < 2; g++)
+            {
+                // FlatNode is 16 bytes: threshold, then feature and child
+                __m256i offset = _mm256_slli_epi64(node[g], 4);
+                info[g] = _mm256_i64gather_epi64((const long long *)(base + 8), offset, 1);
+                __m256i feature = _mm256_and_si256(info[g], low);
+                __m256i leaf = _mm256_cmpeq_epi64(feature, low); // feature == -1
+                done &= _mm256_movemask_pd(_mm256_castsi256_pd(leaf)) == 0xf;
+                __m256i active = _mm256_xor_si256(leaf, _mm256_set1_epi64x(-1));
+
+                __m256d threshold = _mm256_i64gather_pd((const double *)base, offset, 1);
+                __m256i index = _mm256_add_epi64(row[g], _mm256_mul_epu32(feature, stride));
+                __m256d value = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), x, index,
+                                                         _mm256_castsi256_pd(active), 8);
+
+                // left child if value <= threshold (all ones, i.e. -1), else right
+                __m256i le = _mm256_castpd_si256(_mm256_cmp_pd(value, threshold, _CMP_LE_OQ));
+                __m256i next = _mm256_add_epi64(_mm256_add_epi64(_mm256_srli_epi64(info[g], 32), one), le);
+                node[g] = _mm256_blendv_epi8(node[g], next, active);
+            }
+        }
+        for (int g = 0; g < 2; g++)
+        {
+            _mm256_storeu_si256((__m256i *)child, _mm256_srli_epi64(info[g], 32));
+            for (int j = 0; j < 4; j++)
+            {
+                leaves[i + 4 * g + j] = (int)child[j];
+            }
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx512f"))) inline long findLeavesAVX512(
+    const FlatNode *nodes, long numNodes, const double *x,
+    long rowStride, long featureStride, long num, int *leaves)
+{
+    // features are multiplied with 32-bit lane products
+    if (featureStride < 0 || featureStride > 0x7fffffffL)
+    {
+        return 0;
+    }
+
+    const __m512i one = _mm512_set1_epi64(1);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i top = _mm512_set1_epi64(16);
+    const __m512i stride = _mm512_set1_epi64(featureStride);
+    const char *base = (const char *)nodes;
+
+    // the first 16 nodes, to be looked up by permutes
+    long long topInfo[16];
+    double topThreshold[16];
+    for (int k = 0; k < 16; k++)
+    {
+        topInfo[k] = -1;
+        topThreshold[k] = 0;
+        if (k < numNodes)
+        {
+            memcpy(topInfo + k, base + 16 * k + 8, 8);
+            topThreshold[k] = nodes[k].threshold;
+        }
+    }
+    const __m512i info0 = _mm512_loadu_si512((const void *)topInfo);
+    const __m512i info1 = _mm512_loadu_si512((const void *)(topInfo + 8));
+    const __m512d threshold0 = _mm512_loadu_pd(topThreshold);
+    const __m512d threshold1 = _mm512_loadu_pd(topThreshold + 8);
+
+    long i = 0;
+    for (; i + 16 <= num; i += 16)
+    {
+        __m512i node[2], row[2], child[2];
+        for (int g = 0; g < 2; g++)
+        {
+            long k = i + 8 * g;
+            node[g] = zero;
+            row[g] = _mm512_set_epi64((k + 7) * rowStride, (k + 6) * rowStride,
+                                      (k + 5) * rowStride, (k + 4) * rowStride,
+                                      (k + 3) * rowStride, (k + 2) * rowStride,
+                                      (k + 1) * rowStride, k * rowStride);
+        }
+        for (bool done = false; !done;)
+        {
+            done = true;
+            for (int g = 0; g < 2; g++)
+            {
+                __m512i info;
+                __m512d threshold;
+                if (_mm512_cmplt_epu64_mask(node[g], top) == 0xff)
+                {
+                    info = _mm512_permutex2var_epi64(info0, node[g], info1);
+                    threshold = _mm512_permutex2var_pd(threshold0, node[g], threshold1);
+                }
+                else
+                {
+                    // FlatNode is 16 bytes: threshold, then feature and child
+                    __m512i offset = _mm512_slli_epi64(node[g], 4);
+                    info = _mm512_i64gather_epi64(offset, base + 8, 1);
+                    threshold = _mm512_i64gather_pd(offset, base, 1);
+                }
+                __m512i feature = _mm512_srai_epi64(_mm512_slli_epi64(info, 32), 32);
+                __mmask8 active = _mm512_cmpge_epi64_mask(feature, zero);
+                child[g] = _mm512_srli_epi64(info, 32);
+                done &= active == 0;
+
+                __m512i index = _mm512_add_epi64(row[g], _mm512_mul_epu32(feature, stride));
+                __m512d value = _mm512_mask_i64gather_pd(_mm512_setzero_pd(), active, index, x, 8);
+
+                // right child is child + 1, left child if value <= threshold
+                __mmask8 le = _mm512_cmp_pd_mask(value, threshold, _CMP_LE_OQ);
+                __m512i next = _mm512_add_epi64(child[g], one);
+                next = _mm512_mask_sub_epi64(next, le, next, one);
+                node[g] = _mm512_mask_mov_epi64(node[g], active, next);
+            }
+        }
+        for (int g = 0; g < 2; g++)
+        {
+            _mm256_storeu_si256((__m256i *)(leaves + i + 8 * g), _mm512_cvtepi64_epi32(child[g]));
+        }
+    }
+    return i;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#else
+
+inline long findLeavesAVX2(const FlatNode *, long, const double *, long, long, long, int *)
+{
+    return 0;
+}
+
+inline long findLeavesAVX512(const FlatNode *, long, const double *, long, long, long, int *)
+{
+    return 0;
+}
+
+#endif
+
+#endif
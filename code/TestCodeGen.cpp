@@ -0,0 +1,165 @@
+/**
+ * @file TestCodeGen.cpp
+ * @brief Test of generated C++ predictors against runDecision.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * A standalone program, not a MEX file. It trains a tree, a forest and an
+ * AdaBoost ensemble on
+ * synthetic data, writes each as C++ source with CodeGen (the forest also
+ * with node tables instead of branches), builds the
+ * source into a shared library, loads it, and checks that the generated
+ * predict() gives the same Y and P as runDecision(), bit for bit, on
+ * testing data with some NaN features. It returns 0 if all checks pass.
+ *
+ * Compile and run (on Windows, name the libraries *.dll):
+ *     g++ -O2 -std=c++11 -pthread TestCodeGen.cpp -o TestCodeGen -ldl
+ *     ./TestCodeGen [compiler] [folder]
+ */
+
+#include <chrono>
+#include <random>
+#include "DecisionTree.h"
+#include "AdaBoost.h"
+#include "CodeGen.h"
+
+static double seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Synthetic data: Gaussian features, and one of 3 labels from the
+ * signs of the first two features. With missing, every 17th value is NaN.
+ */
+static void makeData(double *X, int *Y, long n, long d, unsigned seed, bool missing)
+{
+    std::mt19937 generator(seed);
+    std::normal_distribution<double> normal;
+    for (long i = 0; i < n * d; i++)
+    {
+        X[i] = normal(generator);
+    }
+    for (long i = 0; i < n; i++)
+    {
+        Y[i] = (X[i] > 0 && X[i + n] > 0) ? 1 : ((X[i] <= 0 && X[i + n] <= 0) ? 2 : 3);
+    }
+    for (long i = 0; missing && i < n * d; i += 17)
+    {
+        X[i] = NAN;
+    }
+}
+
+/**
+ * @brief Write, build and load the trees, and compare with runDecision.
+ */
+static bool check(const char *name, FlatTree **trees, int numTrees, const double *weights, double *X, long n,
+                  long d, const char *compiler, std::string folder, int branchDepth = CodeGen::maxBranchDepth)
+{
+    std::string source = folder + "/" + name + ".cpp";
+#ifdef _WIN32
+    std::string library = folder + "/" + name + ".dll";
+#else
+    std::string library = folder + "/" + name + ".so";
+#endif
+    CodeGen::writeSource((char *)source.c_str(), trees, numTrees, weights, branchDepth);
+    if (!CodeGen::compileSource(source.c_str(), library.c_str(), compiler))
+    {
+        printf("%s: FAIL, cannot compile %s\n", name, source.c_str());
+        return false;
+    }
+    CompiledModel model(library.c_str());
+
+    FlatForest forest(trees, numTrees, weights);
+    int nol = forest.nol;
+    double *Y1 = new double[n];
+    double *P1 = new double[n * nol];
+    double *Y2 = new double[n];
+    double *P2 = new double[n * nol];
+
+    double start = seconds();
+    forest.runDecision(X, Y1, P1, n, d);
+    double elapsed1 = seconds() - start;
+    start = seconds();
+    model.runDecision(X, Y2, P2, n, d);
+    double elapsed2 = seconds() - start;
+
+    bool pass = model.d == d && model.nol == nol &&
+                memcmp(Y1, Y2, n * sizeof(double)) == 0 && memcmp(P1, P2, n * nol * sizeof(double)) == 0;
+    printf("%s: %s, runDecision %.1f ns/row, generated %.1f ns/row\n", name, pass ? "PASS" : "FAIL",
+           elapsed1 * 1e9 / n, elapsed2 * 1e9 / n);
+
+    delete[] Y1;
+    delete[] P1;
+    delete[] Y2;
+    delete[] P2;
+    return pass;
+}
+
+int main(int argc, char **argv)
+{
+    const char *compiler = argc > 1 ? argv[1] : "c++";
+    std::string folder = argc > 2 ? argv[2] : ".";
+
+    long n = 20000, d = 10;
+    double *X = new double[n * d];
+    int *Y = new int[n];
+    makeData(X, Y, n, d, 1, false);
+    Data data(X, Y, n, d);
+
+    long testN = 50000;
+    double *testX = new double[testN * d];
+    int *testY = new int[testN];
+    makeData(testX, testY, testN, d, 2, true);
+
+    bool pass = true;
+
+    Tree tree(10, 50);
+    tree.trainTree(&data);
+    FlatTree *flat = tree.getFlat();
+    pass = check("TestCodeGenTree", &flat, 1, NULL, testX, testN, d, compiler, folder) && pass;
+
+    Forest forest(20, 6, 50);
+    forest.trainForest(&data);
+    FlatTree *flats[20];
+    for (int i = 0; i < 20; i++)
+    {
+        flats[i] = forest.getTree(i)->getFlat();
+    }
+    pass = check("TestCodeGenForest", flats, 20, NULL, testX, testN, d, compiler, folder) && pass;
+    pass = check("TestCodeGenTable", flats, 20, NULL, testX, testN, d, compiler, folder, 0) && pass;
+
+    AdaBoost boost(10, 3, 50);
+    boost.trainBoost(&data);
+    for (int i = 0; i < 10; i++)
+    {
+        flats[i] = boost.getTree(i)->getFlat();
+    }
+    pass = check("TestCodeGenBoost", flats, 10, boost.getAlphas(), testX, testN, d, compiler, folder) && pass;
+
+    delete[] X;
+    delete[] Y;
+    delete[] testX;
+    delete[] testY;
+    return pass ? 0 : 1;
+}
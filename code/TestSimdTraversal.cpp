@@ -0,0 +1,242 @@
+/**
+ * @file TestSimdTraversal.cpp
+ * @brief Test of every SIMD level of tree traversal against decideTree.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * A standalone program, not a MEX file. It trains a tree and a forest with
+ * fixed seeds on synthetic data, and for every SIMD level the CPU
+ * supports, forced with setSimdLevel(), runs them on testing data with
+ * some NaN features:
+ *   - Tree::runDecision() and FlatForest::runStrided() on row-major data
+ *     must decide the leaf decideTree() decides for every row, and
+ *   - every level must give Y and P bit-identical to the scalar level,
+ *     with both forest engines and with the compact forests of
+ *     CompactModel.h, and
+ *   - the tree made compact with 16-bit codes must decide as the tree.
+ * Levels the CPU does not support are reported as skipped. It returns 0 if
+ * all checks pass.
+ *
+ * Compile and run:
+ *     g++ -O2 -std=c++11 -pthread TestSimdTraversal.cpp -o TestSimdTraversal
+ *     ./TestSimdTraversal
+ */
+
+#include <random>
+#include "DecisionTree.h"
+#include "CompactModel.h"
+
+/**
+ * @brief Synthetic data: Gaussian features, and one of 3 labels from the
+ * signs of the first two features. With missing, every 13th value is NaN.
+ */
+static void makeData(double *X, int *Y, long n, long d, unsigned seed, bool missing)
+{
+    std::mt19937 generator(seed);
+    std::normal_distribution<double> normal;
+    for (long i = 0; i < n * d; i++)
+    {
+        X[i] = normal(generator);
+    }
+    for (long i = 0; i < n; i++)
+    {
+        Y[i] = (X[i] > 0 && X[i + n] > 0) ? 1 : ((X[i] <= 0 && X[i + n] <= 0) ? 2 : 3);
+    }
+    for (long i = 0; missing && i < n * d; i += 13)
+    {
+        X[i] = NAN;
+    }
+}
+
+/**
+ * @brief Check Y and P of one tree against the leaf decideTree() reaches:
+ * its first label of largest weight, and its weights normalized.
+ */
+static bool checkTree(Tree *tree, const double *X, const double *Y, const double *P, long n, long d)
+{
+    int nol = tree->nol;
+    std::vector<double> x(d);
+    for (long i = 0; i < n; i++)
+    {
+        for (long f = 0; f < d; f++)
+        {
+            x[f] = X[i + f * n];
+        }
+        TreeNode *leaf = tree->decideTree(0, x.data());
+        double sum = 0, maxP = 0;
+        int label = 1;
+        for (int k = 0; k < leaf->numParams; k++)
+        {
+            sum += leaf->param[k];
+        }
+        std::vector<double> p(nol, 0);
+        for (int k = 0; k < leaf->numParams; k++)
+        {
+            p[leaf->labels[k]] = leaf->param[k] / sum;
+            if (p[leaf->labels[k]] > maxP)
+            {
+                maxP = p[leaf->labels[k]];
+                label = leaf->labels[k] + 1;
+            }
+        }
+        if (Y[i] != label)
+        {
+            return false;
+        }
+        for (int j = 0; j < nol; j++)
+        {
+            if (fabs(P[i + j * n] - p[j]) > 1e-9)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Check the forest's P, the average of its trees' P, against the
+ * trees run alone.
+ */
+static bool checkForest(Forest *forest, const double *X, const double *P, long n, long d)
+{
+    int nol = forest->nol;
+    std::vector<double> sum(n * nol, 0), treeY(n), treeP(n * nol);
+    for (int t = 0; t < forest->forestSize(); t++)
+    {
+        Tree *tree = forest->getTree(t);
+        tree->runDecision((double *)X, treeY.data(), treeP.data(), n, d);
+        if (!checkTree(tree, X, treeY.data(), treeP.data(), n, d))
+        {
+            return false;
+        }
+        for (long k = 0; k < n * nol; k++)
+        {
+            sum[k] += treeP[k];
+        }
+    }
+    for (long k = 0; k < n * nol; k++)
+    {
+        if (fabs(P[k] - sum[k] / forest->forestSize()) > 1e-9)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    long n = 20000, d = 10;
+    std::vector<double> X(n * d);
+    std::vector<int> Y(n);
+    makeData(X.data(), Y.data(), n, d, 1, false);
+    Data data(X.data(), Y.data(), n, d);
+
+    long testN = 5000;
+    std::vector<double> testX(testN * d), rowMajor(testN * d);
+    std::vector<int> testY(testN);
+    makeData(testX.data(), testY.data(), testN, d, 2, true);
+    for (long i = 0; i < testN; i++)
+    {
+        for (long f = 0; f < d; f++)
+        {
+            rowMajor[i * d + f] = testX[i + f * testN];
+        }
+    }
+
+    Tree tree(12, 50, 1);
+    tree.trainTree(&data);
+    Forest forest(16, 6, 50, 2);
+    forest.trainForest(&data);
+    std::vector<FlatTree *> flats;
+    for (int t = 0; t < forest.forestSize(); t++)
+    {
+        flats.push_back(forest.getTree(t)->getFlat());
+    }
+
+    int nol = forest.nol;
+    std::vector<double> scalarY[5], scalarP[5];
+    bool pass = true;
+    for (int level = SIMD_SCALAR; level <= SIMD_AVX512; level++)
+    {
+        if (level > supportedSimdLevel())
+        {
+            printf("%s: SKIP, not supported by this CPU\n", simdLevelName(level));
+            continue;
+        }
+        setSimdLevel(level);
+        bool levelPass = simdLevel() == level;
+
+        // the tree, column-major as the MEX functions pass it
+        std::vector<double> treeY(testN), treeP(testN * tree.nol);
+        tree.runDecision(testX.data(), treeY.data(), treeP.data(), testN, d);
+        levelPass = checkTree(&tree, testX.data(), treeY.data(), treeP.data(), testN, d) && levelPass;
+
+        // the forest, row-major, with each engine
+        std::vector<double> outY[5], outP[5];
+        outY[0] = treeY;
+        outP[0] = treeP;
+        for (int engine = ENGINE_TRAVERSAL; engine <= ENGINE_QUICKSCORER; engine++)
+        {
+            FlatForest flat(flats.data(), (int)flats.size());
+            flat.setEngine(engine);
+            outY[engine].resize(testN);
+            outP[engine].resize(testN * nol);
+            flat.runStrided(rowMajor.data(), d, 1, outY[engine].data(), outP[engine].data(), testN, d);
+            levelPass = checkForest(&forest, testX.data(), outP[engine].data(), testN, d) && levelPass;
+        }
+
+        // compact forests with each kind of thresholds
+        FlatForest flat(flats.data(), (int)flats.size());
+        for (int mode = COMPACT_FLOAT32; mode <= COMPACT_UINT16; mode++)
+        {
+            CompactForest compact(&flat, mode, COMPACT_PROBABILITY);
+            outY[3 + mode].resize(testN);
+            outP[3 + mode].resize(testN * nol);
+            compact.runDecision(testX.data(), outY[3 + mode].data(), outP[3 + mode].data(), testN, d);
+        }
+
+        // 16-bit codes are exact: a one-tree compact forest voting with its
+        // leaf labels decides as the tree
+        FlatTree *treeFlat = tree.getFlat();
+        FlatForest single(&treeFlat, 1);
+        CompactForest coded(&single, COMPACT_UINT16, COMPACT_ARGMAX);
+        std::vector<double> codedY(testN), codedP(testN * tree.nol);
+        coded.runDecision(testX.data(), codedY.data(), codedP.data(), testN, d);
+        levelPass = codedY == treeY && levelPass;
+
+        for (int k = 0; k < 5; k++)
+        {
+            if (level == SIMD_SCALAR)
+            {
+                scalarY[k] = outY[k];
+                scalarP[k] = outP[k];
+            }
+            levelPass = outY[k] == scalarY[k] && outP[k] == scalarP[k] && levelPass;
+        }
+        printf("%s: %s\n", simdLevelName(level), levelPass ? "PASS" : "FAIL");
+        pass = levelPass && pass;
+    }
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,287 @@
+/**
+ * @file ThreadPool.h
+ * @brief C++ implementation of a minimal thread pool.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * @brief Class for running indexed tasks on a pool of threads.
+ *
+ * Implemented functionalities:
+ *   1. Run tasks 0, 1, ..., num-1 on at most size() threads.
+ *   2. Balance tasks of different cost: each worker claims the next
+ *      unclaimed index when it finishes its current task.
+ *   3. Rethrow the first exception thrown by a task in the caller.
+ *
+ * The worker threads are created once per process, the first time they
+ * are needed, and wait on a queue of runs between tasks; a ThreadPool only
+ * limits how many of them join each of its runs, so it is cheap to make
+ * one per call. The calling thread is one of the workers and claims tasks
+ * like the others, so a run finishes even if every worker is busy, and a
+ * task may itself run tasks on a ThreadPool. A pool of size 1 runs all
+ * tasks serially on the caller.
+ */
+
+#ifndef ThreadPool_H
+#define ThreadPool_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**********************************************
+ * Declaration part
+ **********************************************/
+
+class ThreadPool
+{
+private:
+    int numThreads; // number of threads of each run, including the caller
+
+    /**
+     * @brief One run: its tasks, and the workers that joined it.
+     */
+    class Job
+    {
+    public:
+        void (*invoke)(void *task, long i); // calls the task of index i
+        void *task;
+        long num;                // number of tasks
+        std::atomic<long> next;  // next unclaimed task
+        int helpers;             // workers that may still join
+        int active;              // workers in the run, guarded by the workers' lock
+        std::exception_ptr error; // first exception, guarded by errorLock
+        std::mutex errorLock;
+
+        void work(); // claim and run tasks until none is left
+    };
+
+    /**
+     * @brief The worker threads shared by all pools.
+     */
+    class Workers
+    {
+    public:
+        std::mutex lock;
+        std::condition_variable wake;     // a job was queued, or stopping
+        std::condition_variable finished; // a worker left a job
+        std::vector<Job *> jobs;          // runs that workers may join
+        std::vector<std::thread> threads;
+        bool stopping;
+
+        Workers();
+        ~Workers();
+        void reserve(int num); // start workers until there are num
+        void loop();           // the body of each worker
+    };
+
+    static Workers &workers();
+
+    template <class F>
+    static void invoke(void *task, long i);
+
+public:
+    /**
+     * @brief Constructor.
+     * @param numThreads_ Number of threads. If less than 1, use the
+     *        number of hardware threads.
+     */
+    ThreadPool(int numThreads_ = 0);
+    int size();
+    static int hardwareThreads();
+
+    /**
+     * @brief Run task(i) for i = 0, 1, ..., num-1, and wait for all of them.
+     */
+    template <class F>
+    void run(long num, F task);
+};
+
+/**********************************************
+ * Implementation part
+ **********************************************/
+
+inline ThreadPool::ThreadPool(int numThreads_)
+{
+    numThreads = numThreads_ < 1 ? hardwareThreads() : numThreads_;
+}
+
+inline int ThreadPool::size()
+{
+    return numThreads;
+}
+
+inline int ThreadPool::hardwareThreads()
+{
+    int n = (int)std::thread::hardware_concurrency();
+    return n < 1 ? 1 : n;
+}
+
+inline void ThreadPool::Job::work()
+{
+    for (long i = next++; i < num; i = next++)
+    {
+        try
+        {
+            invoke(task, i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> guard(errorLock);
+            if (error == NULL)
+            {
+                error = std::current_exception();
+            }
+            next = num; // stop claiming new tasks
+        }
+    }
+}
+
+inline ThreadPool::Workers::Workers()
+{
+    stopping = false;
+}
+
+inline ThreadPool::Workers::~Workers()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+}
+
+inline void ThreadPool::Workers::reserve(int num)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    while ((int)threads.size() < num)
+    {
+        threads.push_back(std::thread([this]() { loop(); }));
+    }
+}
+
+inline void ThreadPool::Workers::loop()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        // join the oldest job that still has unclaimed tasks and room
+        Job *job = NULL;
+        for (size_t i = 0; i < jobs.size() && job == NULL; i++)
+        {
+            if (jobs[i]->helpers > 0 && jobs[i]->next.load() < jobs[i]->num)
+            {
+                job = jobs[i];
+            }
+        }
+        if (job == NULL)
+        {
+            if (stopping) return;
+            wake.wait(guard);
+            continue;
+        }
+
+        job->helpers--;
+        job->active++;
+        guard.unlock();
+        job->work();
+        guard.lock();
+        job->active--;
+        finished.notify_all();
+    }
+}
+
+inline ThreadPool::Workers &ThreadPool::workers()
+{
+    static Workers shared;
+    return shared;
+}
+
+template <class F>
+void ThreadPool::invoke(void *task, long i)
+{
+    (*(F *)task)(i);
+}
+
+template <class F>
+void ThreadPool::run(long num, F task)
+{
+    if (num <= 0)
+    {
+        return;
+    }
+
+    Job job;
+    job.invoke = invoke<F>;
+    job.task = &task;
+    job.num = num;
+    job.next = 0;
+    job.helpers = (int)(numThreads < num ? numThreads : num) - 1;
+    job.active = 0;
+    job.error = NULL;
+
+    Workers &shared = workers();
+    bool queued = job.helpers > 0;
+    if (queued)
+    {
+        shared.reserve(numThreads - 1);
+        {
+            std::lock_guard<std::mutex> guard(shared.lock);
+            shared.jobs.push_back(&job);
+        }
+        shared.wake.notify_all();
+    }
+
+    job.work();
+
+    if (queued)
+    {
+        // no worker joins once the job is dequeued; wait for those that did
+        std::unique_lock<std::mutex> guard(shared.lock);
+        for (size_t i = 0; i < shared.jobs.size(); i++)
+        {
+            if (shared.jobs[i] == &job)
+            {
+                shared.jobs.erase(shared.jobs.begin() + i);
+                break;
+            }
+        }
+        while (job.active > 0)
+        {
+            shared.finished.wait(guard);
+        }
+    }
+
+    if (job.error != NULL)
+    {
+        std::rethrow_exception(job.error);
+    }
+}
+
+#endif
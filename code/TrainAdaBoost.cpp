@@ -0,0 +1,329 @@
+/**
+ * This is the C/MEX code for training an AdaBoost ensemble of decision trees
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ *
+ * compile:
+ *     mex TrainAdaBoost.cpp
+ *
+ * usage:
+ *     [weights,importance]=TrainAdaBoost(X,Y,forestPath,forestSize,depth,noc,numThreads,'name',value,...)
+ *       X: n*d training data, each row is one instance, double, or the path of a
+ *           column file (see SaveColumnFile.m)
+ *       Y: n*1 labels, each row is one instance, each number is an integer between 1 and nol
+ *       forestPath: the binary model file of the resulting ensemble, holding the trees
+ *           and their voting weights, see ModelFile.h
+ *       forestSize: the number of boosting rounds, one tree each
+ *       depth: the maximum depth of each tree, or Inf for fully grown trees
+ *       noc: number of candidates at each node
+ *       numThreads (optional): number of training threads, 0 for all cores (default)
+ *       'maxBins' (optional): if positive, train in histogram mode on features
+ *           quantized into at most maxBins (up to 256) bins, default 0
+ *       'maxFeatures' (optional): number of features sampled without replacement at
+ *           each node, the candidates take turns among them, default 0 for all
+ *       'levelWise' (optional): if true, train breadth-first, one sweep over the rows
+ *           per level, giving the same tree as the default depth-first training
+ *       'seed' (optional): non-negative integer seed of the random candidates, the
+ *           same seed gives the same ensemble for any numThreads, default random
+ *       weights (optional): forestSize*1 vector of voting weights of the trees (alpha)
+ *       importance (optional): d*1 vector of feature importance, normalized to sum 1
+ *
+ * Once compiled, this MEX function takes precedence over TrainAdaBoost.m.
+ * The trees stay in memory, each round scores the training rows with the
+ * compiled tree, and the whole ensemble is saved once, as one file.
+ */
+
+#include "mex.h"
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "DecisionTree.h"
+#include "AdaBoost.h"
+#include "ModelFile.h"
+
+/* the work of the gateway function */
+static void trainAdaBoost(
+    int nlhs, mxArray *plhs[],
+    int nrhs, const mxArray *prhs[])
+{
+    double *X;
+    double *Y1;
+    double *weights;
+    double *importance;
+    long n;         // number of instances
+    long d;         // dimension of features
+    int forestSize; // number of rounds
+    int depth;      // the maximum depth of each tree
+    long noc;       // number of candidates at each node
+    int numThreads = 0;
+    int maxBins = 0;
+    uint64_t seed = Random::randomSeed();
+    long maxFeatures = 0;
+    bool levelWise = false;
+    char *path;
+
+    /*  check for proper number of arguments */
+    /*  positional inputs end where name-value options begin */
+    int nargs = nrhs;
+    for (int i = 6; i < nrhs; i++)
+    {
+        if (mxIsChar(prhs[i]))
+        {
+            nargs = i;
+            break;
+        }
+    }
+
+    if (nargs < 6 || nargs > 7 || (nrhs - nargs) % 2 != 0)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainAdaBoost:invalidNumInputs",
+            "Six or seven inputs required, followed by name-value options.");
+    }
+    if (nlhs > 2)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainAdaBoost:invalidNumOutputs",
+            "At most two outputs.");
+    }
+
+    /*  get X, or open the column file */
+    std::unique_ptr<ColumnFile> source;
+    if (mxIsChar(prhs[0]))
+    {
+        char *sourcePath = mxArrayToString(prhs[0]);
+        if (!ColumnFile::isColumnFile(sourcePath))
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:TrainAdaBoost:notColumnFile",
+                "Input X is not a matrix or a column file.");
+        }
+        source.reset(new ColumnFile(sourcePath, false));
+        mxFree(sourcePath);
+        X = NULL;
+        n = source->n;
+        d = source->d;
+    }
+    else
+    {
+        X = mxGetPr(prhs[0]);
+        n = mxGetM(prhs[0]);
+        d = mxGetN(prhs[0]);
+    }
+
+    /*  get Y */
+    Y1 = mxGetPr(prhs[1]);
+    if (mxGetM(prhs[1]) != n || mxGetN(prhs[1]) != 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainAdaBoost:dimNotMatch",
+            "Dimension of input Y is incorrect");
+    }
+
+    /*  get path */
+    path = mxArrayToString(prhs[2]);
+
+    /*  get forestSize */
+    if (!mxIsDouble(prhs[3]) || mxIsComplex(prhs[3]) ||
+        mxGetN(prhs[3]) * mxGetM(prhs[3]) != 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainAdaBoost:forestSizeNotScalar",
+            "Input forestSize must be a scalar.");
+    }
+
+    forestSize = (int)mxGetScalar(prhs[3]);
+
+    if (forestSize < 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainAdaBoost:forestSizeWrongRange",
+            "Input forestSize must be larger than 0.");
+    }
+
+    /*  get depth */
+    if (!mxIsDouble(prhs[4]) || mxIsComplex(prhs[4]) ||
+        mxGetN(prhs[4]) * mxGetM(prhs[4]) != 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainAdaBoost:depthNotScalar",
+            "Input depth must be a scalar.");
+    }
+
+    // Inf (0 in Tree) grows the tree until its lists are too small or pure
+    double depthValue = mxGetScalar(prhs[4]);
+    depth = depthValue >= 2147483647 ? 0 : (int)depthValue;
+
+    if (depthValue < 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainAdaBoost:depthWrongRange",
+            "Input depth must be larger than 0.");
+    }
+
+    /*  get noc */
+    if (!mxIsDouble(prhs[5]) || mxIsComplex(prhs[5]) ||
+        mxGetN(prhs[5]) * mxGetM(prhs[5]) != 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainAdaBoost:nocNotScalar",
+            "Input noc must be a scalar.");
+    }
+
+    noc = (long)mxGetScalar(prhs[5]);
+
+    if (noc < 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainAdaBoost:nocWrongRange",
+            "Input noc must be larger than 0.");
+    }
+
+    /*  get numThreads */
+    if (nargs == 7)
+    {
+        if (!mxIsDouble(prhs[6]) || mxIsComplex(prhs[6]) ||
+            mxGetN(prhs[6]) * mxGetM(prhs[6]) != 1)
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:TrainAdaBoost:numThreadsNotScalar",
+                "Input numThreads must be a scalar.");
+        }
+
+        numThreads = (int)mxGetScalar(prhs[6]);
+    }
+
+    /*  get options */
+    for (int i = nargs; i < nrhs; i += 2)
+    {
+        char *name = mxArrayToString(prhs[i]);
+        if (strcmp(name, "maxBins") == 0)
+        {
+            maxBins = (int)mxGetScalar(prhs[i + 1]);
+            if (maxBins != 0 && (maxBins < 2 || maxBins > 256))
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainAdaBoost:maxBinsWrongRange",
+                    "Option maxBins must be 0, or between 2 and 256.");
+            }
+        }
+        else if (strcmp(name, "maxFeatures") == 0)
+        {
+            maxFeatures = (long)mxGetScalar(prhs[i + 1]);
+            if (maxFeatures < 0)
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainAdaBoost:maxFeaturesWrongRange",
+                    "Option maxFeatures must be 0 (all features) or positive.");
+            }
+        }
+        else if (strcmp(name, "levelWise") == 0)
+        {
+            levelWise = mxGetScalar(prhs[i + 1]) != 0;
+        }
+        else if (strcmp(name, "seed") == 0)
+        {
+            double value = mxIsDouble(prhs[i + 1]) && mxGetM(prhs[i + 1]) * mxGetN(prhs[i + 1]) == 1
+                               ? mxGetScalar(prhs[i + 1]) : -1;
+            if (value < 0 || value != floor(value) || value >= 18446744073709551616.0)
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainAdaBoost:seedWrongValue",
+                    "Option seed must be a non-negative integer.");
+            }
+            seed = (uint64_t)value;
+        }
+        else
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:TrainAdaBoost:unknownOption",
+                "Unknown option %s.", name);
+        }
+        mxFree(name);
+    }
+
+    /*  call the C++ subroutine, its objects freed also if it throws */
+    std::vector<int> Y(n);
+    for (long i = 0; i < n; i++)
+    {
+        Y[i] = (int)Y1[i];
+    }
+    std::unique_ptr<Data> data;
+    if (source)
+    {
+        data.reset(new Data(source.get(), Y.data(), NULL, maxBins > 0 ? maxBins : 256));
+        if (maxBins > 0)
+        {
+            data->buildBins(maxBins);
+        }
+    }
+    else
+    {
+        data.reset(new Data(X, Y.data(), n, d, NULL, maxBins));
+    }
+    std::unique_ptr<AdaBoost> boost(new AdaBoost(forestSize, depth, noc, seed));
+    boost->setNumThreads(numThreads);
+    boost->setHistogramMode(maxBins > 0);
+    boost->setFeatureSampling(maxFeatures);
+    boost->setLevelWise(levelWise);
+    boost->trainBoost(data.get());
+    ModelFile::saveBoost(path, boost.get());
+
+    /*  return weights and importance */
+    if (nlhs >= 1)
+    {
+        plhs[0] = mxCreateDoubleMatrix(forestSize, 1, mxREAL);
+        weights = mxGetPr(plhs[0]);
+        for (int i = 0; i < forestSize; i++)
+        {
+            weights[i] = boost->getAlphas()[i];
+        }
+    }
+    if (nlhs >= 2)
+    {
+        plhs[1] = mxCreateDoubleMatrix(d, 1, mxREAL);
+        importance = mxGetPr(plhs[1]);
+        double *boostImportance = boost->getImportance();
+        for (long i = 0; i < d; i++)
+        {
+            importance[i] = boostImportance[i];
+        }
+    }
+
+    mxFree(path);
+
+    return;
+}
+
+/* the gateway function, reporting errors of the library as MATLAB errors */
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    try
+    {
+        trainAdaBoost(nlhs, plhs, nrhs, prhs);
+    }
+    catch (const Error &e)
+    {
+        mexErrMsgIdAndTxt("MATLAB:TrainAdaBoost:error", "%s", e.what());
+    }
+}
@@ -1,13 +1,20 @@
 function [weights, importance] = TrainAdaBoost(X, Y, forestPath, forestSize, depth, noc)
 %TrainAdaBoost Trains an AdaBoost ensemble of decision trees.
 %
+%   This is the fallback implementation, which saves each tree to a file
+%   and reads it back to score the training data. Once TrainAdaBoost.cpp
+%   is compiled with MEX, the MEX function takes precedence: it keeps the
+%   trees in memory, and saves the ensemble as one binary model file at
+%   forestPath, with the weights, instead of a folder.
+%
 %   Usage:
 %       [weights, importance] = TrainAdaBoost(X, Y, forestPath, forestSize, depth, noc)
 %
 %   Inputs:
 %       X           - n*d matrix, training data.
 %       Y           - n*1 vector, labels (1...M).
-%       forestPath  - String, the folder path to save the forest.
+%       forestPath  - String, the folder path to save the forest (the file
+%                     path with the MEX function).
 %       forestSize  - Integer, the number of decision trees in the ensemble.
 %       depth       - Integer, the maximum depth of each decision tree.
 %       noc         - Integer, number of candidates at each tree node.
@@ -0,0 +1,359 @@
+/**
+ * This is the C/MEX code for training a decision forest
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ *
+ * compile:
+ *     mex TrainDecisionForest.cpp
+ *
+ * usage:
+ *     importance = TrainDecisionForest(X,Y,forestPath,forestSize,depth,noc,numThreads,'name',value,...)
+ *       X: n*d training data, each row is one instance, double, or the path of a
+ *           column file (see SaveColumnFile.m) to train from disk: with 'maxBins'
+ *           the binned features are kept in memory (n*d bytes), and without it
+ *           the file is streamed a chunk of rows at a time at each level
+ *       Y: n*1 labels, each row is one instance, each number is an integer between 1 and nol
+ *       forestPath: the folder of the resulting forest, trees are saved as 1.tree, 2.tree, ...
+ *       forestSize: the number of trees in the forest
+ *       depth: the maximum depth of each tree, or Inf for fully grown trees
+ *       noc: number of candidates at each node
+ *       numThreads (optional): number of training threads, 0 for all cores (default)
+ *       'maxBins' (optional): if positive, train in histogram mode on features
+ *           quantized into at most maxBins (up to 256) bins, default 0
+ *       'format' (optional): 'text' (default) or 'binary' model file, a binary forest
+ *           is saved as one file at forestPath instead of a folder
+ *       'maxFeatures' (optional): number of features sampled without replacement at
+ *           each node, the candidates take turns among them, default 0 for all
+ *       'sampleRatio' (optional): train each tree on round(sampleRatio * n) sampled rows,
+ *           at most 1 without bootstrap, default 1
+ *       'bootstrap' (optional): if true, sample rows with replacement, default false
+ *       'levelWise' (optional): if true, train breadth-first, one sweep over the rows
+ *           per level, giving the same tree as the default depth-first training
+ *       'seed' (optional): non-negative integer seed of the random candidates, the
+ *           same seed gives the same forest for any numThreads, default random
+ *       importance (optional): d*1 vector of feature importance, summed over trees
+ *
+ * Once compiled, this MEX function takes precedence over TrainDecisionForest.m.
+ * All trees share one copy of the training data, and are trained concurrently.
+ */
+
+#include "mex.h"
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "DecisionTree.h"
+#include "ModelFile.h"
+
+/* the work of the gateway function */
+static void trainDecisionForest(
+    int nlhs, mxArray *plhs[],
+    int nrhs, const mxArray *prhs[])
+{
+    double *X;
+    double *Y1;
+    double *importance;
+    long n;         // number of instances
+    long d;         // dimension of features
+    int forestSize; // number of trees
+    int depth;      // the maximum depth of each tree
+    long noc;       // number of candidates at each node
+    int numThreads = 0;
+    int maxBins = 0;
+    bool binary = false;
+    uint64_t seed = Random::randomSeed();
+    long maxFeatures = 0;
+    double sampleRatio = 1;
+    bool bootstrap = false;
+    bool levelWise = false;
+    char *path;
+
+    /*  check for proper number of arguments */
+    /*  positional inputs end where name-value options begin */
+    int nargs = nrhs;
+    for (int i = 6; i < nrhs; i++)
+    {
+        if (mxIsChar(prhs[i]))
+        {
+            nargs = i;
+            break;
+        }
+    }
+
+    if (nargs < 6 || nargs > 7 || (nrhs - nargs) % 2 != 0)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionForest:invalidNumInputs",
+            "Six or seven inputs required, followed by name-value options.");
+    }
+    if (nlhs > 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionForest:invalidNumOutputs",
+            "At most one output.");
+    }
+
+    /*  get X, or open the column file */
+    std::unique_ptr<ColumnFile> source;
+    if (mxIsChar(prhs[0]))
+    {
+        char *sourcePath = mxArrayToString(prhs[0]);
+        if (!ColumnFile::isColumnFile(sourcePath))
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:TrainDecisionForest:notColumnFile",
+                "Input X is not a matrix or a column file.");
+        }
+        source.reset(new ColumnFile(sourcePath, false));
+        mxFree(sourcePath);
+        X = NULL;
+        n = source->n;
+        d = source->d;
+    }
+    else
+    {
+        X = mxGetPr(prhs[0]);
+        n = mxGetM(prhs[0]);
+        d = mxGetN(prhs[0]);
+    }
+
+    /*  get Y */
+    Y1 = mxGetPr(prhs[1]);
+    if (mxGetM(prhs[1]) != n || mxGetN(prhs[1]) != 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionForest:dimNotMatch",
+            "Dimension of input Y is incorrect");
+    }
+
+    /*  get path */
+    path = mxArrayToString(prhs[2]);
+
+    /*  get forestSize */
+    if (!mxIsDouble(prhs[3]) || mxIsComplex(prhs[3]) ||
+        mxGetN(prhs[3]) * mxGetM(prhs[3]) != 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionForest:forestSizeNotScalar",
+            "Input forestSize must be a scalar.");
+    }
+
+    forestSize = (int)mxGetScalar(prhs[3]);
+
+    if (forestSize < 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionForest:forestSizeWrongRange",
+            "Input forestSize must be larger than 0.");
+    }
+
+    /*  get depth */
+    if (!mxIsDouble(prhs[4]) || mxIsComplex(prhs[4]) ||
+        mxGetN(prhs[4]) * mxGetM(prhs[4]) != 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionForest:depthNotScalar",
+            "Input depth must be a scalar.");
+    }
+
+    // Inf (0 in Tree) grows the tree until its lists are too small or pure
+    double depthValue = mxGetScalar(prhs[4]);
+    depth = depthValue >= 2147483647 ? 0 : (int)depthValue;
+
+    if (depthValue < 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionForest:depthWrongRange",
+            "Input depth must be larger than 0.");
+    }
+
+    /*  get noc */
+    if (!mxIsDouble(prhs[5]) || mxIsComplex(prhs[5]) ||
+        mxGetN(prhs[5]) * mxGetM(prhs[5]) != 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionForest:nocNotScalar",
+            "Input noc must be a scalar.");
+    }
+
+    noc = (long)mxGetScalar(prhs[5]);
+
+    if (noc < 1)
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionForest:nocWrongRange",
+            "Input noc must be larger than 0.");
+    }
+
+    /*  get numThreads */
+    if (nargs == 7)
+    {
+        if (!mxIsDouble(prhs[6]) || mxIsComplex(prhs[6]) ||
+            mxGetN(prhs[6]) * mxGetM(prhs[6]) != 1)
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:TrainDecisionForest:numThreadsNotScalar",
+                "Input numThreads must be a scalar.");
+        }
+
+        numThreads = (int)mxGetScalar(prhs[6]);
+    }
+
+    /*  get options */
+    for (int i = nargs; i < nrhs; i += 2)
+    {
+        char *name = mxArrayToString(prhs[i]);
+        if (strcmp(name, "maxBins") == 0)
+        {
+            maxBins = (int)mxGetScalar(prhs[i + 1]);
+            if (maxBins != 0 && (maxBins < 2 || maxBins > 256))
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainDecisionForest:maxBinsWrongRange",
+                    "Option maxBins must be 0, or between 2 and 256.");
+            }
+        }
+        else if (strcmp(name, "maxFeatures") == 0)
+        {
+            maxFeatures = (long)mxGetScalar(prhs[i + 1]);
+            if (maxFeatures < 0)
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainDecisionForest:maxFeaturesWrongRange",
+                    "Option maxFeatures must be 0 (all features) or positive.");
+            }
+        }
+        else if (strcmp(name, "sampleRatio") == 0)
+        {
+            sampleRatio = mxGetScalar(prhs[i + 1]);
+        }
+        else if (strcmp(name, "bootstrap") == 0)
+        {
+            bootstrap = mxGetScalar(prhs[i + 1]) != 0;
+        }
+        else if (strcmp(name, "levelWise") == 0)
+        {
+            levelWise = mxGetScalar(prhs[i + 1]) != 0;
+        }
+        else if (strcmp(name, "seed") == 0)
+        {
+            double value = mxIsDouble(prhs[i + 1]) && mxGetM(prhs[i + 1]) * mxGetN(prhs[i + 1]) == 1
+                               ? mxGetScalar(prhs[i + 1]) : -1;
+            if (value < 0 || value != floor(value) || value >= 18446744073709551616.0)
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainDecisionForest:seedWrongValue",
+                    "Option seed must be a non-negative integer.");
+            }
+            seed = (uint64_t)value;
+        }
+        else if (strcmp(name, "format") == 0)
+        {
+            char *format = mxIsChar(prhs[i + 1]) ? mxArrayToString(prhs[i + 1]) : NULL;
+            if (format == NULL || (strcmp(format, "text") != 0 && strcmp(format, "binary") != 0))
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainDecisionForest:formatWrongValue",
+                    "Option format must be 'text' or 'binary'.");
+            }
+            binary = strcmp(format, "binary") == 0;
+            mxFree(format);
+        }
+        else
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:TrainDecisionForest:unknownOption",
+                "Unknown option %s.", name);
+        }
+        mxFree(name);
+    }
+
+    if (!(sampleRatio > 0) || (!bootstrap && sampleRatio > 1))
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionForest:sampleRatioWrongRange",
+            "Option sampleRatio must be positive, and at most 1 without bootstrap.");
+    }
+
+    /*  call the C++ subroutine, its objects freed also if it throws */
+    std::vector<int> Y(n);
+    for (long i = 0; i < n; i++)
+    {
+        Y[i] = (int)Y1[i];
+    }
+    std::unique_ptr<Data> data;
+    if (source)
+    {
+        data.reset(new Data(source.get(), Y.data(), NULL, maxBins > 0 ? maxBins : 256));
+        if (maxBins > 0)
+        {
+            data->buildBins(maxBins);
+        }
+    }
+    else
+    {
+        data.reset(new Data(X, Y.data(), n, d, NULL, maxBins));
+    }
+    std::unique_ptr<Forest> forest(new Forest(forestSize, depth, noc, seed));
+    forest->setHistogramMode(maxBins > 0);
+    forest->setFeatureSampling(maxFeatures);
+    forest->setRowSampling(sampleRatio, bootstrap);
+    forest->setLevelWise(levelWise);
+    forest->trainForest(data.get(), numThreads);
+    if (binary)
+    {
+        ModelFile::saveForest(path, forest.get());
+    }
+    else
+    {
+        forest->saveForest(path);
+    }
+
+    /*  return importance */
+    if (nlhs >= 1)
+    {
+        plhs[0] = mxCreateDoubleMatrix(d, 1, mxREAL);
+        importance = mxGetPr(plhs[0]);
+        double *forestImportance = forest->getImportance();
+        for (long i = 0; i < d; i++)
+        {
+            importance[i] = forestImportance[i];
+        }
+    }
+
+    mxFree(path);
+
+    return;
+}
+
+/* the gateway function, reporting errors of the library as MATLAB errors */
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    try
+    {
+        trainDecisionForest(nlhs, plhs, nrhs, prhs);
+    }
+    catch (const Error &e)
+    {
+        mexErrMsgIdAndTxt("MATLAB:TrainDecisionForest:error", "%s", e.what());
+    }
+}
@@ -1,22 +1,34 @@
-function TrainDecisionForest(X, Y, forestPath, forestSize, depth, noc)
+function TrainDecisionForest(X, Y, forestPath, forestSize, depth, noc, varargin)
 %TrainDecisionForest Trains a decision forest.
 %
 %   A decision forest is saved as a folder, and each decision tree is a file
 %   in this folder, named as 1.tree, 2.tree, 3.tree, ...
 %
+%   This is the fallback implementation which trains one tree at a time.
+%   Once TrainDecisionForest.cpp is compiled with MEX, the MEX function
+%   takes precedence: it shares the training data between trees and trains
+%   them on all cores.
+%
 %   Usage:
 %       TrainDecisionForest(X, Y, forestPath, forestSize, depth, noc)
+%       TrainDecisionForest(X, Y, forestPath, forestSize, depth, noc, numThreads, 'name', value, ...)
 %
 %   Inputs:
-%       X           - n*d matrix, training data, each row is one instance.
+%       X           - n*d matrix, training data, each row is one instance,
+%                     or the path of a column file (see SaveColumnFile).
 %       Y           - n*1 vector, labels, each row is one instance.
 %                     Important: for M classes, labels should be 1, 2, ..., M.
 %       forestPath  - String, the folder path to save the forest.
 %       forestSize  - Integer, the number of decision trees in the forest.
 %       depth       - Integer, the maximum depth of each decision tree.
 %       noc         - Integer, number of candidates at each tree node.
+%       numThreads  - (Optional) Integer, number of training threads of each tree.
+%       'name', value - (Optional) Options of TrainDecisionTree, e.g.
+%                     'sampleRatio', 'bootstrap' and 'maxFeatures'. With
+%                     'seed', tree i is seeded from seed and i as in the MEX
+%                     function, so both train the same forest.
 %
-%   See also RunDecisionForest, TrainDecisionTree, RunDecisionTree.
+%   See also RunDecisionForest, TrainDecisionTree, RunDecisionTree, SaveColumnFile.
 
 %   Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>
 %   Signal Analysis and Machine Perception Laboratory
@@ -40,7 +52,18 @@ if exist(forestPath, 'dir') ~= 7
     mkdir(forestPath);
 end
 
+numThreads = 1;
+if ~isempty(varargin) && ~ischar(varargin{1})
+    numThreads = varargin{1};
+    varargin(1) = [];
+end
+hasSeed = any(strcmp(varargin(1:2:end), 'seed'));
+
 for i=1:forestSize
     treeFile=[forestPath '/' num2str(i) '.tree'];
-    TrainDecisionTree(X,Y,treeFile,depth,noc);
+    options = varargin;
+    if hasSeed
+        options = [options, {'stream', i - 1}];
+    end
+    TrainDecisionTree(X,Y,treeFile,depth,noc,[],numThreads,options{:});
 end
@@ -23,13 +23,31 @@
  *     mex TrainDecisionTree.cpp
  *
  * usage:
- *     importance = TrainDecisionTree(X,Y,path,depth,noc,W)
- *       X: n*d training data, each row is one instance, double
+ *     importance = TrainDecisionTree(X,Y,path,depth,noc,W,numThreads,'name',value,...)
+ *       X: n*d training data, each row is one instance, double, or the path of a
+ *           column file (see SaveColumnFile.m) to train from disk: with 'maxBins'
+ *           the binned features are kept in memory (n*d bytes), and without it
+ *           the file is streamed a chunk of rows at a time at each level
  *       Y: n*1 labels, each row is one instance, each number is an integer between 1 and nol
  *       path: the file path of the resulting tree
- *       depth: the maximum depth of the tree
+ *       depth: the maximum depth of the tree, or Inf for fully grown trees
  *       noc: number of candidates at each node
- *       W (optional): n*1 weights, each row is one instance, double
+ *       W (optional): n*1 weights, each row is one instance, double, or [] for uniform weights
+ *       numThreads (optional): number of training threads, 0 for all cores, default 1
+ *       'maxBins' (optional): if positive, train in histogram mode on features
+ *           quantized into at most maxBins (up to 256) bins, default 0
+ *       'format' (optional): 'text' (default) or 'binary' model file
+ *       'maxFeatures' (optional): number of features sampled without replacement at
+ *           each node, the candidates take turns among them, default 0 for all
+ *       'sampleRatio' (optional): train the tree on round(sampleRatio * n) sampled rows,
+ *           at most 1 without bootstrap, default 1
+ *       'bootstrap' (optional): if true, sample rows with replacement, default false
+ *       'levelWise' (optional): if true, train breadth-first, one sweep over the rows
+ *           per level, giving the same tree as the default depth-first training
+ *       'seed' (optional): non-negative integer seed of the random candidates, the
+ *           same seed gives the same tree for any numThreads, default random
+ *       'stream' (optional): with 'seed', train the tree as tree stream + 1 of a
+ *           forest, seeded from seed and stream as in TrainDecisionForest
  *       importance (optional): d*1 vector of feature importance
  */
 
@@ -38,15 +56,17 @@
 #include <cstdio>
 #include <cmath>
 #include <iostream>
+#include <memory>
+#include <vector>
 #include "DecisionTree.h"
+#include "ModelFile.h"
 
-/* the gateway function */
-void mexFunction(
+/* the work of the gateway function */
+static void trainDecisionTree(
     int nlhs, mxArray *plhs[],
     int nrhs, const mxArray *prhs[])
 {
     double *X;
-    int *Y;
     double *Y1;
     double *W = NULL;
     double *importance;
@@ -54,14 +74,34 @@ void mexFunction(
     long d;    // dimension of features
     int depth; // the maximum depth of the tree
     long noc;  // number of candidates at each node
+    int numThreads = 1;
+    int maxBins = 0;
+    bool binary = false;
+    uint64_t seed = Random::randomSeed();
+    double stream = -1; // tree index in a forest, -1 for none
+    long maxFeatures = 0;
+    double sampleRatio = 1;
+    bool bootstrap = false;
+    bool levelWise = false;
     char *path;
 
     /*  check for proper number of arguments */
-    if (nrhs < 5 || nrhs > 6)
+    /*  positional inputs end where name-value options begin */
+    int nargs = nrhs;
+    for (int i = 5; i < nrhs; i++)
+    {
+        if (mxIsChar(prhs[i]))
+        {
+            nargs = i;
+            break;
+        }
+    }
+
+    if (nargs < 5 || nargs > 7 || (nrhs - nargs) % 2 != 0)
     {
         mexErrMsgIdAndTxt(
             "MATLAB:TrainDecisionTree:invalidNumInputs",
-            "Five or six inputs required.");
+            "Five to seven inputs required, followed by name-value options.");
     }
     if (nlhs > 1)
     {
@@ -70,10 +110,29 @@ void mexFunction(
             "At most one output.");
     }
 
-    /*  get X */
-    X = mxGetPr(prhs[0]);
-    n = mxGetM(prhs[0]);
-    d = mxGetN(prhs[0]);
+    /*  get X, or open the column file */
+    std::unique_ptr<ColumnFile> source;
+    if (mxIsChar(prhs[0]))
+    {
+        char *sourcePath = mxArrayToString(prhs[0]);
+        if (!ColumnFile::isColumnFile(sourcePath))
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:TrainDecisionTree:notColumnFile",
+                "Input X is not a matrix or a column file.");
+        }
+        source.reset(new ColumnFile(sourcePath, false));
+        mxFree(sourcePath);
+        X = NULL;
+        n = source->n;
+        d = source->d;
+    }
+    else
+    {
+        X = mxGetPr(prhs[0]);
+        n = mxGetM(prhs[0]);
+        d = mxGetN(prhs[0]);
+    }
 
     /*  get Y */
     Y1 = mxGetPr(prhs[1]);
@@ -83,12 +142,6 @@ void mexFunction(
             "MATLAB:TrainDecisionTree:dimNotMatch",
             "Dimension of input Y is incorrect");
     }
-    Y = new int[n];
-    for (long i = 0; i < n; i++)
-    {
-        Y[i] = (int)Y1[i];
-    }
-
     /*  get path */
     path = mxArrayToString(prhs[2]);
 
@@ -101,9 +154,11 @@ void mexFunction(
             "Input depth must be a scalar.");
     }
 
-    depth = (int)mxGetScalar(prhs[3]);
+    // Inf (0 in Tree) grows the tree until its lists are too small or pure
+    double depthValue = mxGetScalar(prhs[3]);
+    depth = depthValue >= 2147483647 ? 0 : (int)depthValue;
 
-    if (depth < 1)
+    if (depthValue < 1)
     {
         mexErrMsgIdAndTxt(
             "MATLAB:TrainDecisionTree:depthWrongRange",
@@ -129,7 +184,7 @@ void mexFunction(
     }
 
     /*  get W */
-    if (nrhs == 6)
+    if (nargs >= 6 && mxGetM(prhs[5]) * mxGetN(prhs[5]) > 0)
     {
         W = mxGetPr(prhs[5]);
         if (mxGetM(prhs[5]) != n || mxGetN(prhs[5]) != 1)
@@ -140,11 +195,145 @@ void mexFunction(
         }
     }
 
-    /*  call the C++ subroutine */
-    Data *data = new Data(X, Y, n, d, W);
-    Tree *tree = new Tree(depth, noc);
-    tree->trainTree(data);
-    tree->saveTree(path);
+    /*  get numThreads */
+    if (nargs == 7)
+    {
+        if (!mxIsDouble(prhs[6]) || mxIsComplex(prhs[6]) ||
+            mxGetN(prhs[6]) * mxGetM(prhs[6]) != 1)
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:TrainDecisionTree:numThreadsNotScalar",
+                "Input numThreads must be a scalar.");
+        }
+
+        numThreads = (int)mxGetScalar(prhs[6]);
+    }
+
+    /*  get options */
+    for (int i = nargs; i < nrhs; i += 2)
+    {
+        char *name = mxArrayToString(prhs[i]);
+        if (strcmp(name, "maxBins") == 0)
+        {
+            maxBins = (int)mxGetScalar(prhs[i + 1]);
+            if (maxBins != 0 && (maxBins < 2 || maxBins > 256))
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainDecisionTree:maxBinsWrongRange",
+                    "Option maxBins must be 0, or between 2 and 256.");
+            }
+        }
+        else if (strcmp(name, "maxFeatures") == 0)
+        {
+            maxFeatures = (long)mxGetScalar(prhs[i + 1]);
+            if (maxFeatures < 0)
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainDecisionTree:maxFeaturesWrongRange",
+                    "Option maxFeatures must be 0 (all features) or positive.");
+            }
+        }
+        else if (strcmp(name, "sampleRatio") == 0)
+        {
+            sampleRatio = mxGetScalar(prhs[i + 1]);
+        }
+        else if (strcmp(name, "bootstrap") == 0)
+        {
+            bootstrap = mxGetScalar(prhs[i + 1]) != 0;
+        }
+        else if (strcmp(name, "levelWise") == 0)
+        {
+            levelWise = mxGetScalar(prhs[i + 1]) != 0;
+        }
+        else if (strcmp(name, "seed") == 0)
+        {
+            double value = mxIsDouble(prhs[i + 1]) && mxGetM(prhs[i + 1]) * mxGetN(prhs[i + 1]) == 1
+                               ? mxGetScalar(prhs[i + 1]) : -1;
+            if (value < 0 || value != floor(value) || value >= 18446744073709551616.0)
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainDecisionTree:seedWrongValue",
+                    "Option seed must be a non-negative integer.");
+            }
+            seed = (uint64_t)value;
+        }
+        else if (strcmp(name, "stream") == 0)
+        {
+            stream = mxIsDouble(prhs[i + 1]) && mxGetM(prhs[i + 1]) * mxGetN(prhs[i + 1]) == 1
+                         ? mxGetScalar(prhs[i + 1]) : -1;
+            if (stream < 0 || stream != floor(stream) || stream >= 18446744073709551616.0)
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainDecisionTree:streamWrongValue",
+                    "Option stream must be a non-negative integer.");
+            }
+        }
+        else if (strcmp(name, "format") == 0)
+        {
+            char *format = mxIsChar(prhs[i + 1]) ? mxArrayToString(prhs[i + 1]) : NULL;
+            if (format == NULL || (strcmp(format, "text") != 0 && strcmp(format, "binary") != 0))
+            {
+                mexErrMsgIdAndTxt(
+                    "MATLAB:TrainDecisionTree:formatWrongValue",
+                    "Option format must be 'text' or 'binary'.");
+            }
+            binary = strcmp(format, "binary") == 0;
+            mxFree(format);
+        }
+        else
+        {
+            mexErrMsgIdAndTxt(
+                "MATLAB:TrainDecisionTree:unknownOption",
+                "Unknown option %s.", name);
+        }
+        mxFree(name);
+    }
+
+    if (!(sampleRatio > 0) || (!bootstrap && sampleRatio > 1))
+    {
+        mexErrMsgIdAndTxt(
+            "MATLAB:TrainDecisionTree:sampleRatioWrongRange",
+            "Option sampleRatio must be positive, and at most 1 without bootstrap.");
+    }
+
+    /*  call the C++ subroutine, its objects freed also if it throws */
+    std::vector<int> Y(n);
+    for (long i = 0; i < n; i++)
+    {
+        Y[i] = (int)Y1[i];
+    }
+    std::unique_ptr<Data> data;
+    if (source)
+    {
+        data.reset(new Data(source.get(), Y.data(), W, maxBins > 0 ? maxBins : 256));
+        if (maxBins > 0)
+        {
+            data->buildBins(maxBins);
+        }
+    }
+    else
+    {
+        data.reset(new Data(X, Y.data(), n, d, W, maxBins));
+    }
+    if (stream >= 0)
+    {
+        seed = Random(seed, (uint64_t)stream).next(); // as Forest seeds its trees
+    }
+    std::unique_ptr<Tree> tree(new Tree(depth, noc, seed));
+    tree->setNumThreads(numThreads);
+    tree->setHistogramMode(maxBins > 0);
+    tree->setFeatureSampling(maxFeatures);
+    tree->setRowSampling(sampleRatio, bootstrap);
+    tree->setLevelWise(levelWise);
+    tree->trainTree(data.get());
+    if (binary)
+    {
+        ModelFile::saveTree(path, tree.get());
+    }
+    else
+    {
+        tree->saveTree(path);
+    }
 
     /*  return importance */
     if (nlhs >= 1) {
@@ -156,9 +345,21 @@ void mexFunction(
         }
     }
 
-    delete data;
-    delete tree;
-    delete[] Y;
+    mxFree(path);
 
     return;
 }
+
+/* the gateway function, reporting errors of the library as MATLAB errors */
+void mexFunction(int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    try
+    {
+        trainDecisionTree(nlhs, plhs, nrhs, prhs);
+    }
+    catch (const Error &e)
+    {
+        mexErrMsgIdAndTxt("MATLAB:TrainDecisionTree:error", "%s", e.what());
+    }
+}
@@ -10,6 +10,7 @@
 % To use this package you need to compile C++ code with MEX. 
 % The four functions are TrainDecisionTree(), RunDecisionTree(), 
 % TrainDecisionForest(), and RunDecisionForest(). 
+% TrainDecisionForest() trains all trees of the forest in parallel. 
 % Note: if there are M classes, then the labels should be 1, 2, ..., M. 
 
 %   Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>
@@ -36,6 +37,7 @@ clear; clc; close all;
 
 mex TrainDecisionTree.cpp;
 mex RunDecisionTree.cpp;
+mex TrainDecisionForest.cpp;
 
 %% training a decision tree
 
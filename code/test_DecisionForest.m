@@ -11,6 +11,9 @@ function test_DecisionForest()
         fprintf('Compiling C++ code...\n');
         mex TrainDecisionTree.cpp;
         mex RunDecisionTree.cpp;
+        mex TrainDecisionForest.cpp;
+        mex DecisionModel.cpp;
+        mex TrainAdaBoost.cpp;
         fprintf('Compilation successful.\n');
     catch e
         error('Compilation failed: %s', e.message);
@@ -48,7 +51,94 @@ function test_DecisionForest()
     assert(length(imp) == size(X, 2), 'Importance vector size mismatch');
     fprintf('Feature importance calculated.\n');
     
+    % Test multithreaded training (uniform weights given as [])
+    load('TrainingData.mat');
+    TrainDecisionTree(X, Y+1, treeFile, depth, noc, [], 4);
+    load('TestingData.mat');
+    [Y1, ~] = RunDecisionTree(X, treeFile);
+    accuracy = 1 - sum(Y1 - 1 ~= Y) / length(Y);
+    fprintf('Multithreaded Decision Tree Accuracy: %.4f\n', accuracy);
+    assert(accuracy > 0.8, 'Multithreaded Decision Tree accuracy is too low.');
+    
+    % Test seeded training, reproducible for any number of threads
+    load('TrainingData.mat');
+    TrainDecisionTree(X, Y+1, treeFile, depth, noc, [], 1, 'seed', 7);
+    seededTree = fileread(treeFile);
+    TrainDecisionTree(X, Y+1, treeFile, depth, noc, [], 4, 'seed', 7);
+    assert(strcmp(fileread(treeFile), seededTree), 'Seeded training is not reproducible.');
+    TrainDecisionTree(X, Y+1, treeFile, depth, noc, [], 1, 'seed', 7, 'levelWise', true);
+    assert(strcmp(fileread(treeFile), seededTree), 'Level-wise tree differs from depth-first tree.');
+    
+    % Test fully grown trees
+    TrainDecisionTree(X, Y+1, treeFile, Inf, noc, [], 1, 'seed', 7);
+    fullTree = fileread(treeFile);
+    TrainDecisionTree(X, Y+1, treeFile, Inf, noc, [], 4, 'seed', 7, 'levelWise', true);
+    assert(strcmp(fileread(treeFile), fullTree), 'Fully grown trees differ.');
+    assert(sum(fullTree == 10) > sum(seededTree == 10), 'Fully grown tree is not deeper.');
+    Y1 = RunDecisionTree(X, treeFile);
+    assert(mean(Y1 - 1 == Y) > 0.8, 'Fully grown tree accuracy is too low.');
+    
+    % Test histogram mode
+    load('TrainingData.mat');
+    TrainDecisionTree(X, Y+1, treeFile, depth, noc, [], 1, 'maxBins', 256);
+    load('TestingData.mat');
+    [Y1, ~] = RunDecisionTree(X, treeFile);
+    accuracy = 1 - sum(Y1 - 1 ~= Y) / length(Y);
+    fprintf('Histogram Mode Decision Tree Accuracy: %.4f\n', accuracy);
+    assert(accuracy > 0.8, 'Histogram mode Decision Tree accuracy is too low.');
+    
+    % Test training from a column file, streamed level by level
+    load('TrainingData.mat');
+    columnFile = 'test_data.cols';
+    SaveColumnFile(X, columnFile);
+    TrainDecisionTree(X, Y+1, treeFile, depth, noc, [], 1, 'maxBins', 256, 'seed', 7);
+    histogramTree = fileread(treeFile);
+    TrainDecisionTree(columnFile, Y+1, treeFile, depth, noc, [], 1, 'seed', 7);
+    assert(strcmp(fileread(treeFile), histogramTree), 'Streamed tree differs from histogram mode.');
+    delete(columnFile);
+    
+    delete(treeFile);
+    
+    % Test binary model format
+    load('TrainingData.mat');
+    binaryFile = 'test_tree.dfm';
+    TrainDecisionTree(X, Y+1, binaryFile, depth, noc, [], 1, 'format', 'binary');
+    load('TestingData.mat');
+    [Y1, P1] = RunDecisionTree(X, binaryFile);
+    accuracy = 1 - sum(Y1 - 1 ~= Y) / length(Y);
+    fprintf('Binary Format Decision Tree Accuracy: %.4f\n', accuracy);
+    assert(accuracy > 0.8, 'Binary format Decision Tree accuracy is too low.');
+    assert(all(abs(sum(P1, 2) - 1) < 1e-6), 'Binary format probabilities do not sum to 1.');
+    delete(binaryFile);
+    
+    % Test sparse leaves of a many-class tree
+    load('TrainingData.mat');
+    manyY = mod(round(X(:, 1) * 1000), 40) + 1;
+    TrainDecisionTree(X, manyY, treeFile, depth, noc, [], 1, 'seed', 7);
+    TrainDecisionTree(X, manyY, binaryFile, depth, noc, [], 1, 'seed', 7, 'format', 'binary');
+    assert(~isempty(strfind(fileread(treeFile), ':')), 'Many-class tree leaves are not sparse.');
+    [Y1, P1] = RunDecisionTree(X, treeFile);
+    [Y2, P2] = RunDecisionTree(X, binaryFile);
+    assert(size(P1, 2) == 40 && isequal(Y1, Y2) && isequal(P1, P2), 'Sparse text and binary trees differ.');
     delete(treeFile);
+    delete(binaryFile);
+    
+    % Test that errors of the library are MATLAB errors
+    load('TrainingData.mat');
+    caught = false;
+    try
+        TrainDecisionTree(X, Y, treeFile, depth, noc);
+    catch e
+        caught = strcmp(e.identifier, 'MATLAB:TrainDecisionTree:error');
+    end
+    assert(caught, 'Labels of 0 did not raise an error.');
+    caught = false;
+    try
+        RunDecisionTree(X, 'missing.tree');
+    catch e
+        caught = strcmp(e.identifier, 'MATLAB:RunDecisionTree:error');
+    end
+    assert(caught, 'A missing tree file did not raise an error.');
     
     % ------------------------
     % Test 2: Decision Forest
@@ -63,7 +153,13 @@ function test_DecisionForest()
         rmdir(forestPath, 's');
     end
     
-    TrainDecisionForest(X, Y+1, forestPath, forestSize, depth, noc);
+    numThreads = 2;
+    imp = TrainDecisionForest(X, Y+1, forestPath, forestSize, depth, noc, numThreads);
+    assert(length(imp) == size(X, 2), 'Importance vector size mismatch');
+    for i = 1:forestSize
+        assert(exist(fullfile(forestPath, [num2str(i) '.tree']), 'file') == 2, ...
+            'Tree file of the forest was not created.');
+    end
     
     load('TestingData.mat');
     [Y1, ~] = RunDecisionForest(X, forestPath);
@@ -75,7 +171,61 @@ function test_DecisionForest()
     fprintf('Decision Forest Accuracy: %.4f\n', accuracy);
     assert(accuracy > 0.85, 'Decision Forest accuracy is too low.');
     
+    % Test a forest kept in memory by a handle
+    handle = DecisionModel('load', forestPath);
+    assert(DecisionModel('load', forestPath) == handle, 'Cached model was not reused.');
+    [Y2, ~] = DecisionModel('run', handle, X);
+    [Y3, ~] = DecisionModel('run', handle, X);
+    assert(isequal(Y2 - 1, Y1) && isequal(Y3, Y2), 'Model handle decisions do not match.');
+    floatReport = DecisionModel('compact', handle, 'float32', 'uint16', X, Y + 1);
+    report = DecisionModel('compact', handle, 'uint16', 'uint16', X, Y + 1);
+    assert(floatReport.bytes < report.doubleBytes, 'Compact model is not smaller.');
+    assert(report.bytes < report.doubleBytes, 'Compact model is not smaller.');
+    assert(report.agreement > 0.99, 'Compact model decisions differ too much.');
+    [Y4, ~] = DecisionModel('run', handle, single(X));
+    assert(mean(Y4 - 1 == Y) > 0.85, 'Compact model accuracy is too low.');
+    DecisionModel('compact', handle, 'double', '');
+    DecisionModel('export', handle, 'test_forest.cpp');
+    assert(exist('test_forest.cpp', 'file') == 2, 'Model was not exported as C++ source.');
+    delete('test_forest.cpp');
+    DecisionModel('release', handle);
+    DecisionModel('release', handle);
+    
     rmdir(forestPath, 's');
+    
+    % Test a forest saved as one binary file
+    load('TrainingData.mat');
+    binaryFile = 'test_forest.dfm';
+    TrainDecisionForest(X, Y+1, binaryFile, forestSize, depth, noc, 0, 'format', 'binary');
+    load('TestingData.mat');
+    [Y1, ~] = RunDecisionForest(X, binaryFile);
+    accuracy = 1 - sum(Y1 - 1 ~= Y) / length(Y);
+    fprintf('Binary Format Decision Forest Accuracy: %.4f\n', accuracy);
+    assert(accuracy > 0.85, 'Binary format Decision Forest accuracy is too low.');
+    delete(binaryFile);
+
+    % 16-bit codes take less memory than float thresholds when trees share
+    % their thresholds, as the bin edges of histogram mode
+    load('TrainingData.mat');
+    TrainDecisionForest(X, Y+1, binaryFile, 20, depth, noc, 0, 'format', 'binary', 'maxBins', 16);
+    load('TestingData.mat');
+    handle = DecisionModel('load', binaryFile);
+    floatReport = DecisionModel('compact', handle, 'float32', 'argmax', X, Y + 1);
+    report = DecisionModel('compact', handle, 'uint16', 'argmax', X, Y + 1);
+    assert(report.bytes < floatReport.bytes, '16-bit codes are not smaller than float thresholds.');
+    DecisionModel('release', handle);
+    delete(binaryFile);
+
+    % Test a bagged forest with sampled rows and features
+    load('TrainingData.mat');
+    TrainDecisionForest(X, Y+1, binaryFile, forestSize, depth, noc, 0, 'format', 'binary', ...
+        'sampleRatio', 0.5, 'bootstrap', true, 'maxFeatures', 1, 'seed', 3);
+    load('TestingData.mat');
+    [Y1, ~] = RunDecisionForest(X, binaryFile);
+    accuracy = 1 - sum(Y1 - 1 ~= Y) / length(Y);
+    fprintf('Bagged Decision Forest Accuracy: %.4f\n', accuracy);
+    assert(accuracy > 0.8, 'Bagged Decision Forest accuracy is too low.');
+    delete(binaryFile);
 
     % ------------------------
     % Test 3: AdaBoost
@@ -83,9 +233,9 @@ function test_DecisionForest()
     fprintf('\nTest 3: AdaBoost...\n');
     load('TrainingData.mat');
     
-    forestPath = 'test_adaboost';
-    if exist(forestPath, 'dir')
-        rmdir(forestPath, 's');
+    forestPath = 'test_adaboost.dfm';
+    if exist(forestPath, 'file') == 2
+        delete(forestPath);
     end
     
     [weights, importance] = TrainAdaBoost(X, Y+1, forestPath, forestSize, depth, noc);
@@ -102,8 +252,9 @@ function test_DecisionForest()
     
     fprintf('AdaBoost Accuracy: %.4f\n', accuracy);
     assert(accuracy > 0.85, 'AdaBoost accuracy is too low.');
+    assert(exist(forestPath, 'file') == 2, 'AdaBoost ensemble was not saved as one file.');
     
-    rmdir(forestPath, 's');
+    delete(forestPath);
     
     fprintf('\nAll tests passed!\n');
 end
@@ -0,0 +1,665 @@
+/**
+ * @file _native.cpp
+ * @brief Python extension running the C++ trees and forests of DecisionTree.h.
+ * @author Quan Wang <wangq10@rpi.edu>
+ * @date 2013
+ *
+ * Copyright (C) 2013 Quan Wang <wangq10@rpi.edu>,
+ * Signal Analysis and Machine Perception Laboratory,
+ * Department of Electrical, Computer, and Systems Engineering,
+ * Rensselaer Polytechnic Institute, Troy, NY 12180, USA
+ *
+ * Related publications:
+ * [1] Quan Wang, Yan Ou, A. Agung Julius, Kim L. Boyer and Min Jun Kim,
+ *     "Tracking Tetrahymena Pyriformis Cells using Decision Trees",
+ *     2012 21st International Conference on Pattern Recognition (ICPR),
+ *     Pages 1843-1847, 11-15 Nov. 2012.
+ * [2] Quan Wang, Dijia Wu, Le Lu, Meizhu Liu, Kim L. Boyer, and Shaohua
+ *     Kevin Zhou, "Semantic Context Forests for Learning-Based Knee
+ *     Cartilage Segmentation in 3D MR Images",
+ *     MICCAI 2013: Workshop on Medical Computer Vision.
+ * [3] Quan Wang. "Exploiting Geometric and Spatial Constraints for Vision
+ *     and Lighting Applications".
+ *     Ph.D. dissertation, Rensselaer Polytechnic Institute, 2014.
+ */
+
+/**
+ * The pydecisionforest._native module, built by setup.py with the headers
+ * of code/, and used through pydecisionforest/native.py. It only takes
+ * objects of the buffer protocol, so it does not depend on the NumPy C API:
+ *
+ *     handle = train_tree(X, Y, W, depth, noc, seed, numThreads)
+ *     handle = train_forest(X, Y, size, depth, noc, seed, numThreads)
+ *     handle = load(path)
+ *       X: n*d float64 training data, in any layout; a Fortran-ordered
+ *           array is used in place, others are copied once, column-major
+ *       Y: n int32 labels between 1 and nol, contiguous
+ *       W: n float64 weights, contiguous, or None for uniform weights
+ *       path: a tree file, a forest folder or a binary model file
+ *       handle: a capsule holding the model
+ *     run(handle, X, Y, P, numThreads)
+ *       X: n*d float64 testing data, rows or columns contiguous, used in place
+ *       Y: n float64 output decisions, contiguous
+ *       P: n*nol float64 output probabilities, Fortran-ordered
+ *     save(handle, path)
+ *       writes a binary model file, see ModelFile.h
+ *     (d, nol, size) = info(handle)
+ *     importance = importance(handle)
+ *     (feature, threshold, child, leafP) = nodes(handle, i)
+ *       the compiled nodes of tree i, see FlatTree
+ *
+ * numThreads is 0 for all cores. The GIL is released while training,
+ * running, loading and saving, and the buffers are held meanwhile, so they
+ * cannot be resized. Errors of the library (see Error.h) are raised as
+ * ValueError.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "DecisionTree.h"
+#include "ModelFile.h"
+
+#ifdef _WIN32
+#define stat _stat
+#endif
+
+/**********************************************
+ * Models
+ **********************************************/
+
+class Model
+{
+public:
+    Tree *tree;                     // a trained tree or a tree file, or
+    Forest *forest;                 // a trained forest or a forest folder, or
+    ModelFile *file;                // a binary model file
+    FlatForest *flat;               // the trees to run
+    std::vector<double> importance; // feature importance of training, zeros if loaded
+
+    Model(Tree *tree_);
+    Model(Forest *forest_);
+    Model(ModelFile *file_);
+    ~Model();
+};
+
+Model::Model(Tree *tree_)
+{
+    tree = tree_;
+    forest = NULL;
+    file = NULL;
+    FlatTree *trees = tree->getFlat();
+    flat = new FlatForest(&trees, 1);
+    double *weights = tree->getImportance();
+    importance.assign(flat->d, 0);
+    if (weights != NULL) importance.assign(weights, weights + flat->d);
+}
+
+Model::Model(Forest *forest_)
+{
+    tree = NULL;
+    forest = forest_;
+    file = NULL;
+    flat = forest->getFlat();
+    double *weights = forest->getImportance();
+    importance.assign(flat->d, 0);
+    if (weights != NULL) importance.assign(weights, weights + flat->d);
+}
+
+Model::Model(ModelFile *file_)
+{
+    tree = NULL;
+    forest = NULL;
+    file = file_;
+    std::vector<FlatTree *> trees(file->forestSize());
+    for (int i = 0; i < file->forestSize(); i++)
+    {
+        trees[i] = file->getTree(i);
+    }
+    flat = new FlatForest(trees.data(), file->forestSize(), file->getWeights());
+    importance.assign(flat->d, 0);
+}
+
+Model::~Model()
+{
+    delete flat;
+    if (file != NULL) delete file;
+    if (forest != NULL) delete forest;
+    if (tree != NULL) delete tree;
+}
+
+static const char *capsuleName = "pydecisionforest._native.Model";
+
+static void deleteModel(PyObject *capsule)
+{
+    delete (Model *)PyCapsule_GetPointer(capsule, capsuleName);
+}
+
+static Model *getModel(PyObject *handle)
+{
+    return (Model *)PyCapsule_GetPointer(handle, capsuleName);
+}
+
+/**********************************************
+ * Buffers
+ **********************************************/
+
+/* a buffer of the given item type: 'd' for float64, 'i' for int32 */
+static bool hasType(const Py_buffer *view, char type)
+{
+    const char *format = view->format == NULL ? "B" : view->format;
+    if (format[0] == '@' || format[0] == '=' || format[0] == '<')
+    {
+        format++;
+    }
+    if (type == 'i')
+    {
+        return view->itemsize == sizeof(int) && (strcmp(format, "i") == 0 || strcmp(format, "l") == 0);
+    }
+    return view->itemsize == sizeof(double) && strcmp(format, "d") == 0;
+}
+
+/* get a 2-D float64 buffer of any strides, in units of doubles */
+static bool getMatrix(PyObject *obj, Py_buffer *view, long &rowStride, long &featureStride)
+{
+    if (PyObject_GetBuffer(obj, view, PyBUF_STRIDES | PyBUF_FORMAT) != 0)
+    {
+        return false;
+    }
+    if (view->ndim != 2 || !hasType(view, 'd') ||
+        view->strides[0] % (Py_ssize_t)sizeof(double) != 0 ||
+        view->strides[1] % (Py_ssize_t)sizeof(double) != 0)
+    {
+        PyBuffer_Release(view);
+        PyErr_SetString(PyExc_ValueError, "X should be a 2-D float64 array.");
+        return false;
+    }
+    rowStride = (long)(view->strides[0] / (Py_ssize_t)sizeof(double));
+    featureStride = (long)(view->strides[1] / (Py_ssize_t)sizeof(double));
+    return true;
+}
+
+/* get a contiguous 1-D buffer of n items of the given type */
+static bool getVector(PyObject *obj, Py_buffer *view, char type, long n, bool writable, const char *name)
+{
+    if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0)) != 0)
+    {
+        return false;
+    }
+    if (view->ndim != 1 || !hasType(view, type) || view->shape[0] != n)
+    {
+        PyBuffer_Release(view);
+        PyErr_Format(PyExc_ValueError, "%s should be a contiguous %s array of %ld items.", name,
+                     type == 'i' ? "int32" : "float64", n);
+        return false;
+    }
+    return true;
+}
+
+/**********************************************
+ * Errors
+ **********************************************/
+
+/* an exception caught without the GIL, raised once it is held again */
+class Failure
+{
+public:
+    PyObject *type;
+    std::string message;
+
+    Failure() : type(NULL) {}
+
+    void catchCurrent()
+    {
+        try
+        {
+            throw;
+        }
+        catch (const Error &e)
+        {
+            type = PyExc_ValueError;
+            message = e.what();
+        }
+        catch (const std::bad_alloc &)
+        {
+            type = PyExc_MemoryError;
+            message = "Out of memory.";
+        }
+        catch (const std::exception &e)
+        {
+            type = PyExc_RuntimeError;
+            message = e.what();
+        }
+    }
+
+    bool raise()
+    {
+        if (type == NULL) return false;
+        PyErr_SetString(type, message.c_str());
+        return true;
+    }
+};
+
+/**********************************************
+ * Module functions
+ **********************************************/
+
+/* train a tree or a forest, size 0 for a tree */
+static PyObject *train(PyObject *objX, PyObject *objY, PyObject *objW, int size, int depth, long noc,
+                       unsigned long long seed, int numThreads)
+{
+    Py_buffer viewX, viewY, viewW;
+    long rowStride, featureStride;
+    if (!getMatrix(objX, &viewX, rowStride, featureStride))
+    {
+        return NULL;
+    }
+    long n = (long)viewX.shape[0], d = (long)viewX.shape[1];
+    if (!getVector(objY, &viewY, 'i', n, false, "Y"))
+    {
+        PyBuffer_Release(&viewX);
+        return NULL;
+    }
+    bool weighted = objW != Py_None;
+    if (weighted && !getVector(objW, &viewW, 'd', n, false, "W"))
+    {
+        PyBuffer_Release(&viewY);
+        PyBuffer_Release(&viewX);
+        return NULL;
+    }
+
+    Model *model = NULL;
+    Failure failure;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        // Data reads column-major X; other layouts are copied once
+        const double *X = (const double *)viewX.buf;
+        std::vector<double> columns;
+        if (rowStride != 1 || featureStride != n)
+        {
+            columns.resize((size_t)n * d);
+            for (long j = 0; j < d; j++)
+            {
+                for (long i = 0; i < n; i++)
+                {
+                    columns[(size_t)j * n + i] = X[i * rowStride + j * featureStride];
+                }
+            }
+            X = columns.data();
+        }
+        Data data((double *)X, (int *)viewY.buf, n, d, weighted ? (double *)viewW.buf : NULL);
+
+        if (size == 0)
+        {
+            Tree *tree = new Tree(depth, noc, (uint64_t)seed);
+            try
+            {
+                tree->setNumThreads(numThreads);
+                tree->trainTree(&data);
+                model = new Model(tree);
+            }
+            catch (...)
+            {
+                delete tree;
+                throw;
+            }
+        }
+        else
+        {
+            Forest *forest = new Forest(size, depth, noc, (uint64_t)seed);
+            try
+            {
+                forest->trainForest(&data, numThreads);
+                model = new Model(forest);
+            }
+            catch (...)
+            {
+                delete forest;
+                throw;
+            }
+        }
+    }
+    catch (...)
+    {
+        failure.catchCurrent();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (weighted) PyBuffer_Release(&viewW);
+    PyBuffer_Release(&viewY);
+    PyBuffer_Release(&viewX);
+    if (failure.raise())
+    {
+        return NULL;
+    }
+    PyObject *handle = PyCapsule_New(model, capsuleName, deleteModel);
+    if (handle == NULL) delete model;
+    return handle;
+}
+
+static PyObject *trainTree(PyObject *self, PyObject *args)
+{
+    PyObject *objX, *objY, *objW;
+    int depth, numThreads;
+    long noc;
+    unsigned long long seed;
+    if (!PyArg_ParseTuple(args, "OOOilKi", &objX, &objY, &objW, &depth, &noc, &seed, &numThreads))
+    {
+        return NULL;
+    }
+    return train(objX, objY, objW, 0, depth, noc, seed, numThreads);
+}
+
+static PyObject *trainForest(PyObject *self, PyObject *args)
+{
+    PyObject *objX, *objY;
+    int size, depth, numThreads;
+    long noc;
+    unsigned long long seed;
+    if (!PyArg_ParseTuple(args, "OOiilKi", &objX, &objY, &size, &depth, &noc, &seed, &numThreads))
+    {
+        return NULL;
+    }
+    if (size < 1)
+    {
+        PyErr_SetString(PyExc_ValueError, "The forest should have at least one tree.");
+        return NULL;
+    }
+    return train(objX, objY, Py_None, size, depth, noc, seed, numThreads);
+}
+
+static PyObject *run(PyObject *self, PyObject *args)
+{
+    PyObject *handle, *objX, *objY, *objP;
+    int numThreads;
+    if (!PyArg_ParseTuple(args, "OOOOi", &handle, &objX, &objY, &objP, &numThreads))
+    {
+        return NULL;
+    }
+    Model *model = getModel(handle);
+    if (model == NULL)
+    {
+        return NULL;
+    }
+
+    Py_buffer viewX, viewY, viewP;
+    long rowStride, featureStride;
+    if (!getMatrix(objX, &viewX, rowStride, featureStride))
+    {
+        return NULL;
+    }
+    long n = (long)viewX.shape[0], d = (long)viewX.shape[1];
+    if (d != model->flat->d)
+    {
+        PyBuffer_Release(&viewX);
+        PyErr_Format(PyExc_ValueError, "X should have %ld features, not %ld.", model->flat->d, d);
+        return NULL;
+    }
+    if (!getVector(objY, &viewY, 'd', n, true, "Y"))
+    {
+        PyBuffer_Release(&viewX);
+        return NULL;
+    }
+    if (PyObject_GetBuffer(objP, &viewP, PyBUF_F_CONTIGUOUS | PyBUF_FORMAT | PyBUF_WRITABLE) != 0)
+    {
+        PyBuffer_Release(&viewY);
+        PyBuffer_Release(&viewX);
+        return NULL;
+    }
+    if (viewP.ndim != 2 || !hasType(&viewP, 'd') || viewP.shape[0] != n || viewP.shape[1] != model->flat->nol)
+    {
+        PyBuffer_Release(&viewP);
+        PyBuffer_Release(&viewY);
+        PyBuffer_Release(&viewX);
+        PyErr_Format(PyExc_ValueError, "P should be a Fortran-ordered float64 array of %ld by %d.", n,
+                     model->flat->nol);
+        return NULL;
+    }
+
+    Failure failure;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        // rows or columns are walked in place, other layouts a block at a time
+        model->flat->runStrided((const double *)viewX.buf, rowStride, featureStride, (double *)viewY.buf,
+                                (double *)viewP.buf, n, d, numThreads);
+    }
+    catch (...)
+    {
+        failure.catchCurrent();
+    }
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&viewP);
+    PyBuffer_Release(&viewY);
+    PyBuffer_Release(&viewX);
+    if (failure.raise())
+    {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *load(PyObject *self, PyObject *args)
+{
+    const char *path;
+    if (!PyArg_ParseTuple(args, "s", &path))
+    {
+        return NULL;
+    }
+
+    // detected as DecisionModel does
+    Model *model = NULL;
+    Failure failure;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        struct stat info;
+        if (stat(path, &info) == 0 && (info.st_mode & S_IFDIR))
+        {
+            Forest *forest = new Forest((char *)path);
+            try
+            {
+                model = new Model(forest);
+            }
+            catch (...)
+            {
+                delete forest;
+                throw;
+            }
+        }
+        else if (ModelFile::isModelFile((char *)path))
+        {
+            ModelFile *file = new ModelFile((char *)path);
+            try
+            {
+                model = new Model(file);
+            }
+            catch (...)
+            {
+                delete file;
+                throw;
+            }
+        }
+        else
+        {
+            Tree *tree = new Tree((char *)path);
+            try
+            {
+                model = new Model(tree);
+            }
+            catch (...)
+            {
+                delete tree;
+                throw;
+            }
+        }
+    }
+    catch (...)
+    {
+        failure.catchCurrent();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (failure.raise())
+    {
+        return NULL;
+    }
+    PyObject *handle = PyCapsule_New(model, capsuleName, deleteModel);
+    if (handle == NULL) delete model;
+    return handle;
+}
+
+static PyObject *save(PyObject *self, PyObject *args)
+{
+    PyObject *handle;
+    const char *path;
+    if (!PyArg_ParseTuple(args, "Os", &handle, &path))
+    {
+        return NULL;
+    }
+    Model *model = getModel(handle);
+    if (model == NULL)
+    {
+        return NULL;
+    }
+
+    Failure failure;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        FlatForest *flat = model->flat;
+        ModelFile::save((char *)path, flat->trees, flat->size, flat->weights);
+    }
+    catch (...)
+    {
+        failure.catchCurrent();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (failure.raise())
+    {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *info(PyObject *self, PyObject *args)
+{
+    PyObject *handle;
+    if (!PyArg_ParseTuple(args, "O", &handle))
+    {
+        return NULL;
+    }
+    Model *model = getModel(handle);
+    if (model == NULL)
+    {
+        return NULL;
+    }
+    return Py_BuildValue("(lii)", model->flat->d, model->flat->nol, model->flat->size);
+}
+
+static PyObject *importance(PyObject *self, PyObject *args)
+{
+    PyObject *handle;
+    if (!PyArg_ParseTuple(args, "O", &handle))
+    {
+        return NULL;
+    }
+    Model *model = getModel(handle);
+    if (model == NULL)
+    {
+        return NULL;
+    }
+    PyObject *list = PyList_New((Py_ssize_t)model->importance.size());
+    for (size_t i = 0; list != NULL && i < model->importance.size(); i++)
+    {
+        PyList_SET_ITEM(list, (Py_ssize_t)i, PyFloat_FromDouble(model->importance[i]));
+    }
+    return list;
+}
+
+static PyObject *nodes(PyObject *self, PyObject *args)
+{
+    PyObject *handle;
+    int i;
+    if (!PyArg_ParseTuple(args, "Oi", &handle, &i))
+    {
+        return NULL;
+    }
+    Model *model = getModel(handle);
+    if (model == NULL)
+    {
+        return NULL;
+    }
+    if (i < 0 || i >= model->flat->size)
+    {
+        PyErr_SetString(PyExc_IndexError, "No such tree.");
+        return NULL;
+    }
+
+    FlatTree *tree = model->flat->trees[i];
+    PyObject *feature = PyList_New(tree->numNodes);
+    PyObject *threshold = PyList_New(tree->numNodes);
+    PyObject *child = PyList_New(tree->numNodes);
+    PyObject *leafP = PyList_New(tree->numLeaves);
+    if (feature == NULL || threshold == NULL || child == NULL || leafP == NULL)
+    {
+        Py_XDECREF(feature);
+        Py_XDECREF(threshold);
+        Py_XDECREF(child);
+        Py_XDECREF(leafP);
+        return NULL;
+    }
+    for (long k = 0; k < tree->numNodes; k++)
+    {
+        FlatNode &node = tree->nodes[k];
+        PyList_SET_ITEM(feature, k, PyLong_FromLong(node.feature));
+        PyList_SET_ITEM(threshold, k, PyFloat_FromDouble(node.threshold));
+        PyList_SET_ITEM(child, k, PyLong_FromLong(node.child));
+    }
+    std::vector<double> p(tree->nol);
+    for (long k = 0; k < tree->numLeaves; k++)
+    {
+        tree->copyLeafP(k, p.data(), 1);
+        PyObject *row = PyList_New(tree->nol);
+        for (int j = 0; row != NULL && j < tree->nol; j++)
+        {
+            PyList_SET_ITEM(row, j, PyFloat_FromDouble(p[j]));
+        }
+        PyList_SET_ITEM(leafP, k, row);
+    }
+    if (PyErr_Occurred())
+    {
+        Py_DECREF(feature);
+        Py_DECREF(threshold);
+        Py_DECREF(child);
+        Py_DECREF(leafP);
+        return NULL;
+    }
+    return Py_BuildValue("(NNNN)", feature, threshold, child, leafP);
+}
+
+static PyMethodDef methods[] = {
+    {"train_tree", trainTree, METH_VARARGS, "train_tree(X, Y, W, depth, noc, seed, num_threads) -> handle"},
+    {"train_forest", trainForest, METH_VARARGS, "train_forest(X, Y, size, depth, noc, seed, num_threads) -> handle"},
+    {"run", run, METH_VARARGS, "run(handle, X, Y, P, num_threads), filling Y and P"},
+    {"load", load, METH_VARARGS, "load(path) -> handle of a tree file, forest folder or model file"},
+    {"save", save, METH_VARARGS, "save(handle, path), as a binary model file"},
+    {"info", info, METH_VARARGS, "info(handle) -> (d, nol, size)"},
+    {"importance", importance, METH_VARARGS, "importance(handle) -> list of d feature importances"},
+    {"nodes", nodes, METH_VARARGS, "nodes(handle, i) -> (feature, threshold, child, leafP) of tree i"},
+    {NULL, NULL, 0, NULL}};
+
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT, "_native", "Trees and forests of the C++ library.", -1, methods};
+
+PyMODINIT_FUNC PyInit__native(void)
+{
+    return PyModule_Create(&module);
+}
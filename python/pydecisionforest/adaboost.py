@@ -1,12 +1,14 @@
+import random
 import numpy as np
 from .core import Data
 from .decision_tree import train_decision_tree, run_decision_tree
 
 class AdaBoost:
-    def __init__(self, forest_size=10, depth=5, noc=10):
+    def __init__(self, forest_size=10, depth=5, noc=10, seed=None):
         self.forest_size = forest_size
         self.depth = depth
         self.noc = noc
+        self.seed = seed
         self.trees = []
         self.weights = [] # Alpha values
         self.feature_importance = None
@@ -20,9 +22,10 @@ class AdaBoost:
         self.trees = []
         self.weights = []
         self.feature_importance = np.zeros(d)
+        rng = random if self.seed is None else random.Random(self.seed)
         
         for i in range(self.forest_size):
-            tree = train_decision_tree(X, Y, self.depth, self.noc, W)
+            tree = train_decision_tree(X, Y, self.depth, self.noc, W, seed=rng.getrandbits(64))
             self.trees.append(tree)
             
             # Aggregate importance
@@ -98,8 +101,8 @@ class AdaBoost:
         with open(path, 'rb') as f:
             return pickle.load(f)
 
-def train_adaboost(X, Y, forest_size=10, depth=5, noc=10):
-    model = AdaBoost(forest_size, depth, noc)
+def train_adaboost(X, Y, forest_size=10, depth=5, noc=10, seed=None):
+    model = AdaBoost(forest_size, depth, noc, seed)
     model.fit(X, Y)
     return model.weights, model.feature_importance, model
 
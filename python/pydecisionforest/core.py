@@ -25,11 +25,91 @@ class TreeNode:
         self.left = None
         self.right = None
 
+class FlatTree:
+    """
+    A trained tree as arrays, as FlatTree in DecisionTree.h. Node 0 is the
+    root; split node k sends a row to left[k] if its feature[k] is at most
+    threshold[k], and to right[k] otherwise. Leaves have feature -1, and
+    value holds the label weights of each leaf, zeros for split nodes.
+    """
+    def __init__(self, feature, threshold, left, right, value, eps=1e-10):
+        self.feature = np.asarray(feature, dtype=np.intp)
+        self.threshold = np.asarray(threshold, dtype=float)
+        self.left = np.asarray(left, dtype=np.intp)
+        self.right = np.asarray(right, dtype=np.intp)
+        self.value = np.asarray(value, dtype=float)
+
+        # normalized probabilities of each node, uniform if it has no weight
+        total = self.value.sum(axis=1, keepdims=True)
+        uniform = total[:, 0] <= eps
+        self.prob = self.value / np.where(uniform[:, None], 1.0, total)
+        self.prob[uniform] = 1.0 / self.value.shape[1]
+
+    @staticmethod
+    def from_root(root, nol):
+        nodes = []
+        stack = [root]
+        while stack:
+            node = stack.pop()
+            nodes.append(node)
+            if node.feature != -1 and node.left is not None:
+                stack.append(node.right)
+                stack.append(node.left)
+        index = {id(node): k for k, node in enumerate(nodes)}
+
+        m = len(nodes)
+        feature = np.full(m, -1, dtype=np.intp)
+        threshold = np.zeros(m)
+        left = np.full(m, -1, dtype=np.intp)
+        right = np.full(m, -1, dtype=np.intp)
+        value = np.zeros((m, nol))
+        for k, node in enumerate(nodes):
+            if node.feature != -1 and node.left is not None:
+                feature[k] = node.feature
+                threshold[k] = node.threshold
+                left[k] = index[id(node.left)]
+                right[k] = index[id(node.right)]
+            else:
+                value[k] = node.param
+        return FlatTree(feature, threshold, left, right, value)
+
+    def to_root(self):
+        nodes = [TreeNode(int(f), float(t)) for f, t in zip(self.feature, self.threshold)]
+        for k, node in enumerate(nodes):
+            if node.feature == -1:
+                node.param = self.value[k].copy()
+            else:
+                node.left = nodes[self.left[k]]
+                node.right = nodes[self.right[k]]
+        return nodes[0]
+
+    def find_leaves(self, X):
+        """
+        Leaf of each row of X, moving all rows still at split nodes down one
+        level at a time.
+        """
+        X = np.asarray(X, dtype=float)
+        node = np.zeros(X.shape[0], dtype=np.intp)
+        rows = np.arange(X.shape[0])
+        while rows.size > 0:
+            current = node[rows]
+            feature = self.feature[current]
+            split = feature >= 0
+            rows, current, feature = rows[split], current[split], feature[split]
+            goes_left = X[rows, feature] <= self.threshold[current]
+            node[rows] = np.where(goes_left, self.left[current], self.right[current])
+        return node
+
 class Tree:
-    def __init__(self, depth, noc):
+    def __init__(self, depth, noc, seed=None, batched=True):
         self.depth = depth
         self.noc = noc
+        # per-tree generator; without a seed, None for the global one, so that
+        # random.seed() still applies and the tree still pickles
+        self.rng = None if seed is None else random.Random(seed)
+        self.batched = batched # score all candidates of a node together, see _get_entropy_decreases
         self.root = None
+        self.flat = None # the root as arrays, built by train()
         self.d = 0
         self.nol = 0
         self.importance = None
@@ -50,6 +130,7 @@ class Tree:
             
         indices = np.arange(data.n)
         self.root = self._train_node(indices, data, level=1)
+        self.flat = FlatTree.from_root(self.root, self.nol)
 
     def _train_node(self, indices, data, level):
         node = TreeNode(nol=data.nol)
@@ -59,8 +140,7 @@ class Tree:
             len(indices) < self.min_list or 
             self._pure_list(indices, data)):
             node.feature = -1
-            for idx in indices:
-                node.param[data.Y[idx] - 1] += data.W[idx]
+            node.param = self._label_weights(indices, data)
             return node
 
         # Case 2: Split node
@@ -69,13 +149,24 @@ class Tree:
         largest_entropy_decrease = -self.inf
         
         candidates = self._get_candidates(data)
-        
-        for cand_feature, cand_threshold in candidates:
-            entropy_decrease = self._get_entropy_decrease(data, indices, cand_feature, cand_threshold)
-            if entropy_decrease > largest_entropy_decrease:
-                largest_entropy_decrease = entropy_decrease
-                best_feature = cand_feature
-                best_threshold = cand_threshold
+        if not candidates:
+            # noc == 0: nothing to split on
+            node.feature = -1
+            node.param = self._label_weights(indices, data)
+            return node
+
+        if self.batched:
+            entropy_decreases = self._get_entropy_decreases(data, indices, candidates)
+            best = int(np.argmax(entropy_decreases)) # first of the largest, as the loop below
+            largest_entropy_decrease = entropy_decreases[best]
+            best_feature, best_threshold = candidates[best]
+        else:
+            for cand_feature, cand_threshold in candidates:
+                entropy_decrease = self._get_entropy_decrease(data, indices, cand_feature, cand_threshold)
+                if entropy_decrease > largest_entropy_decrease:
+                    largest_entropy_decrease = entropy_decrease
+                    best_feature = cand_feature
+                    best_threshold = cand_threshold
                 
         # Update importance
         if best_feature != -1:
@@ -85,33 +176,28 @@ class Tree:
         node.threshold = best_threshold
         
         # Split data
-        left_indices = []
-        right_indices = []
-        
-        for idx in indices:
-            if data.X[idx, best_feature] <= best_threshold:
-                left_indices.append(idx)
-            else:
-                right_indices.append(idx)
+        goes_left = data.X[indices, best_feature] <= best_threshold
+        left_indices = indices[goes_left]
+        right_indices = indices[~goes_left]
                 
-        if not left_indices or not right_indices:
+        if len(left_indices) == 0 or len(right_indices) == 0:
             # Failed to split (can happen if all features same but labels diff?)
             # Fallback to leaf
             node.feature = -1
-            for idx in indices:
-                node.param[data.Y[idx] - 1] += data.W[idx]
+            node.param = self._label_weights(indices, data)
             return node
             
-        node.left = self._train_node(np.array(left_indices), data, level + 1)
-        node.right = self._train_node(np.array(right_indices), data, level + 1)
+        node.left = self._train_node(left_indices, data, level + 1)
+        node.right = self._train_node(right_indices, data, level + 1)
         
         return node
 
     def _get_candidates(self, data):
+        rng = random if self.rng is None else self.rng
         candidates = []
         for _ in range(self.noc):
-            feature = random.randint(0, self.d - 1)
-            r = random.uniform(-1, 1)
+            feature = rng.randint(0, self.d - 1)
+            r = rng.uniform(-1, 1)
             threshold = data.mean[feature] + data.std[feature] * self.search_range * r
             candidates.append((feature, threshold))
         return candidates
@@ -154,38 +240,54 @@ class Tree:
             
         return entropy_decrease
 
+    def _get_entropy_decreases(self, data, indices, candidates):
+        # _get_entropy_decrease of all candidates: the comparison matrix of a
+        # chunk of candidates times the label weights of the rows gives the
+        # left label weights of every candidate at once, as a batched bincount;
+        # the dense label weights take n*nol entries of the same budget of 4M,
+        # so with more, each candidate is scored alone by bincount instead
+        budget = 1 << 22
+        if len(indices) * self.nol > budget // 2:
+            return np.array([self._get_entropy_decrease(data, indices, feature, threshold)
+                             for feature, threshold in candidates])
+        subset_X = data.X[indices]
+        label_W = np.zeros((len(indices), self.nol))
+        label_W[np.arange(len(indices)), data.Y[indices] - 1] = data.W[indices]
+        total_counts = label_W.sum(axis=0)
+        total_weight = total_counts.sum()
+        features = np.array([feature for feature, _ in candidates], dtype=np.intp)
+        thresholds = np.array([threshold for _, threshold in candidates])
+
+        entropy_decreases = np.zeros(len(candidates))
+        if total_weight == 0: return entropy_decreases
+        chunk = max(1, (budget - label_W.size) // len(indices)) # comparison matrix and label weights
+        for begin in range(0, len(candidates), chunk):
+            end = min(begin + chunk, len(candidates))
+            left_mask = subset_X[:, features[begin:end]] <= thresholds[begin:end]
+            left_counts = left_mask.T @ label_W
+            right_counts = total_counts - left_counts
+            for counts in (left_counts, right_counts):
+                weight = counts.sum(axis=1)
+                probs = counts / np.where(weight > self.eps, weight, 1.0)[:, None]
+                valid = probs > self.eps
+                entropy = -np.sum(np.where(valid, probs * np.log(np.where(valid, probs, 1.0)), 0.0), axis=1)
+                entropy_decreases[begin:end] -= np.where(weight > self.eps, weight / total_weight * entropy, 0.0)
+        return entropy_decreases
+
+    def _label_weights(self, indices, data):
+        return np.bincount(data.Y[indices] - 1, weights=data.W[indices], minlength=self.nol).astype(float)
+
     def _pure_list(self, indices, data):
         if len(indices) == 0: return True
-        first_label = data.Y[indices[0]]
-        for idx in indices[1:]:
-            if data.Y[idx] != first_label:
-                return False
-        return True
+        return bool(np.all(data.Y[indices] == data.Y[indices[0]]))
 
     def run(self, X):
-        n = X.shape[0]
-        Y = np.zeros(n, dtype=int)
-        P = np.zeros((n, self.nol))
-        
-        for i in range(n):
-            node = self._decide_recursive(self.root, X[i,:])
-            sum_p = np.sum(node.param)
-            if sum_p > self.eps:
-                P[i,:] = node.param / sum_p
-            else:
-                P[i,:] = 1.0 / self.nol # Uniform fallback
-            Y[i] = np.argmax(P[i,:]) + 1
-            
+        if getattr(self, 'flat', None) is None:
+            self.flat = FlatTree.from_root(self.root, self.nol) # pickled before FlatTree
+        leaves = self.flat.find_leaves(X)
+        P = self.flat.prob[leaves]
+        Y = np.argmax(P, axis=1) + 1
         return Y, P
-
-    def _decide_recursive(self, node, feature_vector):
-        if node.feature == -1 or node.left is None:
-            return node
-        
-        if feature_vector[node.feature] <= node.threshold:
-            return self._decide_recursive(node.left, feature_vector)
-        else:
-            return self._decide_recursive(node.right, feature_vector)
     
     def get_importance(self):
         return self.importance
@@ -194,9 +296,37 @@ class Tree:
         import pickle
         with open(path, 'wb') as f:
             pickle.dump(self, f)
-            
+
+    def export(self, path):
+        """
+        Save the tree as the arrays of its FlatTree, in a NumPy .npz file
+        that is loaded without pickle.
+        """
+        if getattr(self, 'flat', None) is None:
+            self.flat = FlatTree.from_root(self.root, self.nol)
+        with open(path, 'wb') as f:
+            np.savez(f, feature=self.flat.feature, threshold=self.flat.threshold,
+                     left=self.flat.left, right=self.flat.right, value=self.flat.value,
+                     importance=self.importance, shape=np.array([self.depth, self.noc, self.d, self.nol]))
+
     @staticmethod
     def load(path):
+        """
+        Load a tree saved by save(), or by export().
+        """
+        with open(path, 'rb') as f:
+            exported = f.read(2) == b'PK' # .npz files are zip archives
+        if exported:
+            with np.load(path, allow_pickle=False) as arrays:
+                depth, noc, d, nol = (int(v) for v in arrays['shape'])
+                tree = Tree(depth, noc)
+                tree.d = d
+                tree.nol = nol
+                tree.importance = arrays['importance']
+                tree.flat = FlatTree(arrays['feature'], arrays['threshold'], arrays['left'],
+                                     arrays['right'], arrays['value'])
+                tree.root = tree.flat.to_root()
+            return tree
         import pickle
         with open(path, 'rb') as f:
             return pickle.load(f)
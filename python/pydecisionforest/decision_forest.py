@@ -1,20 +1,35 @@
+import random
 import numpy as np
 from .decision_tree import train_decision_tree, run_decision_tree
+from . import native
 
 class DecisionForest:
-    def __init__(self, forest_size=10, depth=5, noc=10):
+    def __init__(self, forest_size=10, depth=5, noc=10, seed=None):
         self.forest_size = forest_size
         self.depth = depth
         self.noc = noc
+        self.seed = seed
         self.trees = []
+        self.model = None # the whole forest, if trained by the C++ extension
     
     def fit(self, X, Y):
         """
         Train the Decision Forest.
         """
         self.trees = []
+        self.model = None
+        if native.available:
+            # one forest, its trees trained in parallel
+            self.model = native.train_forest(X, Y, self.forest_size, self.depth, self.noc, self.seed)
+            # copies of its trees, which run as the model does
+            self.trees = self.model.trees
+            for tree in self.trees:
+                tree.depth, tree.noc = self.depth, self.noc
+            return
+        # each tree has its own seed, drawn from the forest's seed
+        rng = random if self.seed is None else random.Random(self.seed)
         for i in range(self.forest_size):
-            tree = train_decision_tree(X, Y, self.depth, self.noc)
+            tree = train_decision_tree(X, Y, self.depth, self.noc, seed=rng.getrandbits(64))
             self.trees.append(tree)
             
     def predict(self, X):
@@ -36,6 +51,8 @@ class DecisionForest:
         Run the forest on X.
         Returns (Y, P).
         """
+        if getattr(self, 'model', None) is not None:
+            return self.model.run(X)
         if not self.trees:
             raise ValueError("Forest not trained yet")
             
@@ -65,11 +82,11 @@ class DecisionForest:
         with open(path, 'rb') as f:
             return pickle.load(f)
 
-def train_decision_forest(X, Y, forest_size=10, depth=5, noc=10):
+def train_decision_forest(X, Y, forest_size=10, depth=5, noc=10, seed=None):
     """
     Functional API for training a forest.
     """
-    forest = DecisionForest(forest_size, depth, noc)
+    forest = DecisionForest(forest_size, depth, noc, seed)
     forest.fit(X, Y)
     return forest
 
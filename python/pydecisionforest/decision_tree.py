@@ -1,6 +1,7 @@
 from .core import Data, Tree
+from . import native
 
-def train_decision_tree(X, Y, depth=5, noc=10, W=None):
+def train_decision_tree(X, Y, depth=5, noc=10, W=None, seed=None):
     """
     Train a single Decision Tree.
     
@@ -10,12 +11,17 @@ def train_decision_tree(X, Y, depth=5, noc=10, W=None):
         depth (int): Maximum depth of the tree.
         noc (int): Number of candidates at each node.
         W (array-like, optional): n x 1 weights.
+        seed (int, optional): Seed of the random candidates. The same seed
+            gives the same tree. Default None uses a random seed.
         
     Returns:
-        Tree: Trained decision tree object.
+        Tree: Trained decision tree object, a native.NativeModel if the C++
+        extension is available.
     """
+    if native.available:
+        return native.train_tree(X, Y, depth, noc, W, seed)
     data = Data(X, Y, W)
-    tree = Tree(depth, noc)
+    tree = Tree(depth, noc, seed)
     tree.train(data)
     return tree
 
@@ -0,0 +1,165 @@
+"""
+Trees and forests of the C++ library (code/DecisionTree.h), through the
+_native extension built by setup.py.
+
+`available` is False if the extension was not built, or if the environment
+variable PYDECISIONFOREST_PURE is set; the pure Python code of core.py is
+used then.
+"""
+import os
+import pickle
+import random
+import tempfile
+import numpy as np
+from .core import FlatTree, Tree, TreeNode
+
+available = False
+_native = None
+if not os.environ.get("PYDECISIONFOREST_PURE"):
+    try:
+        from . import _native
+        available = True
+    except ImportError:
+        pass
+
+
+def _seed(seed):
+    # the C++ seeds are unsigned 64-bit, None draws a random one
+    if seed is None:
+        return random.getrandbits(64)
+    return seed & (2**64 - 1)
+
+
+def _matrix(X):
+    # float64 arrays of any layout are passed as they are, without a copy
+    X = np.asarray(X, dtype=np.float64)
+    if X.ndim != 2:
+        raise ValueError("X should be a 2-D array.")
+    return X
+
+
+class NativeModel:
+    """
+    A tree or forest in the memory of the C++ library.
+
+    It runs like core.Tree, and pickles as a binary model file (see
+    ModelFile.h), which RunDecisionTree, DecisionModel and dforest also read.
+    """
+
+    def __init__(self, handle):
+        self._handle = handle
+        self.d, self.nol, self.size = _native.info(handle)
+        self.importance = np.array(_native.importance(handle))  # zeros if loaded
+
+    def run(self, X, num_threads=0):
+        """
+        Run the model on X, with num_threads threads, 0 for all cores.
+        Returns (Y, P), P averaged over the trees of a forest.
+        """
+        X = _matrix(X)
+        n = X.shape[0]
+        Y = np.empty(n)
+        P = np.empty((n, self.nol), order="F")
+        _native.run(self._handle, X, Y, P, num_threads)
+        return Y.astype(int), P
+
+    def get_importance(self):
+        return self.importance
+
+    def tree(self, i):
+        """
+        Tree i as a core.Tree, built on each call. Its leaves hold
+        probabilities, and its importance is zeros; depth and noc are 0, as
+        the C++ model does not keep them.
+        """
+        feature, threshold, child, leafP = _native.nodes(self._handle, i)
+        nodes = [TreeNode(f, t) for f, t in zip(feature, threshold)]
+        for node, c in zip(nodes, child):
+            if node.feature == -1:
+                node.param = np.array(leafP[c])
+            else:
+                node.left, node.right = nodes[c], nodes[c + 1]
+        tree = Tree(0, 0)
+        tree.root = nodes[0]
+        tree.flat = FlatTree.from_root(tree.root, self.nol)
+        tree.d = self.d
+        tree.nol = self.nol
+        tree.importance = np.zeros(self.d)
+        return tree
+
+    @property
+    def trees(self):
+        """
+        All trees as core.Tree objects, see tree().
+        """
+        return [self.tree(i) for i in range(self.size)]
+
+    @property
+    def root(self):
+        """
+        The first tree as core.TreeNode objects, built on each access.
+        """
+        return self.tree(0).root
+
+    def export(self, path):
+        """
+        Save the model as a binary model file.
+        """
+        _native.save(self._handle, str(path))
+
+    def save(self, path):
+        with open(path, 'wb') as f:
+            pickle.dump(self, f)
+
+    @staticmethod
+    def load(path):
+        with open(path, 'rb') as f:
+            return pickle.load(f)
+
+    def __getstate__(self):
+        fd, path = tempfile.mkstemp(suffix=".model")
+        os.close(fd)
+        try:
+            self.export(path)
+            with open(path, 'rb') as f:
+                data = f.read()
+        finally:
+            os.remove(path)
+        return {"model": data, "importance": self.importance}
+
+    def __setstate__(self, state):
+        fd, path = tempfile.mkstemp(suffix=".model")
+        try:
+            with os.fdopen(fd, 'wb') as f:
+                f.write(state["model"])
+            model = load_model(path)
+        finally:
+            os.remove(path)
+        self.__dict__.update(model.__dict__)
+        self.importance = state["importance"]
+
+
+def train_tree(X, Y, depth, noc, W=None, seed=None, num_threads=0):
+    """
+    Train a tree with the C++ library, see decision_tree.train_decision_tree.
+    """
+    Y = np.ascontiguousarray(Y, dtype=np.intc).ravel()
+    if W is not None:
+        W = np.ascontiguousarray(W, dtype=np.float64).ravel()
+    return NativeModel(_native.train_tree(_matrix(X), Y, W, depth, noc, _seed(seed), num_threads))
+
+
+def train_forest(X, Y, forest_size, depth, noc, seed=None, num_threads=0):
+    """
+    Train a forest with the C++ library, tree i seeded from seed and i.
+    """
+    Y = np.ascontiguousarray(Y, dtype=np.intc).ravel()
+    return NativeModel(_native.train_forest(_matrix(X), Y, forest_size, depth, noc, _seed(seed), num_threads))
+
+
+def load_model(path):
+    """
+    Load a tree file, a forest folder or a binary model file, as saved by
+    the MATLAB interface or dforest.
+    """
+    return NativeModel(_native.load(str(path)))
@@ -56,3 +56,68 @@ def test_adaboost():
     assert accuracy > 0.85
     assert len(weights) == 10
     assert len(importance) == 10
+
+def test_seed():
+    X_train, Y_train = create_synthetic_data(n=300)
+    X_test, _ = create_synthetic_data(n=100)
+
+    forest1 = train_decision_forest(X_train, Y_train, forest_size=3, depth=4, noc=50, seed=7)
+    forest2 = train_decision_forest(X_train, Y_train, forest_size=3, depth=4, noc=50, seed=7)
+    _, P1 = run_decision_forest(X_test, forest1)
+    _, P2 = run_decision_forest(X_test, forest2)
+    assert np.array_equal(P1, P2)
+
+    tree1 = train_decision_tree(X_train, Y_train, depth=4, noc=50, seed=1)
+    tree2 = train_decision_tree(X_train, Y_train, depth=4, noc=50, seed=2)
+    assert tree1.root.threshold != tree2.root.threshold
+
+def test_flat_tree(tmp_path):
+    from pydecisionforest.core import Data, Tree
+    X_train, Y_train = create_synthetic_data(n=300)
+    X_test, _ = create_synthetic_data(n=200)
+    X_test[0, 0] = np.nan
+
+    tree = Tree(depth=5, noc=50, seed=3)
+    tree.train(Data(X_train, Y_train))
+    Y, P = tree.run(X_test)
+
+    # every row follows the path of the node graph
+    for i in range(X_test.shape[0]):
+        node = tree.root
+        while node.feature != -1:
+            node = node.left if X_test[i, node.feature] <= node.threshold else node.right
+        assert np.allclose(P[i], node.param / np.sum(node.param))
+    assert np.array_equal(Y, np.argmax(P, axis=1) + 1)
+
+    # exported arrays load without pickle
+    tree.export(tmp_path / "tree.npz")
+    loaded = Tree.load(tmp_path / "tree.npz")
+    assert np.array_equal(loaded.run(X_test)[1], P)
+    assert np.array_equal(loaded.get_importance(), tree.get_importance())
+    assert loaded.root.threshold == tree.root.threshold
+
+    # a tree without a seed uses the random module, and still pickles
+    unseeded = Tree(depth=5, noc=50)
+    unseeded.train(Data(X_train, Y_train))
+    unseeded.save(tmp_path / "tree.pkl")
+    assert np.array_equal(Tree.load(tmp_path / "tree.pkl").run(X_test)[1], unseeded.run(X_test)[1])
+
+def test_batched_split_search():
+    from pydecisionforest.core import Data, Tree
+    X_train, Y_train = create_synthetic_data(n=500)
+    data = Data(X_train, Y_train, np.random.rand(500))
+
+    # scoring all candidates together chooses the splits of the loop
+    batched = Tree(depth=6, noc=100, seed=4)
+    batched.train(data)
+    reference = Tree(depth=6, noc=100, seed=4, batched=False)
+    reference.train(data)
+    assert np.array_equal(batched.flat.feature, reference.flat.feature)
+    assert np.array_equal(batched.flat.threshold, reference.flat.threshold)
+    assert np.allclose(batched.flat.value, reference.flat.value)
+    assert np.allclose(batched.get_importance(), reference.get_importance())
+
+    # without candidates, both give a single leaf
+    for tree in (Tree(depth=6, noc=0, seed=4), Tree(depth=6, noc=0, seed=4, batched=False)):
+        tree.train(data)
+        assert tree.root.feature == -1
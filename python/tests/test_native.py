@@ -0,0 +1,108 @@
+import os
+import pickle
+import subprocess
+import sys
+import pytest
+import numpy as np
+from pydecisionforest import native, train_decision_tree, train_decision_forest, run_decision_forest
+from test_decision_forest import create_synthetic_data
+
+pytestmark = pytest.mark.skipif(not native.available, reason="C++ extension not built")
+
+def test_layouts():
+    X_train, Y_train = create_synthetic_data(n=500)
+    X_test, _ = create_synthetic_data(n=300)
+
+    # the same data in any layout gives the same model and decisions
+    tree1 = native.train_tree(X_train, Y_train, 6, 50, seed=3)
+    tree2 = native.train_tree(np.asfortranarray(X_train), Y_train, 6, 50, seed=3)
+    Y1, P1 = tree1.run(X_test)
+    Y2, P2 = tree2.run(np.asfortranarray(X_test))
+    Y3, P3 = tree1.run(X_test[::-1])
+    Y4, P4 = tree1.run(np.repeat(X_test, 2, axis=1)[:, ::2])
+    assert np.array_equal(P1, P2)
+    assert np.array_equal(P1, P3[::-1]) and np.array_equal(P1, P4)
+    assert np.array_equal(Y1, Y2)
+    assert np.array_equal(Y1, np.argmax(P1, axis=1) + 1)
+
+def test_forest():
+    X_train, Y_train = create_synthetic_data(n=500)
+    X_test, _ = create_synthetic_data(n=200)
+
+    forest = native.train_forest(X_train, Y_train, 5, 5, 100, seed=7)
+    assert forest.size == 5
+    _, P = forest.run(X_test)
+    _, P1 = forest.run(X_test, num_threads=1)
+    assert np.allclose(P.sum(axis=1), 1)
+    assert np.array_equal(P, P1)
+
+    model = train_decision_forest(X_train, Y_train, forest_size=5, depth=5, noc=100, seed=7)
+    assert np.array_equal(run_decision_forest(X_test, model)[1], P)
+
+    # its trees run alone average to the forest
+    assert len(model.trees) == 5
+    assert np.allclose(sum(tree.run(X_test)[1] for tree in model.trees) / 5, P)
+
+def test_save_load(tmp_path):
+    X_train, Y_train = create_synthetic_data(n=300)
+    X_test, _ = create_synthetic_data(n=100)
+    tree = train_decision_tree(X_train, Y_train, depth=4, noc=50, seed=1)
+    Y, P = tree.run(X_test)
+
+    copy = pickle.loads(pickle.dumps(tree))
+    assert np.array_equal(copy.run(X_test)[1], P)
+    assert np.array_equal(copy.get_importance(), tree.get_importance())
+
+    tree.export(tmp_path / "tree.model")
+    loaded = native.load_model(tmp_path / "tree.model")
+    assert np.array_equal(loaded.run(X_test)[1], P)
+
+    # the root as core.TreeNode objects decides as the tree does
+    node = tree.root
+    while node.feature != -1:
+        node = node.left if X_test[0, node.feature] <= node.threshold else node.right
+    assert np.argmax(node.param) + 1 == Y[0]
+
+def test_errors(tmp_path):
+    X, Y = create_synthetic_data(n=100)
+    with pytest.raises(ValueError):
+        native.train_tree(X, Y - 1, 4, 10)
+    with pytest.raises(ValueError):
+        native.load_model(tmp_path / "missing.tree")
+    tree = native.train_tree(X, Y, 4, 10)
+    with pytest.raises(ValueError):
+        tree.run(X[:, :5])
+
+def test_pure_fallback():
+    code = "from pydecisionforest import native, train_decision_tree; print(native.available)"
+    env = dict(os.environ, PYDECISIONFOREST_PURE="1")
+    out = subprocess.run([sys.executable, "-c", code], env=env, cwd=os.path.dirname(os.path.dirname(os.path.abspath(__file__))), capture_output=True, text=True, check=True)
+    assert out.stdout.strip() == "False"
+
+def test_corrupt_model(tmp_path):
+    import struct
+    X, Y = create_synthetic_data(n=300)
+    tree = native.train_tree(X, Y, 4, 50, seed=1)
+    path = tmp_path / "tree.model"
+    tree.export(path)
+    data = bytearray(path.read_bytes())
+    offset = struct.unpack_from("<Q", data, 64)[0] # node array of the first tree
+
+    def load(patch):
+        corrupt = bytearray(data)
+        patch(corrupt)
+        # FNV-1a of ModelFile::checksum, so only the structure is wrong
+        h = 14695981039346656037
+        for (word,) in struct.iter_unpack("<Q", bytes(corrupt[64:len(corrupt) // 8 * 8])):
+            h = ((h ^ word) * 1099511628211) % 2**64
+        struct.pack_into("<Q", corrupt, 40, h)
+        (tmp_path / "corrupt.model").write_bytes(corrupt)
+        return native.load_model(tmp_path / "corrupt.model")
+
+    assert np.array_equal(load(lambda b: None).run(X)[1], tree.run(X)[1])
+    with pytest.raises(ValueError, match="child"):
+        load(lambda b: struct.pack_into("<i", b, offset + 12, 0)) # root is its own child
+    with pytest.raises(ValueError, match="feature"):
+        load(lambda b: struct.pack_into("<i", b, offset + 8, 10))
+    with pytest.raises(ValueError, match="corrupted"):
+        load(lambda b: struct.pack_into("<Q", b, 72, 2**62)) # numNodes
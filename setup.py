@@ -1,20 +1,34 @@
-from setuptools import setup, find_packages
+import sys
+from setuptools import setup, find_packages, Extension
 
 # Read the contents of README file
 from pathlib import Path
 this_directory = Path(__file__).parent
 long_description = (this_directory / "README.md").read_text()
 
+# The C++ library, built from the headers of code/. It is optional: without a
+# compiler, the package installs with its pure Python implementation only.
+native = Extension(
+    "pydecisionforest._native",
+    sources=["python/pydecisionforest/_native.cpp"],
+    include_dirs=["code"],
+    language="c++",
+    extra_compile_args=[] if sys.platform == "win32" else ["-std=c++11", "-O2", "-pthread"],
+    extra_link_args=[] if sys.platform == "win32" else ["-pthread"],
+    optional=True,
+)
+
 setup(
     name="pydecisionforest",
     version="0.1.2",
-    description="Python implementation of Decision Tree, Decision Forest, and AdaBoost",
+    description="Python interface and implementation of Decision Tree, Decision Forest, and AdaBoost",
     long_description=long_description,
     long_description_content_type='text/markdown',
     author="Quan Wang",
     author_email="wangq10@rpi.edu",
     packages=find_packages(where="python"),
     package_dir={"": "python"},
+    ext_modules=[native],
     install_requires=[
         "numpy>=1.18.0",
     ],